@@ -371,6 +371,29 @@ typedef struct ILISTHEAD ilist_head;
 #endif
 
 
+/*====================================================================*/
+/* IFUTEX - futex mutex (linux only), implemented in inetbase.c       */
+/*====================================================================*/
+#if defined(__linux__) && (!defined(IDISABLE_FUTEX))
+#ifndef __IFUTEX_MUTEX_DEFINED
+#define __IFUTEX_MUTEX_DEFINED
+
+/* state: 0/unlocked, 1/locked, 2/locked with waiters parked in kernel */
+struct iFutexMutex { volatile IINT32 state; volatile int spin; };
+typedef struct iFutexMutex iFutexMutex;
+
+void ifutex_mutex_init(iFutexMutex *mutex);
+void ifutex_mutex_destroy(iFutexMutex *mutex);
+void ifutex_mutex_lock(iFutexMutex *mutex);
+void ifutex_mutex_unlock(iFutexMutex *mutex);
+
+/* returns 1 for locked, 0 for busy */
+int ifutex_mutex_trylock(iFutexMutex *mutex);
+
+#endif
+#endif
+
+
 /*====================================================================*/
 /* IMUTEX - mutex interfaces                                          */
 /*====================================================================*/
@@ -399,6 +422,13 @@ typedef struct ILISTHEAD ilist_head;
 #define IMUTEX_LOCK(m)      EnterCriticalSection((CRITICAL_SECTION*)(m))
 #define IMUTEX_UNLOCK(m)    LeaveCriticalSection((CRITICAL_SECTION*)(m))
 
+#elif defined(IMUTEX_FUTEX) && defined(__IFUTEX_MUTEX_DEFINED)
+#define IMUTEX_TYPE         iFutexMutex
+#define IMUTEX_INIT(m)      ifutex_mutex_init((iFutexMutex*)(m))
+#define IMUTEX_DESTROY(m)   ifutex_mutex_destroy((iFutexMutex*)(m))
+#define IMUTEX_LOCK(m)      ifutex_mutex_lock((iFutexMutex*)(m))
+#define IMUTEX_UNLOCK(m)    ifutex_mutex_unlock((iFutexMutex*)(m))
+
 #elif defined(__unix) || defined(__unix__) || defined(__MACH__)
 #include <unistd.h>
 #include <pthread.h>
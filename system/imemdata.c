@@ -1134,6 +1134,69 @@ ilong ims_flat(const struct IMSTREAM *s, void **pointer)
 	return s->pos_write - s->pos_read;
 }
 
+/* get up to count flat segments from the read position */
+int ims_vector(const struct IMSTREAM *s, void *ptrs[], ilong sizes[],
+	int count)
+{
+	const struct ILISTHEAD *head;
+	iulong posread = s->pos_read;
+	iulong remain = s->size;
+	int n = 0;
+	for (head = s->head.next; head != &s->head && n < count; ) {
+		struct IMSPAGE *current = ilist_entry(head, struct IMSPAGE, head);
+		iulong canread;
+		if (remain == 0) break;
+		head = head->next;
+		if (head == &s->head) canread = s->pos_write - posread;
+		else canread = current->size - posread;
+		if (canread > remain) canread = remain;
+		if (canread > 0) {
+			ptrs[n] = current->data + posread;
+			sizes[n] = (ilong)canread;
+			remain -= canread;
+			n++;
+		}
+		posread = 0;
+	}
+	return n;
+}
+
+/* get contiguous free space at the tail */
+ilong ims_reserve(struct IMSTREAM *s, void **pointer)
+{
+	struct IMSPAGE *current = NULL;
+	ilong canwrite = 0;
+	if (ilist_is_empty(&s->head) == 0) {
+		current = ilist_entry(s->head.prev, struct IMSPAGE, head);
+		canwrite = current->size - s->pos_write;
+	}
+	if (canwrite == 0) {
+		current = ims_page_cache_get(s);
+		if (current == NULL) {
+			if (pointer) pointer[0] = NULL;
+			return 0;
+		}
+		ilist_add_tail(&current->head, &s->head);
+		s->pos_write = 0;
+		canwrite = current->size;
+	}
+	if (pointer) pointer[0] = current->data + s->pos_write;
+	return canwrite;
+}
+
+/* commit data written into the reserved space */
+ilong ims_commit(struct IMSTREAM *s, ilong size)
+{
+	struct IMSPAGE *current;
+	if (size <= 0 || ilist_is_empty(&s->head)) return 0;
+	current = ilist_entry(s->head.prev, struct IMSPAGE, head);
+	if (size > (ilong)(current->size - s->pos_write)) 
+		size = current->size - s->pos_write;
+	s->pos_write += size;
+	s->size += size;
+	return size;
+}
+
 
 /**********************************************************************
  * common string operation
@@ -1388,6 +1388,18 @@ void ims_clear(struct IMSTREAM *s);
 /* get flat ptr and size */
 ilong ims_flat(const struct IMSTREAM *s, void **pointer);
 
+/* get up to count flat segments from the read position, returns the
+   number of segments, used to build iovec for writev/sendmsg */
+int ims_vector(const struct IMSTREAM *s, void *ptrs[], ilong sizes[],
+	int count);
+
+/* get contiguous free space at the tail (allocates a page if needed),
+   write into it directly then call ims_commit, returns space size */
+ilong ims_reserve(struct IMSTREAM *s, void **pointer);
+
+/* commit size bytes written into the space returned by ims_reserve */
+ilong ims_commit(struct IMSTREAM *s, ilong size);
+
 
 
 /**********************************************************************
@@ -28,6 +28,7 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 
 #ifndef __AVM3__
 #include <poll.h>
@@ -39,6 +40,17 @@
 #include <sys/filio.h>
 #endif
 
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <netinet/udp.h>
+#endif
+
+#if defined(__linux__) && (!defined(IDISABLE_FUTEX))
+#include <limits.h>
+#include <linux/futex.h>
+#define IHAVE_FUTEX
+#endif
+
 #elif (defined(_WIN32) || defined(WIN32))
 #if ((!defined(_M_PPC)) && (!defined(_M_PPC_BE)) && (!defined(_XBOX)))
 #include <mmsystem.h>
@@ -440,6 +452,182 @@ void ithread_once(int *control, void (*run_once)(void))
 }
 
 
+/*===================================================================*/
+/* Cross-Platform Atomic Interface                                   */
+/*===================================================================*/
+#if defined(__GNUC__) || defined(__clang__)
+#define IATOMIC_NATIVE_GCC
+#elif defined(_MSC_VER) && (_MSC_VER >= 1400)
+#define IATOMIC_NATIVE_MSC
+#endif
+
+/* atomic add, returns the new value */
+long iatomic_add(volatile long *ptr, long value)
+{
+#if defined(IATOMIC_NATIVE_GCC)
+	return __sync_add_and_fetch(ptr, value);
+#elif defined(IATOMIC_NATIVE_MSC)
+	return InterlockedExchangeAdd(ptr, value) + value;
+#else
+	IMUTEX_TYPE *lock = internal_mutex_ptr((const void*)ptr);
+	long result;
+	IMUTEX_LOCK(lock);
+	ptr[0] += value;
+	result = ptr[0];
+	IMUTEX_UNLOCK(lock);
+	return result;
+#endif
+}
+
+/* atomic add 64 bits, returns the new value */
+IINT64 iatomic_add64(volatile IINT64 *ptr, IINT64 value)
+{
+#if defined(IATOMIC_NATIVE_GCC)
+	return __sync_add_and_fetch(ptr, value);
+#elif defined(IATOMIC_NATIVE_MSC) && (defined(_WIN64) || defined(WIN64))
+	return InterlockedExchangeAdd64((volatile LONG64*)ptr, value) + value;
+#else
+	IMUTEX_TYPE *lock = internal_mutex_ptr((const void*)ptr);
+	IINT64 result;
+	IMUTEX_LOCK(lock);
+	ptr[0] += value;
+	result = ptr[0];
+	IMUTEX_UNLOCK(lock);
+	return result;
+#endif
+}
+
+/* compare and swap, returns 1 for success, 0 for failed */
+int iatomic_cas(volatile long *ptr, long oldval, long newval)
+{
+#if defined(IATOMIC_NATIVE_GCC)
+	return __sync_bool_compare_and_swap(ptr, oldval, newval)? 1 : 0;
+#elif defined(IATOMIC_NATIVE_MSC)
+	return (InterlockedCompareExchange(ptr, newval, oldval) == oldval)? 1 : 0;
+#else
+	IMUTEX_TYPE *lock = internal_mutex_ptr((const void*)ptr);
+	int result = 0;
+	IMUTEX_LOCK(lock);
+	if (ptr[0] == oldval) {
+		ptr[0] = newval;
+		result = 1;
+	}
+	IMUTEX_UNLOCK(lock);
+	return result;
+#endif
+}
+
+/* compare and swap pointer, returns 1 for success, 0 for failed */
+int iatomic_cas_ptr(void * volatile *ptr, void *oldval, void *newval)
+{
+#if defined(IATOMIC_NATIVE_GCC)
+	return __sync_bool_compare_and_swap(ptr, oldval, newval)? 1 : 0;
+#elif defined(IATOMIC_NATIVE_MSC)
+	return (InterlockedCompareExchangePointer(ptr, newval, oldval) == 
+		oldval)? 1 : 0;
+#else
+	IMUTEX_TYPE *lock = internal_mutex_ptr((const void*)ptr);
+	int result = 0;
+	IMUTEX_LOCK(lock);
+	if (ptr[0] == oldval) {
+		ptr[0] = newval;
+		result = 1;
+	}
+	IMUTEX_UNLOCK(lock);
+	return result;
+#endif
+}
+
+/* atomic add 32 bits, returns the new value */
+IINT32 iatomic_add32(volatile IINT32 *ptr, IINT32 value)
+{
+#if defined(IATOMIC_NATIVE_GCC)
+	return __sync_add_and_fetch(ptr, value);
+#elif defined(IATOMIC_NATIVE_MSC)
+	return InterlockedExchangeAdd((volatile LONG*)ptr, value) + value;
+#else
+	IMUTEX_TYPE *lock = internal_mutex_ptr((const void*)ptr);
+	IINT32 result;
+	IMUTEX_LOCK(lock);
+	ptr[0] += value;
+	result = ptr[0];
+	IMUTEX_UNLOCK(lock);
+	return result;
+#endif
+}
+
+/* compare and swap 32 bits, returns 1 for success, 0 for failed */
+int iatomic_cas32(volatile IINT32 *ptr, IINT32 oldval, IINT32 newval)
+{
+#if defined(IATOMIC_NATIVE_GCC)
+	return __sync_bool_compare_and_swap(ptr, oldval, newval)? 1 : 0;
+#elif defined(IATOMIC_NATIVE_MSC)
+	return (InterlockedCompareExchange((volatile LONG*)ptr, newval, 
+		oldval) == oldval)? 1 : 0;
+#else
+	IMUTEX_TYPE *lock = internal_mutex_ptr((const void*)ptr);
+	int result = 0;
+	IMUTEX_LOCK(lock);
+	if (ptr[0] == oldval) {
+		ptr[0] = newval;
+		result = 1;
+	}
+	IMUTEX_UNLOCK(lock);
+	return result;
+#endif
+}
+
+/* exchange 32 bits with full barrier, returns the old value */
+IINT32 iatomic_xchg32(volatile IINT32 *ptr, IINT32 value)
+{
+#if defined(IATOMIC_NATIVE_GCC) && defined(__ATOMIC_SEQ_CST)
+	return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+#elif defined(IATOMIC_NATIVE_GCC)
+	__sync_synchronize();
+	return __sync_lock_test_and_set(ptr, value);
+#elif defined(IATOMIC_NATIVE_MSC)
+	return InterlockedExchange((volatile LONG*)ptr, value);
+#else
+	IMUTEX_TYPE *lock = internal_mutex_ptr((const void*)ptr);
+	IINT32 result;
+	IMUTEX_LOCK(lock);
+	result = ptr[0];
+	ptr[0] = value;
+	IMUTEX_UNLOCK(lock);
+	return result;
+#endif
+}
+
+/* full memory barrier */
+void iatomic_fence(void)
+{
+#if defined(IATOMIC_NATIVE_GCC)
+	__sync_synchronize();
+#elif defined(IATOMIC_NATIVE_MSC)
+	MemoryBarrier();
+#else
+	IMUTEX_TYPE *lock = internal_mutex_get(4);
+	IMUTEX_LOCK(lock);
+	IMUTEX_UNLOCK(lock);
+#endif
+}
+
+/* cpu hint inside spin loops */
+void iatomic_pause(void)
+{
+#if defined(IATOMIC_NATIVE_GCC) && \
+	(defined(__i386__) || defined(__x86_64__) || defined(__amd64__))
+	__asm__ __volatile__ ("pause" ::: "memory");
+#elif defined(IATOMIC_NATIVE_GCC) && defined(__aarch64__)
+	__asm__ __volatile__ ("yield" ::: "memory");
+#elif defined(IATOMIC_NATIVE_GCC)
+	__sync_synchronize();
+#elif defined(IATOMIC_NATIVE_MSC)
+	YieldProcessor();
+#endif
+}
+
+
 /*===================================================================*/
 /* Cross-Platform Socket Interface                                   */
 /*===================================================================*/
@@ -538,6 +726,32 @@ int iaccept(int sock, struct sockaddr *addr, int *addrlen)
 	return hr;
 }
 
+/* accept with IACCEPT_* flags */
+int iaccept4(int sock, struct sockaddr *addr, int *addrlen, int flags)
+{
+	int fd;
+#if defined(__linux__) && defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+	DSOCKLEN_T len = sizeof(struct sockaddr);
+	int mode = 0;
+	if (addrlen) {
+		len = (addrlen[0] > 0)? (DSOCKLEN_T)addrlen[0] : len;
+	}
+	if (flags & IACCEPT_NOBLOCK) mode |= SOCK_NONBLOCK;
+	if (flags & IACCEPT_CLOEXEC) mode |= SOCK_CLOEXEC;
+	fd = accept4(sock, addr, &len, mode);
+	if (fd >= 0 || errno != ENOSYS) {
+		if (addrlen) addrlen[0] = (int)len;
+		return fd;
+	}
+#endif
+	fd = iaccept(sock, addr, addrlen);
+	if (fd >= 0) {
+		if (flags & IACCEPT_NOBLOCK) isocket_enable(fd, ISOCK_NOBLOCK);
+		if (flags & IACCEPT_CLOEXEC) isocket_enable(fd, ISOCK_CLOEXEC);
+	}
+	return fd;
+}
+
 /* get error number */
 int ierrno(void)
 {
@@ -610,6 +824,173 @@ long irecvfrom(int sock, void *buf, long size, int mode,
 	return hr;
 }
 
+#ifndef ISENDV_MAX
+#define ISENDV_MAX 64
+#endif
+
+/* send vector: gather write with sendmsg/WSASend in one syscall */
+long isendv(int sock, const void * const vecptr[], const long veclen[],
+	int count, int mode)
+{
+#if defined(__unix)
+	struct iovec iov[ISENDV_MAX];
+	struct msghdr msg;
+	int i;
+	if (count > ISENDV_MAX) count = ISENDV_MAX;
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = (void*)vecptr[i];
+		iov[i].iov_len = (size_t)veclen[i];
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = count;
+	return (long)sendmsg(sock, &msg, mode);
+#elif defined(_WIN32) && (!defined(_XBOX))
+	WSABUF bufs[ISENDV_MAX];
+	DWORD sent = 0;
+	int i;
+	if (count > ISENDV_MAX) count = ISENDV_MAX;
+	for (i = 0; i < count; i++) {
+		bufs[i].buf = (char*)vecptr[i];
+		bufs[i].len = (u_long)veclen[i];
+	}
+	if (WSASend(sock, bufs, count, &sent, mode, NULL, NULL) != 0) 
+		return -1;
+	return (long)sent;
+#else
+	long total = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		long hr = isend(sock, vecptr[i], veclen[i], mode);
+		if (hr < 0) return (total > 0)? total : hr;
+		total += hr;
+		if (hr < veclen[i]) break;
+	}
+	return total;
+#endif
+}
+
+#ifndef IDGRAM_BATCH
+#define IDGRAM_BATCH 64
+#endif
+
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define IHAVE_MMSG
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+union IDGRAM_CTRL {
+	struct cmsghdr align;
+	char buffer[CMSG_SPACE(sizeof(int))];
+};
+#endif
+
+/* receive datagrams: recvmmsg, or recvfrom one by one */
+int irecvmm(int sock, struct IDGRAM *vec, int count, int mode)
+{
+#ifdef IHAVE_MMSG
+	struct mmsghdr msgs[IDGRAM_BATCH];
+	struct iovec iov[IDGRAM_BATCH];
+	union IDGRAM_CTRL ctrl[IDGRAM_BATCH];
+	int hr, i;
+	if (count > IDGRAM_BATCH) count = IDGRAM_BATCH;
+	memset(msgs, 0, sizeof(struct mmsghdr) * count);
+	for (i = 0; i < count; i++) {
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+		iov[i].iov_base = vec[i].data;
+		iov[i].iov_len = (size_t)vec[i].size;
+		hdr->msg_iov = &iov[i];
+		hdr->msg_iovlen = 1;
+		hdr->msg_name = vec[i].remote;
+		hdr->msg_namelen = (vec[i].remote)? vec[i].addrlen : 0;
+		hdr->msg_control = ctrl[i].buffer;
+		hdr->msg_controllen = sizeof(ctrl[i].buffer);
+	}
+	hr = recvmmsg(sock, msgs, count, mode, NULL);
+	if (hr < 0) return -1;
+	for (i = 0; i < hr; i++) {
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+		struct cmsghdr *cmsg;
+		vec[i].size = (long)msgs[i].msg_len;
+		vec[i].addrlen = (int)hdr->msg_namelen;
+		vec[i].segment = 0;
+		for (cmsg = CMSG_FIRSTHDR(hdr); cmsg; 
+				cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+			if (cmsg->cmsg_level == SOL_UDP && 
+				cmsg->cmsg_type == UDP_GRO) {
+				int segment;
+				memcpy(&segment, CMSG_DATA(cmsg), sizeof(int));
+				if (segment < vec[i].size) vec[i].segment = segment;
+			}
+		}
+	}
+	return hr;
+#else
+	int i;
+	for (i = 0; i < count; i++) {
+		long hr = irecvfrom(sock, vec[i].data, vec[i].size, mode,
+			vec[i].remote, &vec[i].addrlen);
+		if (hr < 0) return (i > 0)? i : -1;
+		vec[i].size = hr;
+		vec[i].segment = 0;
+	}
+	return count;
+#endif
+}
+
+/* send datagrams: sendmmsg with UDP_SEGMENT, or sendto one by one */
+int isendmm(int sock, const struct IDGRAM *vec, int count, int mode)
+{
+#ifdef IHAVE_MMSG
+	struct mmsghdr msgs[IDGRAM_BATCH];
+	struct iovec iov[IDGRAM_BATCH];
+	union IDGRAM_CTRL ctrl[IDGRAM_BATCH];
+	int i;
+	if (count > IDGRAM_BATCH) count = IDGRAM_BATCH;
+	memset(msgs, 0, sizeof(struct mmsghdr) * count);
+	for (i = 0; i < count; i++) {
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+		iov[i].iov_base = vec[i].data;
+		iov[i].iov_len = (size_t)vec[i].size;
+		hdr->msg_iov = &iov[i];
+		hdr->msg_iovlen = 1;
+		hdr->msg_name = vec[i].remote;
+		hdr->msg_namelen = (vec[i].remote)? vec[i].addrlen : 0;
+		if (vec[i].segment > 0 && vec[i].size > vec[i].segment) {
+			struct cmsghdr *cmsg;
+			IUINT16 segment = (IUINT16)vec[i].segment;
+			memset(&ctrl[i], 0, sizeof(ctrl[i]));
+			hdr->msg_control = ctrl[i].buffer;
+			hdr->msg_controllen = CMSG_SPACE(sizeof(IUINT16));
+			cmsg = CMSG_FIRSTHDR(hdr);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(IUINT16));
+			memcpy(CMSG_DATA(cmsg), &segment, sizeof(IUINT16));
+		}
+	}
+	return sendmmsg(sock, msgs, count, mode);
+#else
+	int i;
+	for (i = 0; i < count; i++) {
+		long hr = isendto(sock, vec[i].data, vec[i].size, mode,
+			vec[i].remote, vec[i].addrlen);
+		if (hr < 0) return (i > 0)? i : -1;
+	}
+	return count;
+#endif
+}
+
 /* i/o control */
 int iioctl(int sock, unsigned long cmd, unsigned long *argp)
 {
@@ -1117,6 +1498,30 @@ int ikeepalive(int sock, int keepcnt, int keepidle, int keepintvl)
 	return 0;
 }
 
+/* ideferaccept: wake listener only when data arrives (linux), seconds */
+int ideferaccept(int sock, int seconds)
+{
+#ifdef TCP_DEFER_ACCEPT
+	int value = (seconds > 0)? seconds : 0;
+	return isetsockopt(sock, IPPROTO_TCP, TCP_DEFER_ACCEPT, 
+		(char*)&value, sizeof(value));
+#else
+	return -1000;
+#endif
+}
+
+/* ifastopen: enable tcp fast open on listener with queue length qlen */
+int ifastopen(int sock, int qlen)
+{
+#ifdef TCP_FASTOPEN
+	int value = (qlen > 0)? qlen : 0;
+	return isetsockopt(sock, IPPROTO_TCP, TCP_FASTOPEN, 
+		(char*)&value, sizeof(value));
+#else
+	return -1000;
+#endif
+}
+
 
 
 /*-------------------------------------------------------------------*/
@@ -1412,6 +1817,14 @@ int isocket_option(int fd, int option, int enable)
 		retval = -1000;
 		#endif
 		break;
+	case ISOCK_UDPGRO:
+		#ifdef IHAVE_MMSG
+		retval = isetsockopt(fd, SOL_UDP, UDP_GRO, 
+			(char*)&value, sizeof(value));
+		#else
+		retval = -1000;
+		#endif
+		break;
 	case ISOCK_CLOEXEC:
 		#ifdef FD_CLOEXEC
 		value = fcntl(fd, F_GETFD);
@@ -3889,6 +4302,142 @@ static int ipx_poll_event(ipolld ipd, int *fd, int *event, void **user)
 
 
 
+/*===================================================================*/
+/* Futex Primitives (linux)                                          */
+/*===================================================================*/
+#ifdef IHAVE_FUTEX
+
+#ifndef FUTEX_WAIT_PRIVATE
+#define FUTEX_WAIT_PRIVATE	FUTEX_WAIT
+#endif
+
+#ifndef FUTEX_WAKE_PRIVATE
+#define FUTEX_WAKE_PRIVATE	FUTEX_WAKE
+#endif
+
+/* max spin rounds before parking in the kernel */
+#ifndef IFUTEX_SPIN_LIMIT
+#define IFUTEX_SPIN_LIMIT	100
+#endif
+
+
+/* sleep while *addr == value, returns 1 for waked up, 0 for timeout */
+static int ifutex_wait(volatile IINT32 *addr, IINT32 value, 
+	unsigned long millisec)
+{
+	struct timespec ts, *pts = NULL;
+	if (millisec != IEVENT_INFINITE) {
+		ts.tv_sec = (time_t)(millisec / 1000);
+		ts.tv_nsec = (long)((millisec % 1000) * 1000000);
+		pts = &ts;
+	}
+	if (syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, pts, 
+				NULL, 0) != 0) {
+		if (errno == ETIMEDOUT) return 0;
+	}
+	return 1;
+}
+
+/* wake up at most count threads sleeping on addr */
+static void ifutex_wake(volatile IINT32 *addr, int count)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+
+/*-------------------------------------------------------------------*/
+/* Futex Mutex                                                       */
+/*-------------------------------------------------------------------*/
+void ifutex_mutex_init(iFutexMutex *mutex)
+{
+	mutex->state = 0;
+	mutex->spin = 0;
+}
+
+void ifutex_mutex_destroy(iFutexMutex *mutex)
+{
+	assert(mutex->state == 0);
+	mutex->state = 0;
+}
+
+/* returns 1 for locked, 0 for busy */
+int ifutex_mutex_trylock(iFutexMutex *mutex)
+{
+	return iatomic_cas32(&mutex->state, 0, 1);
+}
+
+void ifutex_mutex_lock(iFutexMutex *mutex)
+{
+	int limit, i, c;
+	if (iatomic_cas32(&mutex->state, 0, 1)) 
+		return;
+	/* adaptive spinning: the limit follows recent successful spins */
+	limit = mutex->spin * 2 + 10;
+	if (limit > IFUTEX_SPIN_LIMIT) limit = IFUTEX_SPIN_LIMIT;
+	for (i = 0; i < limit; i++) {
+		iatomic_pause();
+		if (mutex->state == 0) {
+			if (iatomic_cas32(&mutex->state, 0, 1)) {
+				mutex->spin += (i - mutex->spin) / 8;
+				return;
+			}
+		}
+	}
+	mutex->spin += (limit - mutex->spin) / 8;
+	/* park: mark the lock contended, so unlock will wake us */
+	c = iatomic_xchg32(&mutex->state, 2);
+	while (c != 0) {
+		ifutex_wait(&mutex->state, 2, IEVENT_INFINITE);
+		c = iatomic_xchg32(&mutex->state, 2);
+	}
+}
+
+void ifutex_mutex_unlock(iFutexMutex *mutex)
+{
+	if (iatomic_xchg32(&mutex->state, 0) == 2) {
+		ifutex_wake(&mutex->state, 1);
+	}
+}
+
+
+/*-------------------------------------------------------------------*/
+/* Futex Sequence: wait until seq changes                            */
+/*-------------------------------------------------------------------*/
+typedef struct
+{
+	volatile IINT32 seq;
+	volatile IINT32 waiters;
+}	iFutexSeq;
+
+/* seq must be read before releasing the outer lock, returns 1 for 
+   waked up, 0 for timeout */
+static int ifutex_seq_park(iFutexSeq *fs, IINT32 seq, 
+	unsigned long millisec)
+{
+	int i, hr;
+	for (i = 0; i < IFUTEX_SPIN_LIMIT; i++) {
+		if (fs->seq != seq) return 1;
+		iatomic_pause();
+	}
+	iatomic_add32(&fs->waiters, 1);
+	hr = ifutex_wait(&fs->seq, seq, millisec);
+	iatomic_add32(&fs->waiters, -1);
+	return hr;
+}
+
+/* bump seq and wake at most count parked threads */
+static void ifutex_seq_wake(iFutexSeq *fs, int count)
+{
+	iatomic_add32(&fs->seq, 1);
+	if (fs->waiters > 0) {
+		ifutex_wake(&fs->seq, count);
+	}
+}
+
+#endif
+
+
+
 /*===================================================================*/
 /* Condition Variable Cross-Platform Interface                       */
 /*===================================================================*/
@@ -4098,6 +4647,52 @@ static void iposix_cond_win32_wake_all(iConditionVariableWin32 *cond)
 	}
 }
 
+#elif defined(IHAVE_FUTEX)
+/*-------------------------------------------------------------------*/
+/* Futex Condition Variable Interface                                */
+/*-------------------------------------------------------------------*/
+typedef iFutexSeq iConditionVariableFutex;
+
+static int iposix_cond_futex_init(iConditionVariableFutex *cond)
+{
+	cond->seq = 0;
+	cond->waiters = 0;
+	return 0;
+}
+
+static void iposix_cond_futex_destroy(iConditionVariableFutex *cond)
+{
+	assert(cond->waiters == 0);
+}
+
+static int iposix_cond_futex_sleep_cs_time(iConditionVariableFutex *cond,
+	IMUTEX_TYPE *mutex, unsigned long millisec)
+{
+	int seq = cond->seq;
+	int hr;
+	IMUTEX_UNLOCK(mutex);
+	hr = ifutex_seq_park(cond, seq, millisec);
+	IMUTEX_LOCK(mutex);
+	return hr;
+}
+
+static int iposix_cond_futex_sleep_cs(iConditionVariableFutex *cond,
+	IMUTEX_TYPE *mutex)
+{
+	iposix_cond_futex_sleep_cs_time(cond, mutex, IEVENT_INFINITE);
+	return 1;
+}
+
+static void iposix_cond_futex_wake(iConditionVariableFutex *cond)
+{
+	ifutex_seq_wake(cond, 1);
+}
+
+static void iposix_cond_futex_wake_all(iConditionVariableFutex *cond)
+{
+	ifutex_seq_wake(cond, INT_MAX);
+}
+
 #else
 /*-------------------------------------------------------------------*/
 /* Posix Condition Variable Interface                                */
@@ -4206,6 +4801,8 @@ struct iConditionVariable
 {
 #ifdef _WIN32
 	iConditionVariableWin32 cond;
+#elif defined(IHAVE_FUTEX)
+	iConditionVariableFutex cond;
 #else
 	iConditionVariablePosix cond;
 #endif
@@ -4220,6 +4817,8 @@ iConditionVariable *iposix_cond_new(void)
 	if (cond == NULL) return NULL;
 #ifdef _WIN32
 	result = iposix_cond_win32_init(&cond->cond);
+#elif defined(IHAVE_FUTEX)
+	result = iposix_cond_futex_init(&cond->cond);
 #else
 	result = iposix_cond_posix_init(&cond->cond);
 #endif
@@ -4234,6 +4833,8 @@ void iposix_cond_delete(iConditionVariable *cond)
 {
 #ifdef _WIN32
 	iposix_cond_win32_destroy(&cond->cond);
+#elif defined(IHAVE_FUTEX)
+	iposix_cond_futex_destroy(&cond->cond);
 #else
 	iposix_cond_posix_destroy(&cond->cond);
 #endif
@@ -4246,6 +4847,8 @@ int iposix_cond_sleep_cs_time(iConditionVariable *cond,
 {
 #ifdef _WIN32
 	return iposix_cond_win32_sleep_cs_time(&cond->cond, mutex, millisec);
+#elif defined(IHAVE_FUTEX)
+	return iposix_cond_futex_sleep_cs_time(&cond->cond, mutex, millisec);
 #else
 	return iposix_cond_posix_sleep_cs_time(&cond->cond, mutex, millisec);
 #endif
@@ -4256,6 +4859,8 @@ int iposix_cond_sleep_cs(iConditionVariable *cond,
 {
 #ifdef _WIN32
 	return iposix_cond_win32_sleep_cs(&cond->cond, mutex);
+#elif defined(IHAVE_FUTEX)
+	return iposix_cond_futex_sleep_cs(&cond->cond, mutex);
 #else
 	return iposix_cond_posix_sleep_cs(&cond->cond, mutex);
 #endif
@@ -4265,6 +4870,8 @@ void iposix_cond_wake(iConditionVariable *cond)
 {
 #ifdef _WIN32
 	iposix_cond_win32_wake(&cond->cond);
+#elif defined(IHAVE_FUTEX)
+	iposix_cond_futex_wake(&cond->cond);
 #else
 	iposix_cond_posix_wake(&cond->cond);
 #endif
@@ -4274,6 +4881,8 @@ void iposix_cond_wake_all(iConditionVariable *cond)
 {
 #ifdef _WIN32
 	iposix_cond_win32_wake_all(&cond->cond);
+#elif defined(IHAVE_FUTEX)
+	iposix_cond_futex_wake_all(&cond->cond);
 #else
 	iposix_cond_posix_wake_all(&cond->cond);
 #endif
@@ -4283,6 +4892,93 @@ void iposix_cond_wake_all(iConditionVariable *cond)
 /*===================================================================*/
 /* Event Cross-Platform Interface                                    */
 /*===================================================================*/
+#ifdef IHAVE_FUTEX
+
+/* futex event: lock free, signal is consumed by cas(1 -> 0) */
+struct iEventPosix
+{
+	volatile IINT32 signal;
+	volatile IINT32 waiters;
+};
+
+
+/* create futex event */
+iEventPosix *iposix_event_new(void)
+{
+	iEventPosix *event;
+	event = (iEventPosix*)ikmalloc(sizeof(iEventPosix));
+	if (event == NULL) return NULL;
+	event->signal = 0;
+	event->waiters = 0;
+	return event;
+}
+
+/* delete futex event */
+void iposix_event_delete(iEventPosix *event)
+{
+	if (event) {
+		assert(event->waiters == 0);
+		event->signal = 0;
+		ikfree(event);
+	}
+}
+
+/* set signal to 1 */
+void iposix_event_set(iEventPosix *event)
+{
+	assert(event);
+	if (iatomic_xchg32(&event->signal, 1) == 0) {
+		if (event->waiters > 0) {
+			ifutex_wake(&event->signal, 1);
+		}
+	}
+}
+
+/* set signal to 0 */
+void iposix_event_reset(iEventPosix *event)
+{
+	assert(event);
+	iatomic_xchg32(&event->signal, 0);
+}
+
+/* sleep until signal is 1(returns 1), or timeout(returns 0) */
+int iposix_event_wait(iEventPosix *event, unsigned long millisec)
+{
+	IINT64 deadline = 0;
+	int i;
+	assert(event);
+	if (iatomic_cas32(&event->signal, 1, 0)) 
+		return 1;
+	if (millisec == 0) 
+		return 0;
+	for (i = 0; i < IFUTEX_SPIN_LIMIT; i++) {
+		iatomic_pause();
+		if (event->signal) {
+			if (iatomic_cas32(&event->signal, 1, 0)) 
+				return 1;
+		}
+	}
+	if (millisec != IEVENT_INFINITE) {
+		deadline = iclock64() + millisec;
+	}
+	while (1) {
+		unsigned long wait = IEVENT_INFINITE;
+		if (millisec != IEVENT_INFINITE) {
+			IINT64 current = iclock64();
+			if (current >= deadline) break;
+			wait = (unsigned long)(deadline - current);
+		}
+		iatomic_add32(&event->waiters, 1);
+		ifutex_wait(&event->signal, 0, wait);
+		iatomic_add32(&event->waiters, -1);
+		if (iatomic_cas32(&event->signal, 1, 0)) 
+			return 1;
+	}
+	return 0;
+}
+
+#else
+
 struct iEventPosix
 {
 	iConditionVariable *cond;
@@ -4372,6 +5068,8 @@ int iposix_event_wait(iEventPosix *event, unsigned long millisec)
 	return result;
 }
 
+#endif
+
 
 /*===================================================================*/
 /* ReadWriteLock Cross-Platform Interface                            */
@@ -4658,6 +5356,362 @@ void iposix_rwlock_r_unlock(iRwLockPosix *rwlock)
 }
 
 
+/*===================================================================*/
+/* CPU Topology Interface                                            */
+/*===================================================================*/
+#ifndef ICPU_NODE_MAX
+#define ICPU_NODE_MAX		256
+#endif
+
+void icpu_set_zero(iCpuSet *set)
+{
+	memset(set, 0, sizeof(iCpuSet));
+}
+
+void icpu_set_add(iCpuSet *set, int cpu)
+{
+	if (cpu < 0 || cpu >= ICPU_SET_SIZE) return;
+	set->bits[cpu / ICPU_SET_BITS] |= 1ul << (cpu % ICPU_SET_BITS);
+}
+
+void icpu_set_del(iCpuSet *set, int cpu)
+{
+	if (cpu < 0 || cpu >= ICPU_SET_SIZE) return;
+	set->bits[cpu / ICPU_SET_BITS] &= ~(1ul << (cpu % ICPU_SET_BITS));
+}
+
+int icpu_set_has(const iCpuSet *set, int cpu)
+{
+	if (cpu < 0 || cpu >= ICPU_SET_SIZE) return 0;
+	return (set->bits[cpu / ICPU_SET_BITS] >> (cpu % ICPU_SET_BITS)) & 1;
+}
+
+int icpu_set_count(const iCpuSet *set)
+{
+	int count = 0, i;
+	for (i = 0; i < ICPU_SET_SIZE; i++) {
+		if (icpu_set_has(set, i)) count++;
+	}
+	return count;
+}
+
+#ifdef __linux__
+/* read a small text file from /sys, returns size or -1 */
+static int icpu_sys_read(const char *path, char *buf, int size)
+{
+	FILE *fp = fopen(path, "r");
+	int n;
+	if (fp == NULL) return -1;
+	n = (int)fread(buf, 1, size - 1, fp);
+	fclose(fp);
+	if (n < 0) n = 0;
+	buf[n] = 0;
+	return n;
+}
+
+/* read an integer from /sys, returns defval for failure */
+static int icpu_sys_int(const char *path, int defval)
+{
+	char text[32];
+	if (icpu_sys_read(path, text, 32) <= 0) return defval;
+	if (text[0] < '0' || text[0] > '9') return defval;
+	return (int)atoi(text);
+}
+
+/* parse cpu list like "0-3,8-11", returns count */
+static int icpu_sys_list(const char *path, iCpuSet *set)
+{
+	char text[4096];
+	const char *p = text;
+	int count = 0;
+	icpu_set_zero(set);
+	if (icpu_sys_read(path, text, 4096) <= 0) return -1;
+	while (*p) {
+		int lo, hi;
+		if (*p < '0' || *p > '9') { p++; continue; }
+		for (lo = 0; *p >= '0' && *p <= '9'; p++) lo = lo * 10 + (*p - '0');
+		hi = lo;
+		if (*p == '-') {
+			for (hi = 0, p++; *p >= '0' && *p <= '9'; p++) 
+				hi = hi * 10 + (*p - '0');
+		}
+		for (; lo <= hi; lo++, count++) icpu_set_add(set, lo);
+	}
+	return count;
+}
+#endif
+
+/* flat layout: each cpu is a core in package 0 and node 0 */
+static int icpu_topology_flat(iCpuInfo *cpus, int limit)
+{
+	int ncpus = 1, i;
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	ncpus = (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (ncpus < 1) ncpus = 1;
+	if (ncpus > limit) ncpus = limit;
+	for (i = 0; i < ncpus; i++) {
+		cpus[i].cpu = i;
+		cpus[i].core = i;
+		cpus[i].smt = 0;
+		cpus[i].package = 0;
+		cpus[i].node = 0;
+		cpus[i].nodeid = 0;
+	}
+	return ncpus;
+}
+
+/* compare cpus by node, package, core and id */
+static int icpu_info_compare(const iCpuInfo *a, const iCpuInfo *b)
+{
+	if (a->node != b->node) return (a->node < b->node)? -1 : 1;
+	if (a->package != b->package) return (a->package < b->package)? -1 : 1;
+	if (a->core != b->core) return (a->core < b->core)? -1 : 1;
+	if (a->cpu != b->cpu) return (a->cpu < b->cpu)? -1 : 1;
+	return 0;
+}
+
+/* replace raw node (which = 0) or package (which = 1) ids with their
+   rank, returns number of distinct ids */
+static int icpu_topology_dense(iCpuInfo *cpus, int ncpus, int which)
+{
+	int count = 0, i;
+	while (1) {
+		int minval = -1;
+		for (i = 0; i < ncpus; i++) {
+			int v = (which == 0)? cpus[i].node : cpus[i].package;
+			if (v >= 0 && (minval < 0 || v < minval)) minval = v;
+		}
+		if (minval < 0) break;
+		for (i = 0; i < ncpus; i++) {
+			int *v = (which == 0)? &cpus[i].node : &cpus[i].package;
+			if (*v == minval) *v = -1 - count;
+		}
+		count++;
+	}
+	for (i = 0; i < ncpus; i++) {
+		int *v = (which == 0)? &cpus[i].node : &cpus[i].package;
+		*v = -1 - *v;
+	}
+	return count;
+}
+
+/* discover topology: reads /sys on linux, flat layout elsewhere */
+iCpuTopology *icpu_topology_new(void)
+{
+	iCpuTopology *topo;
+	iCpuInfo *cpus;
+	int ncpus = 0, i, j;
+
+	topo = (iCpuTopology*)ikmalloc(sizeof(iCpuTopology));
+	if (topo == NULL) return NULL;
+
+	cpus = (iCpuInfo*)ikmalloc(sizeof(iCpuInfo) * ICPU_SET_SIZE);
+	if (cpus == NULL) {
+		ikfree(topo);
+		return NULL;
+	}
+
+#ifdef __linux__
+	{
+		iCpuSet online, nodeset;
+		char path[128];
+		int node;
+		if (icpu_sys_list("/sys/devices/system/cpu/online", &online) > 0) {
+			for (i = 0; i < ICPU_SET_SIZE; i++) {
+				if (icpu_set_has(&online, i) == 0) continue;
+				cpus[ncpus].cpu = i;
+				sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/"
+						"physical_package_id", i);
+				cpus[ncpus].package = icpu_sys_int(path, 0);
+				if (cpus[ncpus].package < 0) cpus[ncpus].package = 0;
+				sprintf(path, "/sys/devices/system/cpu/cpu%d/topology/"
+						"core_id", i);
+				cpus[ncpus].core = icpu_sys_int(path, i);
+				cpus[ncpus].node = 0;
+				cpus[ncpus].nodeid = 0;
+				cpus[ncpus].smt = 0;
+				ncpus++;
+			}
+			for (node = 0; node < ICPU_NODE_MAX; node++) {
+				sprintf(path, "/sys/devices/system/node/node%d/cpulist", 
+						node);
+				if (icpu_sys_list(path, &nodeset) <= 0) continue;
+				for (i = 0; i < ncpus; i++) {
+					if (icpu_set_has(&nodeset, cpus[i].cpu)) {
+						cpus[i].node = node;
+						cpus[i].nodeid = node;
+					}
+				}
+			}
+		}
+	}
+#endif
+
+	if (ncpus == 0) {
+		ncpus = icpu_topology_flat(cpus, ICPU_SET_SIZE);
+	}
+
+	/* insertion sort, cpu count is small */
+	for (i = 1; i < ncpus; i++) {
+		iCpuInfo key = cpus[i];
+		for (j = i - 1; j >= 0; j--) {
+			if (icpu_info_compare(&cpus[j], &key) <= 0) break;
+			cpus[j + 1] = cpus[j];
+		}
+		cpus[j + 1] = key;
+	}
+
+	/* convert raw ids into dense indexes, cores are contiguous after
+	   sorting so a new core starts whenever node/package/core changes */
+	topo->ncpus = ncpus;
+	topo->nnodes = icpu_topology_dense(cpus, ncpus, 0);
+	topo->npackages = icpu_topology_dense(cpus, ncpus, 1);
+	topo->ncores = 0;
+	for (i = 0, j = -1; i < ncpus; i++) {
+		int rawcore = cpus[i].core;
+		if (i > 0 && cpus[i].node == cpus[i - 1].node &&
+			cpus[i].package == cpus[i - 1].package && rawcore == j) {
+			cpus[i].core = topo->ncores - 1;
+			cpus[i].smt = cpus[i - 1].smt + 1;
+		}	else {
+			cpus[i].core = topo->ncores++;
+			cpus[i].smt = 0;
+		}
+		j = rawcore;
+	}
+	topo->cpus = cpus;
+	return topo;
+}
+
+void icpu_topology_delete(iCpuTopology *topo)
+{
+	if (topo == NULL) return;
+	if (topo->cpus) ikfree(topo->cpus);
+	topo->cpus = NULL;
+	ikfree(topo);
+}
+
+/* get cpus of the given core, returns cpu count */
+int icpu_topology_core(const iCpuTopology *topo, int core, iCpuSet *set)
+{
+	int count = 0, i;
+	icpu_set_zero(set);
+	for (i = 0; i < topo->ncpus; i++) {
+		if (topo->cpus[i].core == core) {
+			icpu_set_add(set, topo->cpus[i].cpu);
+			count++;
+		}
+	}
+	return count;
+}
+
+/* get cpus of the given node, returns cpu count */
+int icpu_topology_node(const iCpuTopology *topo, int node, iCpuSet *set)
+{
+	int count = 0, i;
+	icpu_set_zero(set);
+	for (i = 0; i < topo->ncpus; i++) {
+		if (topo->cpus[i].node == node) {
+			icpu_set_add(set, topo->cpus[i].cpu);
+			count++;
+		}
+	}
+	return count;
+}
+
+/* os numa node id of the cpu running the caller */
+int icpu_topology_current(const iCpuTopology *topo)
+{
+	if (topo == NULL || topo->ncpus <= 0) return -1;
+#if defined(__linux__) && defined(__NR_getcpu)
+	{
+		unsigned int cpu = 0;
+		int i;
+		if (syscall(__NR_getcpu, &cpu, NULL, NULL) == 0) {
+			for (i = 0; i < topo->ncpus; i++) {
+				if (topo->cpus[i].cpu == (int)cpu) 
+					return topo->cpus[i].nodeid;
+			}
+		}
+	}
+#endif
+	return topo->cpus[0].nodeid;
+}
+
+/* map os numa node id to node index, returns -1 if not found */
+static int icpu_topology_index(const iCpuTopology *topo, int nodeid)
+{
+	int i;
+	for (i = 0; i < topo->ncpus; i++) {
+		if (topo->cpus[i].nodeid == nodeid) return topo->cpus[i].node;
+	}
+	return -1;
+}
+
+/* placement for the index-th worker, returns cpu count */
+int icpu_topology_place(const iCpuTopology *topo, int mode, int node,
+	int index, iCpuSet *set)
+{
+	int first = -1, ncores = 0, i;
+	icpu_set_zero(set);
+	if (topo == NULL || topo->ncpus <= 0 || index < 0) return -1;
+	if (node == ICPU_NODE_CURRENT) {
+		node = icpu_topology_current(topo);
+	}
+	if (node >= 0) {
+		node = icpu_topology_index(topo, node);
+		if (node < 0) return -2;
+	}
+	if (mode == ICPU_PIN_NODE) {
+		if (node < 0) node = index % topo->nnodes;
+		return icpu_topology_node(topo, node, set);
+	}
+	if (mode != ICPU_PIN_CORE) return -3;
+	if (node < 0) {
+		return icpu_topology_core(topo, index % topo->ncores, set);
+	}
+	/* cores of one node are contiguous */
+	for (i = 0; i < topo->ncpus; i++) {
+		if (topo->cpus[i].node != node) continue;
+		if (first < 0) first = topo->cpus[i].core;
+		ncores = topo->cpus[i].core - first + 1;
+	}
+	if (ncores <= 0) return -4;
+	return icpu_topology_core(topo, first + index % ncores, set);
+}
+
+/* set affinity of the calling thread, returns zero for success */
+int icpu_affinity_current(const iCpuSet *set)
+{
+	if (set == NULL || icpu_set_count(set) == 0) return -1;
+#if defined(_WIN32)
+	{
+		DWORD_PTR mask = 0;
+		int i;
+		for (i = 0; i < (int)(sizeof(DWORD_PTR) * 8); i++) {
+			if (icpu_set_has(set, i)) mask |= ((DWORD_PTR)1) << i;
+		}
+		if (mask == 0) return -2;
+		if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) 
+			return -3;
+	}
+	return 0;
+#elif defined(__linux__) && defined(__NR_sched_setaffinity)
+	if (syscall(__NR_sched_setaffinity, 0, sizeof(set->bits), 
+		set->bits) != 0) 
+		return -3;
+	return 0;
+#else
+	return -4;
+#endif
+}
+
+
 /*===================================================================*/
 /* Threading Cross-Platform Interface                                */
 /*===================================================================*/
@@ -4695,7 +5749,10 @@ struct iPosixThread
 	pthread_attr_t attr;
 	pthread_t ptid;
 	int attr_inited;
+	int ktid;
 #endif
+	int affinity_set;
+	iCpuSet affinity;
 	IUINT32 mask;
 	char name[IPOSIX_THREAD_NAME_SIZE];
 };
@@ -4793,6 +5850,7 @@ iPosixThread *iposix_thread_new(iPosixThreadFun target, void *obj,
 
 #ifndef _WIN32
 	thread->attr_inited = 0;
+	thread->ktid = 0;
 #endif
 
 	thread->event = iposix_event_new();
@@ -4831,6 +5889,8 @@ iPosixThread *iposix_thread_new(iPosixThreadFun target, void *obj,
 	thread->sched = 0;
 	thread->sig = 0;
 	thread->alive = 1;
+	thread->affinity_set = 0;
+	icpu_set_zero(&thread->affinity);
 	thread->mask = 0x11223344;
 	return thread;
 }
@@ -5088,6 +6148,24 @@ static void iposix_thread_bootstrap(iPosixThread *thread)
 		return;
 	}
 
+#if defined(__linux__) && defined(SYS_gettid)
+	thread->ktid = (int)syscall(SYS_gettid);
+#endif
+
+	/* apply affinity requested before start, the start caller holds
+	   thread->lock until we are started, so read it under critical */
+	{
+		iCpuSet affinity;
+		int affinity_set;
+		IMUTEX_LOCK(&thread->critical);
+		affinity_set = thread->affinity_set;
+		affinity = thread->affinity;
+		IMUTEX_UNLOCK(&thread->critical);
+		if (affinity_set) {
+			icpu_affinity_current(&affinity);
+		}
+	}
+
 	thread->state = IPOSIX_THREAD_STATE_STARTED;
 	iposix_event_set(thread->event);
 
@@ -5336,34 +6414,43 @@ int iposix_thread_set_stack(iPosixThread *thread, int stacksize)
 /* set cpu mask affinity, the thread must be started (supports win/linux)*/
 int iposix_thread_affinity(iPosixThread *thread, unsigned int cpumask)
 {
-	int retval = 0;
+	iCpuSet set;
+	int i;
 	if (thread == NULL || cpumask == 0) return -1;
+	icpu_set_zero(&set);
+	for (i = 0; i < 32; i++) {
+		if (cpumask & (((unsigned int)1) << i)) 
+			icpu_set_add(&set, i);
+	}
+	return iposix_thread_set_affinity(thread, &set);
+}
+
+
+/* set cpu set affinity (supports win/linux), if the thread hasn't been
+   started, the set will be applied when it starts */
+int iposix_thread_set_affinity(iPosixThread *thread, const iCpuSet *set)
+{
+	int retval = 0;
+	if (thread == NULL || set == NULL) return -1;
+	if (icpu_set_count(set) == 0) return -1;
 	IMUTEX_LOCK(&thread->lock);
+	IMUTEX_LOCK(&thread->critical);
+	thread->affinity = *set;
+	thread->affinity_set = 1;
+	IMUTEX_UNLOCK(&thread->critical);
 	if (thread->state == IPOSIX_THREAD_STATE_STARTED) {
 	#if defined(_WIN32)
-		DWORD mask = (DWORD)cpumask;
-		if (SetThreadAffinityMask(thread->th, mask) == 0) retval = -2;
-	#elif defined(__CYGWIN__) || defined(__AVM3__)
-		retval = -3;
-	#elif defined(__linux__) && (!defined(__ANDROID__))
-		#if 0
-		cpu_set_t mask;
+		DWORD_PTR mask = 0;
 		int i;
-		CPU_ZERO(&mask);
-		for (i = 0; i < 32; i++) {
-			if (cpumask & (((unsigned int)1) << i)) 
-				CPU_SET(i, &mask);
+		for (i = 0; i < (int)(sizeof(DWORD_PTR) * 8); i++) {
+			if (icpu_set_has(set, i)) mask |= ((DWORD_PTR)1) << i;
 		}
-		#ifdef __ANDROID__
-		retval = syscall(__NR_sched_setaffinity, thread->ptid,
-			sizeof(mask), &mask);
-		#else
-		retval = sched_setaffinity(thread->ptid, sizeof(mask), &mask);
-		#endif
-		if (retval != 0) retval = -2;
-		#else
-		retval = -3;
-		#endif
+		if (mask == 0) retval = -2;
+		else if (SetThreadAffinityMask(thread->th, mask) == 0) retval = -2;
+	#elif defined(__linux__) && defined(__NR_sched_setaffinity)
+		if (syscall(__NR_sched_setaffinity, thread->ktid, 
+			sizeof(set->bits), set->bits) != 0) 
+			retval = -2;
 	#else
 		retval = -4;
 	#endif
@@ -5667,11 +6754,42 @@ struct iPosixSemaphore
 {
 	iulong value;
 	iulong maximum;
+#ifdef IHAVE_FUTEX
+	iFutexMutex lock;
+	iFutexSeq cond_not_full;
+	iFutexSeq cond_not_empty;
+#else
 	IMUTEX_TYPE lock;
 	iConditionVariable *cond_not_full;
 	iConditionVariable *cond_not_empty;
+#endif
 };
 
+#ifdef IHAVE_FUTEX
+#define ISEM_LOCK(s)		ifutex_mutex_lock(&((s)->lock))
+#define ISEM_UNLOCK(s)		ifutex_mutex_unlock(&((s)->lock))
+#define ISEM_SLEEP(s, c, t)	iposix_sem_futex_sleep((s), &((s)->c), (t))
+#define ISEM_WAKE(s, c)		ifutex_seq_wake(&((s)->c), INT_MAX)
+
+/* release sem->lock and park on the sequence, lock held on return */
+static int iposix_sem_futex_sleep(iPosixSemaphore *sem, iFutexSeq *cond,
+	unsigned long millisec)
+{
+	int seq = cond->seq;
+	int hr;
+	ifutex_mutex_unlock(&sem->lock);
+	hr = ifutex_seq_park(cond, seq, millisec);
+	ifutex_mutex_lock(&sem->lock);
+	return hr;
+}
+
+#else
+#define ISEM_LOCK(s)		IMUTEX_LOCK(&((s)->lock))
+#define ISEM_UNLOCK(s)		IMUTEX_UNLOCK(&((s)->lock))
+#define ISEM_SLEEP(s, c, t)	iposix_cond_sleep_cs_time((s)->c, &((s)->lock), t)
+#define ISEM_WAKE(s, c)		iposix_cond_wake_all((s)->c)
+#endif
+
 
 /* create a semaphore with a maximum count, and initial count is 0. */
 iPosixSemaphore* iposix_sem_new(iulong maximum)
@@ -5683,6 +6801,13 @@ iPosixSemaphore* iposix_sem_new(iulong maximum)
 	sem->value = 0;
 	sem->maximum = maximum;
 
+#ifdef IHAVE_FUTEX
+	ifutex_mutex_init(&sem->lock);
+	sem->cond_not_full.seq = 0;
+	sem->cond_not_full.waiters = 0;
+	sem->cond_not_empty.seq = 0;
+	sem->cond_not_empty.waiters = 0;
+#else
 	sem->cond_not_full = iposix_cond_new();
 	if (sem->cond_not_full == NULL) {
 		ikfree(sem);
@@ -5697,6 +6822,7 @@ iPosixSemaphore* iposix_sem_new(iulong maximum)
 	}
 
 	IMUTEX_INIT(&sem->lock);
+#endif
 
 	return sem;
 }
@@ -5706,6 +6832,9 @@ iPosixSemaphore* iposix_sem_new(iulong maximum)
 void iposix_sem_delete(iPosixSemaphore *sem)
 {
 	if (sem) {
+#ifdef IHAVE_FUTEX
+		ifutex_mutex_destroy(&sem->lock);
+#else
 		if (sem->cond_not_full) {
 			iposix_cond_delete(sem->cond_not_full);
 			sem->cond_not_full = NULL;
@@ -5715,6 +6844,7 @@ void iposix_sem_delete(iPosixSemaphore *sem)
 			sem->cond_not_empty = NULL;
 		}
 		IMUTEX_DESTROY(&sem->lock);
+#endif
 		sem->value = 0;
 		sem->maximum = 0;
 		ikfree(sem);
@@ -5731,15 +6861,14 @@ iulong iposix_sem_post(iPosixSemaphore *sem, iulong count,
 
 	if (count == 0) return 0;
 
-	IMUTEX_LOCK(&sem->lock);
+	ISEM_LOCK(sem);
 
 	if (sem->value == sem->maximum && millisec != 0) {
 		if (millisec != IEVENT_INFINITE) {
 			while (sem->value == sem->maximum) {
 				IUINT32 ts = iclock();
 				IUINT32 last = millisec > 10000? 10000 : (IUINT32)millisec;
-				iposix_cond_sleep_cs_time(sem->cond_not_full, 
-					&sem->lock, last);
+				ISEM_SLEEP(sem, cond_not_full, last);
 				last = (iclock() - ts);
 				if (millisec <= (unsigned long)last) {
 					break;
@@ -5749,7 +6878,7 @@ iulong iposix_sem_post(iPosixSemaphore *sem, iulong count,
 			}
 		}	else {
 			while (sem->value == sem->maximum) {
-				iposix_cond_sleep_cs(sem->cond_not_full, &sem->lock);
+				ISEM_SLEEP(sem, cond_not_full, IEVENT_INFINITE);
 			}
 		}
 	}
@@ -5760,10 +6889,10 @@ iulong iposix_sem_post(iPosixSemaphore *sem, iulong count,
 		increased = (count < caninc)? count : caninc;
 		sem->value += increased;
 		if (hook) hook(increased, arg);
-		iposix_cond_wake_all(sem->cond_not_empty);
+		ISEM_WAKE(sem, cond_not_empty);
 	}
 
-	IMUTEX_UNLOCK(&sem->lock);
+	ISEM_UNLOCK(sem);
 
 	return increased;
 }
@@ -5777,15 +6906,14 @@ iulong iposix_sem_wait(iPosixSemaphore *sem, iulong count,
 
 	if (count == 0) return 0;
 
-	IMUTEX_LOCK(&sem->lock);
+	ISEM_LOCK(sem);
 
 	if (sem->value == 0 && millisec != 0) {
 		if (millisec != IEVENT_INFINITE) {
 			while (sem->value == 0) {
 				IUINT32 ts = iclock();
 				IUINT32 last = millisec > 10000? 10000 : (IUINT32)millisec;
-				iposix_cond_sleep_cs_time(sem->cond_not_empty, 
-					&sem->lock, last);
+				ISEM_SLEEP(sem, cond_not_empty, last);
 				last = iclock() - ts;
 				if (millisec <= (unsigned long)last) {
 					break;
@@ -5795,7 +6923,7 @@ iulong iposix_sem_wait(iPosixSemaphore *sem, iulong count,
 			}
 		}	else {
 			while (sem->value == 0) {
-				iposix_cond_sleep_cs(sem->cond_not_empty, &sem->lock);
+				ISEM_SLEEP(sem, cond_not_empty, IEVENT_INFINITE);
 			}
 		}
 	}
@@ -5804,10 +6932,10 @@ iulong iposix_sem_wait(iPosixSemaphore *sem, iulong count,
 		decreased = (count < sem->value)? count : sem->value;
 		sem->value -= decreased;
 		if (hook) hook(decreased, arg);
-		iposix_cond_wake_all(sem->cond_not_full);
+		ISEM_WAKE(sem, cond_not_full);
 	}
 
-	IMUTEX_UNLOCK(&sem->lock);
+	ISEM_UNLOCK(sem);
 
 	return decreased;
 }
@@ -5820,15 +6948,14 @@ iulong iposix_sem_peek(iPosixSemaphore *sem, iulong count,
 
 	if (count == 0) return 0;
 
-	IMUTEX_LOCK(&sem->lock);
+	ISEM_LOCK(sem);
 
 	if (sem->value == 0 && millisec != 0) {
 		if (millisec != IEVENT_INFINITE) {
 			while (sem->value == 0) {
 				IUINT32 ts = iclock();
 				IUINT32 last = millisec > 10000? 10000 : (IUINT32)millisec;
-				iposix_cond_sleep_cs_time(sem->cond_not_empty, 
-					&sem->lock, last);
+				ISEM_SLEEP(sem, cond_not_empty, last);
 				last = iclock() - ts;
 				if (millisec <= (unsigned long)last) {
 					break;
@@ -5838,7 +6965,7 @@ iulong iposix_sem_peek(iPosixSemaphore *sem, iulong count,
 			}
 		}	else {
 			while (sem->value == 0) {
-				iposix_cond_sleep_cs(sem->cond_not_empty, &sem->lock);
+				ISEM_SLEEP(sem, cond_not_empty, IEVENT_INFINITE);
 			}
 		}
 	}
@@ -5848,7 +6975,7 @@ iulong iposix_sem_peek(iPosixSemaphore *sem, iulong count,
 		if (hook) hook(decreased, arg);
 	}
 
-	IMUTEX_UNLOCK(&sem->lock);
+	ISEM_UNLOCK(sem);
 
 	return decreased;
 }
@@ -5857,9 +6984,9 @@ iulong iposix_sem_peek(iPosixSemaphore *sem, iulong count,
 iulong iposix_sem_value(iPosixSemaphore *sem)
 {
 	iulong x;
-	IMUTEX_LOCK(&sem->lock);
+	ISEM_LOCK(sem);
 	x = sem->value;
-	IMUTEX_UNLOCK(&sem->lock);
+	ISEM_UNLOCK(sem);
 	return x;
 }
 
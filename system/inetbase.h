@@ -232,6 +232,8 @@ typedef SOCKET Socket;
 #include "config.h"
 #endif
 
+#include "imembase.h"
+
 #if defined(i386) || defined(__i386__) || defined(__i386) || \
 	defined(_M_IX86) || defined(_X86_) || defined(__THW_INTEL)
 	#ifndef __i386__
@@ -330,6 +332,7 @@ typedef SOCKET Socket;
 #define ISOCK_CLOEXEC	5		/* flag - FD_CLOEXEC      */
 #define ISOCK_REUSEPORT 8		/* flag - reuse port(bsd) */
 #define ISOCK_UNIXREUSE	16		/* use reuseaddr in bsd   */
+#define ISOCK_UDPGRO	32		/* flag - udp gro (linux) */
 
 #define ISOCK_ERECV		1		/* event - recv           */
 #define ISOCK_ESEND		2		/* event - send           */
@@ -469,6 +472,38 @@ int ithread_close(ilong id);
 void ithread_once(int *control, void (*run_once)(void));
 
 
+/*===================================================================*/
+/* Cross-Platform Atomic Interface                                   */
+/*===================================================================*/
+
+/* atomic add, returns the new value */
+long iatomic_add(volatile long *ptr, long value);
+
+/* atomic add 64 bits, returns the new value */
+IINT64 iatomic_add64(volatile IINT64 *ptr, IINT64 value);
+
+/* compare and swap, returns 1 for success, 0 for failed */
+int iatomic_cas(volatile long *ptr, long oldval, long newval);
+
+/* compare and swap pointer, returns 1 for success, 0 for failed */
+int iatomic_cas_ptr(void * volatile *ptr, void *oldval, void *newval);
+
+/* atomic add 32 bits, returns the new value */
+IINT32 iatomic_add32(volatile IINT32 *ptr, IINT32 value);
+
+/* compare and swap 32 bits, returns 1 for success, 0 for failed */
+int iatomic_cas32(volatile IINT32 *ptr, IINT32 oldval, IINT32 newval);
+
+/* exchange 32 bits with full barrier, returns the old value */
+IINT32 iatomic_xchg32(volatile IINT32 *ptr, IINT32 value);
+
+/* full memory barrier */
+void iatomic_fence(void);
+
+/* cpu hint inside spin loops */
+void iatomic_pause(void);
+
+
 /*===================================================================*/
 /* Cross-Platform Mutex Interface                                    */
 /*===================================================================*/
@@ -542,6 +577,12 @@ int ilisten(int sock, int count);
 /* accept */
 int iaccept(int sock, struct sockaddr *addr, int *addrlen);
 
+#define IACCEPT_NOBLOCK		1		/* accepted fd is non-blocking */
+#define IACCEPT_CLOEXEC		2		/* accepted fd has FD_CLOEXEC  */
+
+/* accept with IACCEPT_* flags, uses accept4 to skip fcntl if possible */
+int iaccept4(int sock, struct sockaddr *addr, int *addrlen, int flags);
+
 /* get errno */
 int ierrno(void);
 
@@ -559,6 +600,26 @@ long isendto(int sock, const void *buf, long size, int mode,
 long irecvfrom(int sock, void *buf, long size, int mode, 
 	struct sockaddr *addr, int *addrlen);
 
+/* send vector: gather write with sendmsg/WSASend in one syscall */
+long isendv(int sock, const void * const vecptr[], const long veclen[],
+	int count, int mode);
+
+/* datagram descriptor for irecvmm / isendmm */
+struct IDGRAM
+{
+	void *data;                 /* payload buffer */
+	long size;                  /* recv: capacity in, length out */
+	struct sockaddr *remote;    /* remote address buffer */
+	int addrlen;                /* recv: capacity in, length out */
+	int segment;                /* gso/gro segment size, 0 for none */
+};
+
+/* receive up to count datagrams with recvmmsg, returns count or -1 */
+int irecvmm(int sock, struct IDGRAM *vec, int count, int mode);
+
+/* send up to count datagrams with sendmmsg, returns count or -1 */
+int isendmm(int sock, const struct IDGRAM *vec, int count, int mode);
+
 /* ioctl */
 int iioctl(int sock, unsigned long cmd, unsigned long *argp);
 
@@ -595,6 +656,12 @@ int ipollfds(const int *fds, const int *events, int *revents, int count,
 /* ikeepalive: tcp keep alive option */
 int ikeepalive(int sock, int keepcnt, int keepidle, int keepintvl);
 
+/* ideferaccept: wake listener only when data arrives (linux), seconds */
+int ideferaccept(int sock, int seconds);
+
+/* ifastopen: enable tcp fast open on listener with queue length qlen */
+int ifastopen(int sock, int qlen);
+
 /* send all data */
 int isendall(int sock, const void *buf, long size);
 
@@ -815,6 +882,84 @@ void iposix_rwlock_r_lock(iRwLockPosix *rwlock);
 void iposix_rwlock_r_unlock(iRwLockPosix *rwlock);
 
 
+/*===================================================================*/
+/* CPU Topology Interface                                            */
+/*===================================================================*/
+#ifndef ICPU_SET_SIZE
+#define ICPU_SET_SIZE		1024
+#endif
+
+#define ICPU_SET_BITS		(8 * sizeof(unsigned long))
+
+/* cpu set: the same layout as the linux kernel affinity mask */
+struct iCpuSet
+{
+	unsigned long bits[ICPU_SET_SIZE / (8 * sizeof(unsigned long))];
+};
+
+typedef struct iCpuSet iCpuSet;
+
+/* logical cpu description, core/package/node are dense indexes */
+struct iCpuInfo
+{
+	int cpu;		/* os cpu id */
+	int core;		/* physical core index */
+	int smt;		/* hardware thread index inside the core */
+	int package;	/* socket index */
+	int node;		/* numa node index */
+	int nodeid;		/* os numa node id */
+};
+
+typedef struct iCpuInfo iCpuInfo;
+
+/* online cpus sorted by node, package, core and smt */
+struct iCpuTopology
+{
+	int ncpus;
+	int ncores;
+	int npackages;
+	int nnodes;
+	iCpuInfo *cpus;
+};
+
+typedef struct iCpuTopology iCpuTopology;
+
+#define ICPU_PIN_NONE		0	/* no affinity */
+#define ICPU_PIN_CORE		1	/* one physical core (with its siblings) */
+#define ICPU_PIN_NODE		2	/* all cpus of one numa node */
+
+#define ICPU_NODE_ANY		(-1)	/* place across every node */
+#define ICPU_NODE_CURRENT	(-2)	/* node of the calling thread */
+
+void icpu_set_zero(iCpuSet *set);
+void icpu_set_add(iCpuSet *set, int cpu);
+void icpu_set_del(iCpuSet *set, int cpu);
+int icpu_set_has(const iCpuSet *set, int cpu);
+int icpu_set_count(const iCpuSet *set);
+
+/* discover topology: reads /sys on linux, flat layout elsewhere */
+iCpuTopology *icpu_topology_new(void);
+
+void icpu_topology_delete(iCpuTopology *topo);
+
+/* get cpus of the given core / node, returns cpu count */
+int icpu_topology_core(const iCpuTopology *topo, int core, iCpuSet *set);
+int icpu_topology_node(const iCpuTopology *topo, int node, iCpuSet *set);
+
+/* placement for the index-th worker: mode is ICPU_PIN_CORE/NODE, 
+   node >= 0 keeps every worker inside that os numa node id (or the
+   node of the caller for ICPU_NODE_CURRENT), returns cpu count */
+int icpu_topology_place(const iCpuTopology *topo, int mode, int node,
+	int index, iCpuSet *set);
+
+/* os numa node id of the cpu running the caller, or the first node 
+   when it can't be told */
+int icpu_topology_current(const iCpuTopology *topo);
+
+/* set affinity of the calling thread, returns zero for success */
+int icpu_affinity_current(const iCpuSet *set);
+
+
 /*===================================================================*/
 /* Threading Cross-Platform Interface                                */
 /*===================================================================*/
@@ -865,6 +1010,10 @@ int iposix_thread_set_stack(iPosixThread *thread, int stacksize);
 /* set cpu mask affinity, the thread must be started (supports win/linux)*/
 int iposix_thread_affinity(iPosixThread *thread, unsigned int cpumask);
 
+/* set cpu set affinity (supports win/linux), if the thread hasn't been
+   started, the set will be applied when it starts */
+int iposix_thread_set_affinity(iPosixThread *thread, const iCpuSet *set);
+
 
 /* set signal: if thread is NULL, current thread object is used */
 void iposix_thread_set_signal(iPosixThread *thread, int sig);
@@ -875,6 +1024,9 @@ int iposix_thread_get_signal(iPosixThread *thread);
 /* get name: if thread is NULL, current thread object is used */
 const char *iposix_thread_get_name(const iPosixThread *thread);
 
+/* get current thread object, returns NULL for non-iposix threads */
+iPosixThread *iposix_thread_current(void);
+
 
 /*===================================================================*/
 /* Timer Cross-Platform Interface                                    */
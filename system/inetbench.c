@@ -0,0 +1,631 @@
+//=====================================================================
+//
+// inetbench.c - kcp/itcp benchmark over the network simulator
+//
+// NOTE:
+// for more information, please see the readme file.
+//
+//=====================================================================
+#include "inetbench.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+//=====================================================================
+// PROFILES
+//=====================================================================
+const ibench_profile ibench_profiles[] = {
+	{ "lan",      2,   0, 10, 1000,       0, 0 },
+	{ "fastest", 60,   5, 30, 1000,       0, 0 },
+	{ "fast",   120,  10, 40, 1000,       0, 0 },
+	{ "normal", 200,  10, 50, 1000,       0, 0 },
+	{ "slow",   800,  20, 60, 1000,       0, 0 },
+	{ "narrow", 120,   2, 20,  200,  256000, 0 },
+	{ "lossy",  200,  20, 50,  200,  512000, 0 },
+	{ NULL,       0,   0,  0,    0,       0, 0 },
+};
+
+void ibench_config_init(ibench_config *config)
+{
+	config->seed1 = 1;
+	config->seed2 = 2;
+	config->count = 1000;
+	config->size = 1000;
+	config->interval = 0;
+	config->timeout = 600000;
+	config->nodelay = 1;
+	config->update = 10;
+	config->resend = 2;
+	config->nc = 1;
+	config->sndwnd = 128;
+	config->rcvwnd = 128;
+	config->ring = 0;
+	config->sack = 0;
+	config->fec = 0;
+	config->mtu = 1400;
+	config->tcpbuf = 0;
+	config->tcp_nodelay = 1;
+}
+
+
+//=====================================================================
+// RUN CONTEXT
+//=====================================================================
+#define IBENCH_KCP_PUSH		81			// IKCP_CMD_PUSH
+#define IBENCH_HEADER		24			// kcp and itcp header size
+
+struct IBENCHCTX
+{
+	iSimNet net;
+	const ibench_config *config;
+	void *sender;						// ikcpcb or itcpcb writing data
+	ikcpfec *fec[2];					// kcp fec codec of each peer
+	IUINT32 start;						// first message scheduled
+	IUINT32 snd_max;					// highest sequence sent
+	int snd_init;
+	long sent;
+	long received;
+	long *sendts;
+	long *latency;
+	char *message;
+	char *stream;						// itcp reassembly
+	long slen;
+	ibench_result *result;
+	clock_t clock;
+};
+
+typedef struct IBENCHCTX ibench_ctx;
+
+static int ibench_ctx_init(ibench_ctx *ctx, const ibench_profile *profile,
+	const ibench_config *config, ibench_result *result)
+{
+	long count = config->count;
+	if (count <= 0 || config->size < 8) return -1;
+	ctx->sendts = (long*)ikmem_malloc(sizeof(long) * count * 2);
+	ctx->message = (char*)ikmem_malloc(config->size * 2);
+	if (ctx->sendts == NULL || ctx->message == NULL) {
+		if (ctx->sendts) ikmem_free(ctx->sendts);
+		if (ctx->message) ikmem_free(ctx->message);
+		return -2;
+	}
+	ctx->latency = ctx->sendts + count;
+	ctx->stream = ctx->message + config->size;
+	ctx->slen = 0;
+	ctx->config = config;
+	ctx->sender = NULL;
+	ctx->fec[0] = NULL;
+	ctx->fec[1] = NULL;
+	ctx->start = 0;
+	ctx->snd_max = 0;
+	ctx->snd_init = 0;
+	ctx->sent = 0;
+	ctx->received = 0;
+	ctx->result = result;
+	memset(result, 0, sizeof(ibench_result));
+	isim_init(&ctx->net, profile->rtt, profile->lost, profile->amb,
+		profile->limit, profile->mode);
+	isim_seed(&ctx->net, config->seed1, config->seed2);
+	isim_bandwidth(&ctx->net, profile->bandwidth);
+	ctx->clock = clock();
+	return 0;
+}
+
+static int ibench_compare(const void *a, const void *b)
+{
+	long x = *(const long*)a, y = *(const long*)b;
+	return (x < y)? -1 : ((x > y)? 1 : 0);
+}
+
+static void ibench_ctx_finish(ibench_ctx *ctx, IUINT32 current)
+{
+	ibench_result *result = ctx->result;
+	long n = ctx->received;
+	double cpu = (double)(clock() - ctx->clock) * 1000.0 / CLOCKS_PER_SEC;
+	double bytes = (double)n * ctx->config->size;
+
+	result->complete = (n == ctx->config->count && result->errors == 0);
+	result->messages = n;
+	result->elapsed = (long)current;
+	if (current > 0) result->goodput = bytes * 1000.0 / current;
+	if (n > 0) {
+		qsort(ctx->latency, n, sizeof(long), ibench_compare);
+		result->p50 = ctx->latency[(n - 1) * 50 / 100];
+		result->p99 = ctx->latency[(n - 1) * 99 / 100];
+		result->pmax = ctx->latency[n - 1];
+	}
+	if (result->segments > 0) {
+		result->retrans = (double)result->resent / result->segments;
+	}
+	if (bytes > 0) result->cpu = cpu * 1048576.0 / bytes;
+
+	isim_destroy(&ctx->net);
+	ikmem_free(ctx->sendts);
+	ikmem_free(ctx->message);
+}
+
+// next message is due: bulk mode fills the window, otherwise one per
+// interval after start
+static int ibench_due(const ibench_ctx *ctx, IUINT32 current)
+{
+	if (ctx->sent >= ctx->config->count) return 0;
+	if (ctx->config->interval <= 0) return 1;
+	return itimediff(current, ctx->start +
+		(IUINT32)(ctx->sent * ctx->config->interval)) >= 0;
+}
+
+static const char *ibench_produce(ibench_ctx *ctx, IUINT32 current)
+{
+	char *ptr = ctx->message;
+	long i, size = ctx->config->size;
+	iencode32u_lsb(ptr, (IUINT32)ctx->sent);
+	for (i = 4; i < size; i++) {
+		ptr[i] = (char)((ctx->sent + i) & 0xff);
+	}
+	// latency counts from the schedule, not from when it fit the buffer
+	if (ctx->config->interval > 0) {
+		current = ctx->start + (IUINT32)(ctx->sent * ctx->config->interval);
+	}
+	ctx->sendts[ctx->sent++] = (long)current;
+	return ptr;
+}
+
+static void ibench_consume(ibench_ctx *ctx, const char *data, long size,
+	IUINT32 current)
+{
+	IUINT32 index;
+	long i;
+	idecode32u_lsb(data, &index);
+	if (size != ctx->config->size || (long)index != ctx->received) {
+		ctx->result->errors++;
+		return;
+	}
+	for (i = 4; i < size; i++) {
+		if (data[i] != (char)((index + i) & 0xff)) {
+			ctx->result->errors++;
+			return;
+		}
+	}
+	ctx->latency[ctx->received] = (long)current - ctx->sendts[index];
+	ctx->received++;
+}
+
+// account a data segment ending at 'next', segments which end at or
+// below the highest one sent are retransmissions
+static void ibench_account(ibench_ctx *ctx, IUINT32 next)
+{
+	ibench_result *result = ctx->result;
+	result->segments++;
+	if (ctx->snd_init && itimediff(next, ctx->snd_max) <= 0) {
+		result->resent++;
+	}	else {
+		ctx->snd_max = next;
+		ctx->snd_init = 1;
+	}
+}
+
+static void ibench_wire(ibench_ctx *ctx, int peer, const char *buf,
+	long len)
+{
+	ctx->result->packets++;
+	ctx->result->bytes += len;
+	isim_send(isim_peer(&ctx->net, peer), buf, len);
+}
+
+
+//=====================================================================
+// KCP
+//=====================================================================
+static int ibench_fec_output(const char *buf, int len, ikcpfec *fec,
+	void *user)
+{
+	ibench_ctx *ctx = (ibench_ctx*)user;
+	ibench_wire(ctx, (fec == ctx->fec[0])? 0 : 1, buf, len);
+	return 0;
+}
+
+static int ibench_kcp_output(const char *buf, int len, ikcpcb *kcp,
+	void *user)
+{
+	ibench_ctx *ctx = (ibench_ctx*)user;
+	int peer = (kcp == ctx->sender)? 0 : 1;
+	if (kcp == ctx->sender) {
+		const char *ptr = buf;
+		long size = len;
+		while (size >= IBENCH_HEADER) {
+			IUINT32 sn, length;
+			idecode32u_lsb(ptr + 12, &sn);
+			idecode32u_lsb(ptr + 20, &length);
+			if ((IUINT8)ptr[4] == IBENCH_KCP_PUSH) {
+				ibench_account(ctx, sn);
+			}
+			ptr += IBENCH_HEADER + length;
+			size -= IBENCH_HEADER + (long)length;
+		}
+	}
+	if (ctx->fec[peer]) {
+		ikcp_fec_output(ctx->fec[peer], buf, len);
+	}	else {
+		ibench_wire(ctx, peer, buf, len);
+	}
+	return 0;
+}
+
+// feed a datagram from the wire to kcp, through fec when enabled
+static void ibench_kcp_input(ibench_ctx *ctx, int peer, ikcpcb *kcp,
+	const char *data, long size)
+{
+	if (ctx->fec[peer]) {
+		ikcp_fec_input(ctx->fec[peer], data, size, kcp);
+	}	else {
+		ikcp_input(kcp, data, size);
+	}
+}
+
+int ibench_kcp(const ibench_profile *profile, const ibench_config *config,
+	ibench_result *result)
+{
+	const ibench_config *cfg = config;
+	ibench_config defconfig;
+	ibench_ctx ctx;
+	ikcpcb *a, *b;
+	IUINT32 current;
+	char *buffer;
+	long n;
+
+	if (cfg == NULL) {
+		ibench_config_init(&defconfig);
+		cfg = &defconfig;
+	}
+
+	if (ibench_ctx_init(&ctx, profile, cfg, result) != 0) return -1;
+
+	a = ikcp_create(0x11223344, &ctx);
+	b = ikcp_create(0x11223344, &ctx);
+	buffer = (char*)ikmem_malloc(cfg->size + 1);
+
+	if (cfg->fec > 0) {
+		ctx.fec[0] = ikcp_fec_create(cfg->fec, cfg->mtu, &ctx);
+		ctx.fec[1] = ikcp_fec_create(cfg->fec, cfg->mtu, &ctx);
+	}
+
+	if (a == NULL || b == NULL || buffer == NULL || (cfg->fec > 0 &&
+		(ctx.fec[0] == NULL || ctx.fec[1] == NULL))) {
+		if (a) ikcp_release(a);
+		if (b) ikcp_release(b);
+		if (buffer) ikmem_free(buffer);
+		ikcp_fec_release(ctx.fec[0]);
+		ikcp_fec_release(ctx.fec[1]);
+		ibench_ctx_finish(&ctx, 0);
+		return -2;
+	}
+
+	if (cfg->fec > 0) {
+		ctx.fec[0]->output = ibench_fec_output;
+		ctx.fec[1]->output = ibench_fec_output;
+	}
+
+	ctx.sender = a;
+	a->output = ibench_kcp_output;
+	b->output = ibench_kcp_output;
+	ikcp_setmtu(a, cfg->mtu);
+	ikcp_setmtu(b, cfg->mtu);
+	ikcp_wndsize(a, cfg->sndwnd, cfg->rcvwnd);
+	ikcp_wndsize(b, cfg->sndwnd, cfg->rcvwnd);
+	ikcp_nodelay(a, cfg->nodelay, cfg->update, cfg->resend, cfg->nc);
+	ikcp_nodelay(b, cfg->nodelay, cfg->update, cfg->resend, cfg->nc);
+	ikcp_ringbuf(a, cfg->ring);
+	ikcp_ringbuf(b, cfg->ring);
+	ikcp_sack(a, cfg->sack);
+	ikcp_sack(b, cfg->sack);
+
+	for (current = 0; ctx.received < cfg->count &&
+			(long)current < cfg->timeout; current++) {
+		char packet[2048];
+
+		isim_settime(&ctx.net, current);
+
+		while (ibench_due(&ctx, current) &&
+			ikcp_waitsnd(a) < cfg->sndwnd * 2) {
+			ikcp_send(a, ibench_produce(&ctx, current), cfg->size);
+		}
+
+		ikcp_update(a, current);
+		ikcp_update(b, current);
+
+		// parity for the tail of this flush
+		if (cfg->fec > 0) {
+			ikcp_fec_flush(ctx.fec[0]);
+			ikcp_fec_flush(ctx.fec[1]);
+		}
+
+		while ((n = isim_recv(isim_peer(&ctx.net, 1), packet, 2048)) > 0) {
+			ibench_kcp_input(&ctx, 1, b, packet, n);
+		}
+		while ((n = isim_recv(isim_peer(&ctx.net, 0), packet, 2048)) > 0) {
+			ibench_kcp_input(&ctx, 0, a, packet, n);
+		}
+
+		while ((n = ikcp_recv(b, buffer, cfg->size + 1)) > 0) {
+			ibench_consume(&ctx, buffer, n, current);
+		}
+	}
+
+	if (cfg->fec > 0) {
+		result->recovered = (long)(ctx.fec[0]->in_recover + 
+			ctx.fec[1]->in_recover);
+	}
+
+	ikcp_release(a);
+	ikcp_release(b);
+	ikmem_free(buffer);
+	ikcp_fec_release(ctx.fec[0]);
+	ikcp_fec_release(ctx.fec[1]);
+	ibench_ctx_finish(&ctx, current);
+
+	return 0;
+}
+
+
+//=====================================================================
+// ITCP
+//=====================================================================
+static int ibench_tcp_output(const char *buf, int len, itcpcb *tcp,
+	void *user)
+{
+	ibench_ctx *ctx = (ibench_ctx*)user;
+	if (tcp == ctx->sender && len > IBENCH_HEADER) {
+		IUINT32 seq;
+		idecode32u_msb(buf + 4, &seq);
+		ibench_account(ctx, seq + (IUINT32)(len - IBENCH_HEADER));
+	}
+	ibench_wire(ctx, (tcp == ctx->sender)? 0 : 1, buf, len);
+	return IOUTPUT_OK;
+}
+
+int ibench_tcp(const ibench_profile *profile, const ibench_config *config,
+	ibench_result *result)
+{
+	const ibench_config *cfg = config;
+	ibench_config defconfig;
+	ibench_ctx ctx;
+	itcpcb *a, *b;
+	IUINT32 current;
+	int estab = 0;
+	long n;
+
+	if (cfg == NULL) {
+		ibench_config_init(&defconfig);
+		cfg = &defconfig;
+	}
+
+	if (ibench_ctx_init(&ctx, profile, cfg, result) != 0) return -1;
+
+	a = itcp_create(0x11223344, &ctx);
+	b = itcp_create(0x11223344, &ctx);
+
+	if (a == NULL || b == NULL) {
+		if (a) itcp_release(a);
+		if (b) itcp_release(b);
+		ibench_ctx_finish(&ctx, 0);
+		return -2;
+	}
+
+	ctx.sender = a;
+	a->output = ibench_tcp_output;
+	b->output = ibench_tcp_output;
+	itcp_setmtu(a, cfg->mtu);
+	itcp_setmtu(b, cfg->mtu);
+	if (cfg->tcpbuf > 0) {
+		itcp_setbuf(a, cfg->tcpbuf);
+		itcp_setbuf(b, cfg->tcpbuf);
+	}
+	itcp_option(a, cfg->tcp_nodelay, 0);
+	itcp_option(b, cfg->tcp_nodelay, 0);
+	itcp_connect(a);
+
+	for (current = 0; ctx.received < cfg->count &&
+			(long)current < cfg->timeout; current++) {
+		char packet[2048];
+
+		isim_settime(&ctx.net, current);
+
+		// the schedule starts once the handshake is done
+		if (estab == 0 && a->state == ITCP_ESTAB) {
+			ctx.start = current;
+			estab = 1;
+		}
+
+		while (estab && ibench_due(&ctx, current) &&
+			itcp_canwrite(a) >= cfg->size) {
+			itcp_send(a, ibench_produce(&ctx, current), cfg->size);
+		}
+
+		itcp_update(a, current);
+		itcp_update(b, current);
+
+		while ((n = isim_recv(isim_peer(&ctx.net, 1), packet, 2048)) > 0) {
+			itcp_input(b, packet, n);
+		}
+		while ((n = isim_recv(isim_peer(&ctx.net, 0), packet, 2048)) > 0) {
+			itcp_input(a, packet, n);
+		}
+
+		// stream to messages
+		while (1) {
+			n = itcp_recv(b, ctx.stream + ctx.slen, cfg->size - ctx.slen);
+			if (n <= 0) break;
+			ctx.slen += n;
+			if (ctx.slen == cfg->size) {
+				ibench_consume(&ctx, ctx.stream, ctx.slen, current);
+				ctx.slen = 0;
+			}
+		}
+	}
+
+	itcp_release(a);
+	itcp_release(b);
+	ibench_ctx_finish(&ctx, current);
+
+	return 0;
+}
+
+
+//=====================================================================
+// MATRIX
+//=====================================================================
+void ibench_matrix(FILE *fp, const ibench_profile *profiles,
+	const ibench_config *config)
+{
+	const ibench_profile *p;
+	ibench_config defconfig;
+	int i;
+
+	if (profiles == NULL) profiles = ibench_profiles;
+	if (config == NULL) {
+		ibench_config_init(&defconfig);
+		config = &defconfig;
+	}
+
+	fprintf(fp, "messages=%ld size=%ld interval=%ld seeds=%lu/%lu\n",
+		config->count, config->size, config->interval,
+		config->seed1, config->seed2);
+	fprintf(fp, "%-5s %-8s %10s %7s %7s %7s %8s %10s %s\n", "proto",
+		"profile", "KB/s", "p50", "p99", "max", "resent%", "cpu ms/MB",
+		"done");
+
+	for (p = profiles; p->name != NULL; p++) {
+		for (i = 0; i < 2; i++) {
+			ibench_result r;
+			int hr = (i == 0)? ibench_kcp(p, config, &r) :
+				ibench_tcp(p, config, &r);
+			if (hr != 0) {
+				fprintf(fp, "%-5s %-8s failed (%d)\n", (i == 0)? "kcp" :
+					"itcp", p->name, hr);
+				continue;
+			}
+			fprintf(fp, "%-5s %-8s %10.1f %7ld %7ld %7ld %8.2f %10.2f %s\n",
+				(i == 0)? "kcp" : "itcp", p->name, r.goodput / 1024.0,
+				r.p50, r.p99, r.pmax, r.retrans * 100.0, r.cpu,
+				r.complete? "yes" : "no");
+		}
+	}
+}
+
+
+//=====================================================================
+// CHECK
+//=====================================================================
+struct IBENCHFRAMES
+{
+	char data[4][1600];
+	int size[4];
+	int count;
+};
+
+static int ibench_frames_output(const char *buf, int len, ikcpfec *fec,
+	void *user)
+{
+	struct IBENCHFRAMES *frames = (struct IBENCHFRAMES*)user;
+	(void)fec;
+	if (frames->count >= 4 || len > 1600) return -1;
+	memcpy(frames->data[frames->count], buf, len);
+	frames->size[frames->count++] = len;
+	return 0;
+}
+
+static int ibench_fec_kcp_output(const char *buf, int len, ikcpcb *kcp,
+	void *user)
+{
+	(void)kcp;
+	return ikcp_fec_output((ikcpfec*)user, buf, len);
+}
+
+// lose the first of two full mtu datagrams, the parity must rebuild it
+static int ibench_check_fec(FILE *fp)
+{
+	struct IBENCHFRAMES frames;
+	ikcpfec *enc = ikcp_fec_create(2, 1400, &frames);
+	ikcpfec *dec = ikcp_fec_create(2, 1400, NULL);
+	ikcpcb *a = ikcp_create(1, enc);
+	ikcpcb *b = ikcp_create(1, NULL);
+	char message[2752], output[2752 + 1];
+	int ok = 0, i;
+
+	frames.count = 0;
+	for (i = 0; i < (int)sizeof(message); i++) message[i] = (char)i;
+
+	if (enc && dec && a && b) {
+		enc->output = ibench_frames_output;
+		a->output = ibench_fec_kcp_output;
+		ikcp_nodelay(a, 1, 10, 2, 1);
+		ikcp_send(a, message, (int)sizeof(message));
+		ikcp_update(a, 0);
+		if (frames.count == 3) {
+			ikcp_fec_input(dec, frames.data[1], frames.size[1], b);
+			ikcp_fec_input(dec, frames.data[2], frames.size[2], b);
+			ok = (dec->in_recover == 1 && 
+				ikcp_recv(b, output, (int)sizeof(output)) == 
+				(int)sizeof(message) &&
+				memcmp(output, message, sizeof(message)) == 0);
+		}
+	}
+
+	if (fp) {
+		fprintf(fp, "fec full mtu shards: %d frames, parity %d bytes, "
+			"recovered %d %s\n", frames.count, 
+			(frames.count == 3)? frames.size[2] : 0,
+			dec? (int)dec->in_recover : 0, ok? "ok" : "FAILED");
+	}
+
+	if (a) ikcp_release(a);
+	if (b) ikcp_release(b);
+	ikcp_fec_release(enc);
+	ikcp_fec_release(dec);
+
+	return ok? 0 : 1;
+}
+
+int ibench_check(FILE *fp)
+{
+	static const ibench_profile lossy = 
+		{ "check", 120, 10, 60, 1000, 0, 0 };
+	static const int options[][3] = {	// ring, sack, fec
+		{ 0, 0, 0 }, { 1, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 },
+		{ 0, 0, 3 }, { 1, 1, 3 },
+	};
+	ibench_config config;
+	int failed = 0;
+	int i;
+
+	// two full segments per message: data datagrams are exactly mtu
+	ibench_config_init(&config);
+	config.count = 1000;
+	config.size = (config.mtu - 24) * 2;
+	config.timeout = 120000;
+	config.sndwnd = 1024;
+	config.rcvwnd = 1024;
+
+	for (i = 0; i < (int)(sizeof(options) / sizeof(options[0])); i++) {
+		ibench_result r;
+		int ok;
+		config.ring = options[i][0];
+		config.sack = options[i][1];
+		config.fec = options[i][2];
+		ok = (ibench_kcp(&lossy, &config, &r) == 0 && r.complete);
+		// with 10% loss fec must rebuild some full size datagrams
+		if (config.fec > 0 && r.recovered == 0) ok = 0;
+		if (!ok) failed++;
+		if (fp) {
+			fprintf(fp, "kcp ring=%d sack=%d fec=%d: %ld/%ld messages in "
+				"%ld ms, errors %ld, resent %.2f%%, recovered %ld %s\n",
+				config.ring, config.sack, config.fec, r.messages,
+				config.count, r.elapsed, r.errors, r.retrans * 100.0,
+				r.recovered, ok? "ok" : "FAILED");
+		}
+	}
+
+	return failed + ibench_check_fec(fp);
+}
+
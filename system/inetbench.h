@@ -0,0 +1,118 @@
+//=====================================================================
+//
+// inetbench.h - kcp/itcp benchmark over the network simulator
+//
+// NOTE:
+// for more information, please see the readme file.
+//
+//=====================================================================
+#ifndef __INETBENCH_H__
+#define __INETBENCH_H__
+
+#include <stdio.h>
+
+#include "inetkcp.h"
+#include "inettcp.h"
+#include "inetsim.h"
+
+
+//---------------------------------------------------------------------
+// network profile, see isim_init
+//---------------------------------------------------------------------
+struct IBENCHPROFILE
+{
+	const char *name;
+	long rtt;
+	long lost;						// percent
+	long amb;						// rtt jitter percent
+	long limit;						// packets on each link
+	long bandwidth;					// bytes per second, 0 for unlimited
+	int mode;						// 1 to keep packets in order
+};
+
+
+//---------------------------------------------------------------------
+// workload and protocol setup
+//---------------------------------------------------------------------
+struct IBENCHCONFIG
+{
+	unsigned long seed1, seed2;		// simulator seeds of both links
+	long count;						// messages to deliver
+	long size;						// bytes per message, at least 8
+	long interval;					// millisecs between messages, 0: bulk
+	long timeout;					// simulated millisecs
+	int nodelay, update, resend, nc;	// ikcp_nodelay
+	int sndwnd, rcvwnd;				// ikcp_wndsize
+	int ring, sack;					// ikcp_ringbuf, ikcp_sack
+	int fec;						// ikcp_fec_create shards, 0: off
+	int mtu;						// mtu of both protocols
+	long tcpbuf;					// itcp_setbuf, 0 for default
+	int tcp_nodelay;
+};
+
+
+//---------------------------------------------------------------------
+// results, everything except cpu is reproducible for the same seeds
+//---------------------------------------------------------------------
+struct IBENCHRESULT
+{
+	int complete;					// every message arrived in time
+	long messages;					// messages delivered
+	long errors;					// out of order or corrupted
+	long elapsed;					// simulated millisecs of the run
+	double goodput;					// payload bytes per simulated sec
+	long p50, p99, pmax;			// message latency in millisecs
+	long segments;					// data segments sent
+	long resent;					// data segments sent again
+	double retrans;					// resent / segments
+	long packets, bytes;			// wire traffic of both directions
+	long recovered;					// datagrams rebuilt by fec
+	double cpu;						// cpu millisecs per MB of payload
+};
+
+typedef struct IBENCHPROFILE ibench_profile;
+typedef struct IBENCHCONFIG ibench_config;
+typedef struct IBENCHRESULT ibench_result;
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------
+// interface
+//---------------------------------------------------------------------
+
+// default profiles: lan, the public network presets of isim_init and
+// bandwidth limited links, terminated by a NULL name
+extern const ibench_profile ibench_profiles[];
+
+// default workload: 1000 bulk messages of 1000 bytes, fast kcp mode
+void ibench_config_init(ibench_config *config);
+
+// run a kcp pair over the profile, returns zero for success
+int ibench_kcp(const ibench_profile *profile, const ibench_config *config,
+	ibench_result *result);
+
+// run an itcp pair over the profile, returns zero for success
+int ibench_tcp(const ibench_profile *profile, const ibench_config *config,
+	ibench_result *result);
+
+// run both protocols over every profile and print a table, profiles
+// and config can be NULL for defaults. a benchmark program is just:
+//     int main(void) { ibench_matrix(stdout, NULL, NULL); return 0; }
+void ibench_matrix(FILE *fp, const ibench_profile *profiles,
+	const ibench_config *config);
+
+// lossy round trips over every kcp option, prints each run if fp is
+// not NULL, returns how many failed to deliver all messages in time
+int ibench_check(FILE *fp);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+
@@ -120,6 +120,17 @@ int isocket_update_address(int resolvname)
 #define ASYNC_SOCK_MAXSIZE 0x800000
 #endif
 
+/* receive directly into the pages of recvmsg */
+#define ASYNC_SOCK_FLAG_INPLACE 0x100
+#define ASYNC_SOCK_FLAG_MANAGED 0x200
+#define ASYNC_SOCK_FLAG_GRO     0x400
+#define ASYNC_SOCK_FLAG_GSO     0x800
+
+/* max pages flushed by one gather write */
+#ifndef ASYNC_SOCK_IOVEC
+#define ASYNC_SOCK_IOVEC 64
+#endif
+
 /* create a new asyncsock */
 void async_sock_init(CAsyncSock *asyncsock, struct IMEMNODE *nodes)
 {
@@ -141,6 +152,20 @@ void async_sock_init(CAsyncSock *asyncsock, struct IMEMNODE *nodes)
 	asyncsock->bufsize = 0;
 	asyncsock->maxsize = ASYNC_SOCK_MAXSIZE;
 	asyncsock->limited = -1;
+	asyncsock->highmark = 0;
+	asyncsock->lowmark = 0;
+	asyncsock->policy = 0;
+	asyncsock->paused = 0;
+	asyncsock->idle = -1;
+	asyncsock->deadline = 0;
+	asyncsock->expire_connect = 0;
+	asyncsock->expire_handshake = 0;
+	asyncsock->owner = NULL;
+	asyncsock->ibytes = 0;
+	asyncsock->obytes = 0;
+	asyncsock->syscalls = 0;
+	asyncsock->eagains = 0;
+	asyncsock->accepts = 0;
 	asyncsock->ipv6 = 0;
 	asyncsock->mask = 0;
 	asyncsock->error = 0;
@@ -152,6 +177,7 @@ void async_sock_init(CAsyncSock *asyncsock, struct IMEMNODE *nodes)
 	asyncsock->protocol = -1;
 	ilist_init(&asyncsock->node);
 	ilist_init(&asyncsock->pending);
+	ilist_init(&asyncsock->dirty);
 	ims_init(&asyncsock->linemsg, nodes, 0, 0);
 	ims_init(&asyncsock->sendmsg, nodes, 0, 0);
 	ims_init(&asyncsock->recvmsg, nodes, 0, 0);
@@ -267,8 +293,9 @@ int async_sock_connect(CAsyncSock *asyncsock, const struct sockaddr *remote,
 	return 0;
 }
 
-/* assign a new socket */
-int async_sock_assign(CAsyncSock *asyncsock, int sock, int header)
+/* assign a new socket, configure == 0 when fd is already set up */
+static int _async_sock_assign(CAsyncSock *asyncsock, int sock, int header,
+	int configure)
 {
 	if (asyncsock->fd >= 0) iclose(asyncsock->fd);
 	asyncsock->fd = -1;
@@ -296,15 +323,23 @@ int async_sock_assign(CAsyncSock *asyncsock, int sock, int header)
 	asyncsock->fd = sock;
 	asyncsock->error = 0;
 
-	isocket_enable(asyncsock->fd, ISOCK_NOBLOCK);
-	isocket_enable(asyncsock->fd, ISOCK_UNIXREUSE);
-	isocket_enable(asyncsock->fd, ISOCK_CLOEXEC);
+	if (configure) {
+		isocket_enable(asyncsock->fd, ISOCK_NOBLOCK);
+		isocket_enable(asyncsock->fd, ISOCK_UNIXREUSE);
+		isocket_enable(asyncsock->fd, ISOCK_CLOEXEC);
+	}
 
 	asyncsock->state = ASYNC_SOCK_STATE_ESTAB;
 
 	return 0;
 }
 
+/* assign a new socket */
+int async_sock_assign(CAsyncSock *asyncsock, int sock, int header)
+{
+	return _async_sock_assign(asyncsock, sock, header, 1);
+}
+
 /* close socket */
 void async_sock_close(CAsyncSock *asyncsock)
 {
@@ -338,31 +373,78 @@ static int async_sock_try_connect(CAsyncSock *asyncsock)
 	return 0;
 }
 
-/* try send */
+/* try send: flush the whole page chain with one gather write */
 static int async_sock_try_send(CAsyncSock *asyncsock)
 {
-	void *ptr;
-	char *flat;
+	void *vecptr[ASYNC_SOCK_IOVEC];
+	ilong sizes[ASYNC_SOCK_IOVEC];
+	long veclen[ASYNC_SOCK_IOVEC];
 	long size;
 	ilong retval;
+	int count, i;
 
 	if (asyncsock->state != ASYNC_SOCK_STATE_ESTAB) return 0;
 
 	while (1) {
-		size = (long)ims_flat(&asyncsock->sendmsg, &ptr);
-		if (size <= 0) break;
-		flat = (char*)ptr;
-		retval = isend(asyncsock->fd, flat, size, 0);
+		count = ims_vector(&asyncsock->sendmsg, vecptr, sizes, 
+				ASYNC_SOCK_IOVEC);
+		if (count <= 0) break;
+		for (size = 0, i = 0; i < count; i++) {
+			veclen[i] = (long)sizes[i];
+			size += veclen[i];
+		}
+		if (count == 1) {
+			retval = isend(asyncsock->fd, vecptr[0], size, 0);
+		}	else {
+			retval = isendv(asyncsock->fd, (const void * const *)vecptr, 
+					veclen, count, 0);
+		}
+		asyncsock->syscalls++;
 		if (retval == 0) break;
 		else if (retval < 0) {
 			retval = ierrno();
-			if (retval == IEAGAIN || retval == 0) break;
+			if (retval == IEAGAIN || retval == 0) {
+				asyncsock->eagains++;
+				break;
+			}
 			else {
 				asyncsock->error = (int)retval;
 				return -1;
 			}
 		}
+		asyncsock->obytes += retval;
 		ims_drop(&asyncsock->sendmsg, retval);
+		if (retval < size) break;
+	}
+	return 0;
+}
+
+/* try receive into recvmsg pages without the intermediate buffer */
+static int async_sock_try_recv_inplace(CAsyncSock *asyncsock)
+{
+	while (1) {
+		void *ptr;
+		long canwrite = (long)ims_reserve(&asyncsock->recvmsg, &ptr);
+		int retval;
+		if (canwrite <= 0) return -2;
+		retval = irecv(asyncsock->fd, ptr, canwrite, 0);
+		asyncsock->syscalls++;
+		if (retval < 0) {
+			retval = ierrno();
+			if (retval == IEAGAIN || retval == 0) {
+				asyncsock->eagains++;
+				break;
+			}
+			asyncsock->error = retval;
+			return -2;
+		}	
+		else if (retval == 0) {
+			asyncsock->error = 0;
+			return -1;
+		}
+		asyncsock->ibytes += retval;
+		ims_commit(&asyncsock->recvmsg, retval);
+		if (retval < canwrite) break;
 	}
 	return 0;
 }
@@ -374,11 +456,20 @@ static int async_sock_try_recv(CAsyncSock *asyncsock)
 	long bufsize = asyncsock->bufsize;
 	int retval;
 	if (asyncsock->state == ASYNC_SOCK_STATE_CLOSED) return 0;
+	if ((asyncsock->flags & ASYNC_SOCK_FLAG_INPLACE) != 0 &&
+		asyncsock->header != ITMH_LINESPLIT &&
+		(asyncsock->rc4_recv_x < 0 || asyncsock->rc4_recv_y < 0)) {
+		return async_sock_try_recv_inplace(asyncsock);
+	}
 	while (1) {
 		retval = irecv(asyncsock->fd, buffer, bufsize, 0);
+		asyncsock->syscalls++;
 		if (retval < 0) {
 			retval = ierrno();
-			if (retval == IEAGAIN || retval == 0) break;
+			if (retval == IEAGAIN || retval == 0) {
+				asyncsock->eagains++;
+				break;
+			}
 			else { 
 				asyncsock->error = retval;
 				return -2;
@@ -388,6 +479,7 @@ static int async_sock_try_recv(CAsyncSock *asyncsock)
 			asyncsock->error = 0;
 			return -1;
 		}
+		asyncsock->ibytes += retval;
 		if (asyncsock->rc4_recv_x >= 0 && asyncsock->rc4_recv_y >= 0) {
 			icrypt_rc4_crypt(asyncsock->rc4_recv_box, &asyncsock->rc4_recv_x,
 				&asyncsock->rc4_recv_y, buffer, buffer, retval);
@@ -395,27 +487,30 @@ static int async_sock_try_recv(CAsyncSock *asyncsock)
 		if (asyncsock->header != ITMH_LINESPLIT) {
 			ims_write(&asyncsock->recvmsg, buffer, retval);
 		}	else {
-			long start = 0, pos = 0;
+			long start = 0, pos = 0, x, y;
+			unsigned char *nl;
 			char head[4];
-			for (start = 0, pos = 0; pos < retval; pos++) {
-				if (buffer[pos] == '\n') {
-					long x = pos - start + 1;
-					long y = (long)(asyncsock->linemsg.size);
-					iencode32u_lsb(head, x + y + 4);
-					ims_write(&asyncsock->recvmsg, head, 4);
-					while (asyncsock->linemsg.size > 0) {
-						ilong csize;
-						void *ptr;
-						csize = ims_flat(&asyncsock->linemsg, &ptr);
-						ims_write(&asyncsock->recvmsg, ptr, csize);
-						ims_drop(&asyncsock->linemsg, csize);
-					}
-					ims_write(&asyncsock->recvmsg, &buffer[start], x);
-					start = pos + 1;
+			/* memchr skips whole runs of payload between newlines */
+			for (start = 0; start < retval; start = pos + 1) {
+				nl = (unsigned char*)memchr(buffer + start, '\n', 
+					retval - start);
+				if (nl == NULL) break;
+				pos = (long)(nl - buffer);
+				x = pos - start + 1;
+				y = (long)(asyncsock->linemsg.size);
+				iencode32u_lsb(head, x + y + 4);
+				ims_write(&asyncsock->recvmsg, head, 4);
+				while (asyncsock->linemsg.size > 0) {
+					ilong csize;
+					void *ptr;
+					csize = ims_flat(&asyncsock->linemsg, &ptr);
+					ims_write(&asyncsock->recvmsg, ptr, csize);
+					ims_drop(&asyncsock->linemsg, csize);
 				}
+				ims_write(&asyncsock->recvmsg, &buffer[start], x);
 			}
-			if (pos > start) {
-				ims_write(&asyncsock->linemsg, &buffer[start], pos - start);
+			if (retval > start) {
+				ims_write(&asyncsock->linemsg, &buffer[start], retval - start);
 			}
 		}
 		if (retval < bufsize) break;
@@ -484,86 +579,129 @@ long async_sock_remain(const CAsyncSock *asyncsock)
 }
 
 
-/* header size */
-static const int async_sock_head_len[15] = 
-	{ 2, 2, 4, 4, 1, 1, 2, 2, 4, 4, 1, 1, 4, 0, 4 };
+/* header decoders: length field of each width and byte order */
+static IUINT32 async_head_dec_wlsb(const unsigned char *p)
+{
+	return (IUINT32)p[0] | ((IUINT32)p[1] << 8);
+}
+
+static IUINT32 async_head_dec_wmsb(const unsigned char *p)
+{
+	return ((IUINT32)p[0] << 8) | (IUINT32)p[1];
+}
+
+static IUINT32 async_head_dec_dlsb(const unsigned char *p)
+{
+	return (IUINT32)p[0] | ((IUINT32)p[1] << 8) | 
+		((IUINT32)p[2] << 16) | ((IUINT32)p[3] << 24);
+}
+
+static IUINT32 async_head_dec_dmsb(const unsigned char *p)
+{
+	return ((IUINT32)p[0] << 24) | ((IUINT32)p[1] << 16) | 
+		((IUINT32)p[2] << 8) | (IUINT32)p[3];
+}
+
+static IUINT32 async_head_dec_byte(const unsigned char *p)
+{
+	return (IUINT32)p[0];
+}
+
+static IUINT32 async_head_dec_mask(const unsigned char *p)
+{
+	return async_head_dec_dlsb(p) & 0xffffff;
+}
+
+/* header encoders */
+static void async_head_enc_wlsb(unsigned char *p, IUINT32 len)
+{
+	p[0] = (unsigned char)(len & 0xff);
+	p[1] = (unsigned char)((len >> 8) & 0xff);
+}
+
+static void async_head_enc_wmsb(unsigned char *p, IUINT32 len)
+{
+	p[0] = (unsigned char)((len >> 8) & 0xff);
+	p[1] = (unsigned char)(len & 0xff);
+}
+
+static void async_head_enc_dlsb(unsigned char *p, IUINT32 len)
+{
+	p[0] = (unsigned char)(len & 0xff);
+	p[1] = (unsigned char)((len >> 8) & 0xff);
+	p[2] = (unsigned char)((len >> 16) & 0xff);
+	p[3] = (unsigned char)((len >> 24) & 0xff);
+}
+
+static void async_head_enc_dmsb(unsigned char *p, IUINT32 len)
+{
+	p[0] = (unsigned char)((len >> 24) & 0xff);
+	p[1] = (unsigned char)((len >> 16) & 0xff);
+	p[2] = (unsigned char)((len >> 8) & 0xff);
+	p[3] = (unsigned char)(len & 0xff);
+}
+
+static void async_head_enc_byte(unsigned char *p, IUINT32 len)
+{
+	p[0] = (unsigned char)(len & 0xff);
+}
+
+/* header codec of each ITMH mode: size, increasement, decode, encode */
+struct CAsyncHeadCodec
+{
+	int hdrlen;
+	int hdrinc;
+	IUINT32 (*decode)(const unsigned char *p);
+	void (*encode)(unsigned char *p, IUINT32 len);
+};
 
-/* header increasement */
-static const int async_sock_head_inc[15] = 
-	{ 0, 0, 0, 0, 0, 0, 2, 2, 4, 4, 1, 1, 0, 0, 0 };
+static const struct CAsyncHeadCodec async_sock_codec[15] = {
+	{ 2, 0, async_head_dec_wlsb, async_head_enc_wlsb },   /* WORDLSB */
+	{ 2, 0, async_head_dec_wmsb, async_head_enc_wmsb },   /* WORDMSB */
+	{ 4, 0, async_head_dec_dlsb, async_head_enc_dlsb },   /* DWORDLSB */
+	{ 4, 0, async_head_dec_dmsb, async_head_enc_dmsb },   /* DWORDMSB */
+	{ 1, 0, async_head_dec_byte, async_head_enc_byte },   /* BYTELSB */
+	{ 1, 0, async_head_dec_byte, async_head_enc_byte },   /* BYTEMSB */
+	{ 2, 2, async_head_dec_wlsb, async_head_enc_wlsb },   /* EWORDLSB */
+	{ 2, 2, async_head_dec_wmsb, async_head_enc_wmsb },   /* EWORDMSB */
+	{ 4, 4, async_head_dec_dlsb, async_head_enc_dlsb },   /* EDWORDLSB */
+	{ 4, 4, async_head_dec_dmsb, async_head_enc_dmsb },   /* EDWORDMSB */
+	{ 1, 1, async_head_dec_byte, async_head_enc_byte },   /* EBYTELSB */
+	{ 1, 1, async_head_dec_byte, async_head_enc_byte },   /* EBYTEMSB */
+	{ 4, 0, async_head_dec_mask, NULL },                  /* DWORDMASK */
+	{ 0, 0, NULL, NULL },                                 /* RAWDATA */
+	{ 4, 0, async_head_dec_dlsb, NULL },                  /* LINESPLIT */
+};
 
 /* peek size */
 static inline IUINT32
 async_sock_read_size(const CAsyncSock *asyncsock)
 {
+	const struct CAsyncHeadCodec *codec;
 	unsigned char dsize[4];
-	IUINT32 len;
-	IUINT8 len8;
-	IUINT16 len16;
-	IUINT32 len32;
-	int hdrlen;
-	int hdrinc;
-	int header;
+	void *ptr;
+	long hdrlen;
 
 	assert(asyncsock);
 
-	hdrlen = async_sock_head_len[asyncsock->header];
-	hdrinc = async_sock_head_inc[asyncsock->header];
-
 	if (asyncsock->header == ITMH_RAWDATA) {
-		len = (unsigned long)asyncsock->recvmsg.size;
+		IUINT32 len = (IUINT32)asyncsock->recvmsg.size;
 		if (len > ASYNC_SOCK_BUFSIZE) return ASYNC_SOCK_BUFSIZE;
-		return (long)len;
+		return len;
 	}
 
-	len = (unsigned short)ims_peek(&asyncsock->recvmsg, dsize, hdrlen);
-	if (len < (unsigned long)hdrlen) return 0;
-
-	if (asyncsock->header <= ITMH_EBYTEMSB) {
-		header = (asyncsock->header < 6)? 
-			asyncsock->header : asyncsock->header - 6;
-	}	else {
-		header = asyncsock->header;
-	}
+	codec = &async_sock_codec[asyncsock->header];
+	hdrlen = codec->hdrlen;
 
-	switch (header) {
-	case ITMH_WORDLSB: 
-		idecode16u_lsb((char*)dsize, &len16); 
-		len = len16;
-		break;
-	case ITMH_WORDMSB:
-		idecode16u_msb((char*)dsize, &len16); 
-		len = len16;
-		break;
-	case ITMH_DWORDLSB:
-		idecode32u_lsb((char*)dsize, &len32);
-		len = len32;
-		break;
-	case ITMH_DWORDMSB:
-		idecode32u_msb((char*)dsize, &len32);
-		len = len32;
-		break;
-	case ITMH_BYTELSB:
-		idecode8u((char*)dsize, &len8);
-		len = len8;
-		break;
-	case ITMH_BYTEMSB:
-		idecode8u((char*)dsize, &len8);
-		len = len8;
-		break;
-	case ITMH_DWORDMASK:
-		idecode32u_lsb((char*)dsize, &len32);
-		len = len32 & 0xffffff;
-		break;
-	case ITMH_LINESPLIT:
-		idecode32u_lsb((char*)dsize, &len32);
-		len = len32;
-		break;
+	/* decode straight from the first page when the header is there */
+	if ((long)ims_flat(&asyncsock->recvmsg, &ptr) >= hdrlen) {
+		return codec->decode((const unsigned char*)ptr) + codec->hdrinc;
 	}
 
-	len += hdrinc;
+	if ((long)ims_peek(&asyncsock->recvmsg, dsize, hdrlen) < hdrlen)
+		return 0;
 
-	return len;
+	return codec->decode(dsize) + codec->hdrinc;
 }
 
 /* write size */
@@ -571,48 +709,24 @@ static inline int
 async_sock_write_size(const CAsyncSock *asyncsock, long size,
 	long mask, char *out)
 {
-	IUINT32 header, len;
-	int hdrlen;
-	int hdrinc;
+	const struct CAsyncHeadCodec *codec;
+	IUINT32 len;
 
 	assert(asyncsock);
 
 	if (asyncsock->header >= ITMH_RAWDATA) return 0;
 
-	hdrlen = async_sock_head_len[asyncsock->header];
-	hdrinc = async_sock_head_inc[asyncsock->header];
+	codec = &async_sock_codec[asyncsock->header];
+	len = (IUINT32)size + codec->hdrlen - codec->hdrinc;
 
-	if (asyncsock->header != ITMH_DWORDMASK) {
-		len = (IUINT32)size + hdrlen - hdrinc;
-		header = (asyncsock->header < 6)? asyncsock->header : 
-			asyncsock->header - 6;
-		switch (header) {
-		case ITMH_WORDLSB:
-			iencode16u_lsb((char*)out, (IUINT16)len);
-			break;
-		case ITMH_WORDMSB:
-			iencode16u_msb((char*)out, (IUINT16)len);
-			break;
-		case ITMH_DWORDLSB:
-			iencode32u_lsb((char*)out, (IUINT32)len);
-			break;
-		case ITMH_DWORDMSB:
-			iencode32u_msb((char*)out, (IUINT32)len);
-			break;
-		case ITMH_BYTELSB:
-			iencode8u((char*)out, (IUINT8)len);
-			break;
-		case ITMH_BYTEMSB:
-			iencode8u((char*)out, (IUINT8)len);
-			break;
-		}
+	if (codec->encode) {
+		codec->encode((unsigned char*)out, len);
 	}	else {
-		len = (IUINT32)size + hdrlen - hdrinc;
 		len = (len & 0xffffff) | ((((IUINT32)mask) & 0xff) << 24);
-		iencode32u_lsb((char*)out, (IUINT32)len);
+		async_head_enc_dlsb((unsigned char*)out, len);
 	}
 
-	return hdrlen;
+	return codec->hdrlen;
 }
 
 /* send vector */
@@ -677,7 +791,7 @@ long async_sock_recv_vector(CAsyncSock *asyncsock, void* const vecptr[],
 	assert(asyncsock);
 	if (asyncsock == 0) return 0;
 
-	hdrlen = async_sock_head_len[asyncsock->header];
+	hdrlen = async_sock_codec[asyncsock->header].hdrlen;
 	for (i = 0; i < count; i++) size += veclen[i];
 
 	len = async_sock_read_size(asyncsock);
@@ -813,9 +927,23 @@ struct CAsyncCore
 	IMUTEX_TYPE xmtx;
 	IMUTEX_TYPE xmsg;
 	IUINT32 current;
-	IUINT32 lastsec;
 	IUINT32 timeout;
 	struct ILISTHEAD pending;
+	struct ILISTHEAD refs;
+	struct ILISTHEAD dirty;
+	int refmode;
+	int shard;
+	volatile IINT32 *hids;
+	char *dgram;
+	itimer_core wheel;
+	IUINT32 jiffies;
+	iConditionVariable *cond;
+	volatile long blocked;
+	int waited;
+	size_t waiter;
+	CAsyncStats stats;
+	CAsyncStats published;
+	IINT64 posted;
 	CAsyncValidator validator;
 };
 
@@ -827,12 +955,53 @@ struct CAsyncCore
 #define ASYNC_CORE_PIPE_WRITE       1
 #define ASYNC_CORE_PIPE_FLAG        2
 
+#ifndef ASYNC_CORE_MMSG_COUNT
+#define ASYNC_CORE_MMSG_COUNT       16
+#endif
+
+#ifndef ASYNC_CORE_MMSG_SIZE
+#define ASYNC_CORE_MMSG_SIZE        0x10000
+#endif
+
+#define ASYNC_CORE_MMSG_ADDR        32      /* >= sizeof(sockaddr_in6) */
+#define ASYNC_CORE_MMSG_ROUNDS      8       /* batches per readiness */
+#define ASYNC_CORE_MMSG_BATCH       64      /* sendmmsg entries per call */
+#define ASYNC_CORE_GSO_SEGS         64      /* max segments per gso packet */
+#define ASYNC_CORE_GSO_SIZE         65000   /* max size of a gso packet */
+
+#ifndef ASYNC_CORE_TICK
+#define ASYNC_CORE_TICK             10      /* deadline wheel resolution */
+#endif
+
+#define ASYNC_CORE_DEADLINE_CONNECT     1
+#define ASYNC_CORE_DEADLINE_HANDSHAKE   2
+
+#ifndef ASYNC_CORE_BACKLOG
+#ifdef SOMAXCONN
+#define ASYNC_CORE_BACKLOG          SOMAXCONN   /* listen backlog */
+#else
+#define ASYNC_CORE_BACKLOG          128
+#endif
+#endif
+
+#ifndef ASYNC_CORE_ACCEPT_BATCH
+#define ASYNC_CORE_ACCEPT_BATCH     64      /* default accepts per wakeup */
+#endif
+
+#ifndef ASYNC_CORE_BLOCK_LIMIT
+#define ASYNC_CORE_BLOCK_LIMIT      1000    /* max ms a producer blocks */
+#endif
+
 #define ASYNC_CORE_FLAG_PROGRESS    1
 #define ASYNC_CORE_FLAG_SENSITIVE   2
 #define ASYNC_CORE_FLAG_SHUTDOWN    4
 
 #define ASYNC_CORE_HID_SALT        ((1 << (31 - ASYNC_CORE_HID_BITS)) - 1)
 
+/* shard cores put their shard below the salt counter */
+#define ASYNC_CORE_SHARD_SALT      \
+	((ASYNC_CORE_HID_SALT) >> (ASYNC_CORE_SHARD_BITS))
+
 
 /* used to monitor self-pipe trick */
 static unsigned int async_core_monitor = 0; 
@@ -901,6 +1070,8 @@ CAsyncCore* async_core_new(int flags)
 	ims_init(&core->msgs, core->cache, 0, 0);
 	ilist_init(&core->head);
 	ilist_init(&core->pending);
+	ilist_init(&core->refs);
+	ilist_init(&core->dirty);
 
 	core->data = NULL;
 	core->msgcnt = 0;
@@ -909,10 +1080,12 @@ CAsyncCore* async_core_new(int flags)
 	core->index = 1;
 	core->validator = NULL;
 	core->user = NULL;
+	core->dgram = NULL;
 	core->data = (char*)core->vector->data;
 	core->buffer = core->data + core->bufsize + 64;
 	core->current = iclock();
-	core->lastsec = 0;
+	core->jiffies = (IUINT32)(iclock64() / ASYNC_CORE_TICK);
+	itimer_core_init(&core->wheel, core->jiffies);
 	core->maxsize = ASYNC_SOCK_MAXSIZE;
 	core->limited = 0;
 	core->flags = 0;
@@ -930,6 +1103,16 @@ CAsyncCore* async_core_new(int flags)
 	IMUTEX_INIT(&core->xmsg);
 	
 	core->nolock = ((flags & 1) == 0)? 0 : 1;
+	core->refmode = ((flags & 4) == 0)? 0 : 1;
+	core->shard = -1;
+	core->hids = NULL;
+	core->cond = (core->nolock == 0)? iposix_cond_new() : NULL;
+	core->blocked = 0;
+	core->waited = 0;
+	core->waiter = 0;
+	core->posted = 0;
+	memset(&core->stats, 0, sizeof(CAsyncStats));
+	memset(&core->published, 0, sizeof(CAsyncStats));
 
 	/* self-pipe trick */
 	if ((flags & 2) == 0) {
@@ -988,6 +1171,7 @@ void async_core_delete(CAsyncCore *core)
 		assert(ilist_is_empty(&core->head));
 		abort();
 	}
+	itimer_core_destroy(&core->wheel);
 	if (core->count != 0) {
 		assert(core->count == 0);
 		abort();
@@ -998,10 +1182,20 @@ void async_core_delete(CAsyncCore *core)
 	}
 	IMUTEX_LOCK(&core->xmsg);
 	ims_destroy(&core->msgs);
+	while (!ilist_is_empty(&core->refs)) {
+		CAsyncMsg *msg = ilist_entry(core->refs.next, CAsyncMsg, node);
+		ilist_del(&msg->node);
+		ilist_init(&msg->node);
+		async_msg_release(msg);
+	}
 	IMUTEX_UNLOCK(&core->xmsg);
 	if (core->vector) iv_delete(core->vector);
 	if (core->nodes) imnode_delete(core->nodes);
 	if (core->cache) imnode_delete(core->cache);
+	if (core->dgram) ikmem_free(core->dgram);
+	if (core->hids) ikmem_free((void*)core->hids);
+	core->dgram = NULL;
+	core->hids = NULL;
 	core->vector = NULL;
 	core->nodes = NULL;
 	core->cache = NULL;
@@ -1020,6 +1214,8 @@ void async_core_delete(CAsyncCore *core)
 	core->xfd[1] = -1;
 	core->xfd[2] = 0;
 	ASYNC_CORE_CRITICAL_END(core);
+	if (core->cond) iposix_cond_delete(core->cond);
+	core->cond = NULL;
 	IMUTEX_DESTROY(&core->xmtx);
 	IMUTEX_DESTROY(&core->lock);
 	IMUTEX_DESTROY(&core->xmsg);
@@ -1028,6 +1224,159 @@ void async_core_delete(CAsyncCore *core)
 }
 
 
+/*-------------------------------------------------------------------*/
+/* histogram bucket of a sample: 4 sub-buckets per power of two      */
+/*-------------------------------------------------------------------*/
+static int async_hist_index(IUINT32 value)
+{
+	IUINT32 x = value;
+	int msb = 0;
+	if (value < 4) return (int)value;
+	for (; x >= 16; x >>= 4) msb += 4;
+	for (; x >= 2; x >>= 1) msb++;
+	return (msb - 1) * 4 + (int)((value >> (msb - 2)) & 3);
+}
+
+/* lower bound of a bucket */
+static IUINT32 async_hist_value(int index)
+{
+	if (index < 4) return (IUINT32)index;
+	return ((IUINT32)(4 + (index & 3))) << (index / 4 - 1);
+}
+
+/* add a sample (us) to histogram */
+void async_hist_add(CAsyncHist *hist, IUINT32 usec)
+{
+	hist->buckets[async_hist_index(usec)]++;
+	hist->count++;
+	hist->total += usec;
+	if (usec > hist->maximum) hist->maximum = usec;
+}
+
+/* lower bound (us) of the bucket holding given percentile (0-100) */
+IUINT32 async_hist_percentile(const CAsyncHist *hist, double percent)
+{
+	IUINT64 target, count = 0;
+	int i;
+	if (hist->count == 0) return 0;
+	if (percent >= 100.0) return hist->maximum;
+	target = (IUINT64)(hist->count * (percent / 100.0)) + 1;
+	for (i = 0; i < ASYNC_HIST_BUCKETS; i++) {
+		count += hist->buckets[i];
+		if (count >= target) return async_hist_value(i);
+	}
+	return hist->maximum;
+}
+
+/*-------------------------------------------------------------------*/
+/* copy published counters                                           */
+/*-------------------------------------------------------------------*/
+void async_core_stats(CAsyncCore *core, CAsyncStats *stats)
+{
+	if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
+	memcpy(stats, &core->published, sizeof(CAsyncStats));
+	stats->messages = core->posted;
+	stats->queue = core->msgcnt;
+	if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+}
+
+
+/*-------------------------------------------------------------------*/
+/* async_sock_update with traffic accounting                         */
+/*-------------------------------------------------------------------*/
+static int async_core_sock_update(CAsyncCore *core, CAsyncSock *sock,
+	int what)
+{
+	IINT64 ibytes = sock->ibytes;
+	IINT64 obytes = sock->obytes;
+	IUINT32 syscalls = sock->syscalls;
+	IUINT32 eagains = sock->eagains;
+	int hr = async_sock_update(sock, what);
+	core->stats.bytes_in += sock->ibytes - ibytes;
+	core->stats.bytes_out += sock->obytes - obytes;
+	core->stats.syscalls += (IUINT32)(sock->syscalls - syscalls);
+	core->stats.eagains += (IUINT32)(sock->eagains - eagains);
+	return hr;
+}
+
+
+static void async_core_event_close(CAsyncCore *core, 
+	CAsyncSock *sock, int code);
+
+/*-------------------------------------------------------------------*/
+/* check deadlines: returns close code of the expired one, otherwise */
+/* zero and ms left to the nearest in *remain (-1 for none armed)    */
+/*-------------------------------------------------------------------*/
+static int async_core_timer_check(CAsyncCore *core, CAsyncSock *sock,
+	IINT32 *remain)
+{
+	long idle = (sock->idle < 0)? (long)core->timeout : sock->idle;
+	IINT32 nearest = -1, left;
+	if (idle > 0 && sock->mode != ASYNC_CORE_NODE_LISTEN4 &&
+		sock->mode != ASYNC_CORE_NODE_LISTEN6 &&
+		sock->mode != ASYNC_CORE_NODE_DGRAM) {
+		left = itimediff(sock->time + (IUINT32)idle, core->current);
+		if (left <= 0) return 2007;
+		nearest = left;
+	}
+	if (sock->deadline & ASYNC_CORE_DEADLINE_CONNECT) {
+		if (sock->state != ASYNC_SOCK_STATE_CONNECTING) {
+			sock->deadline &= ~ASYNC_CORE_DEADLINE_CONNECT;
+		}	else {
+			left = itimediff(sock->expire_connect, core->current);
+			if (left <= 0) return 2011;
+			if (nearest < 0 || left < nearest) nearest = left;
+		}
+	}
+	if (sock->deadline & ASYNC_CORE_DEADLINE_HANDSHAKE) {
+		left = itimediff(sock->expire_handshake, core->current);
+		if (left <= 0) return 2012;
+		if (nearest < 0 || left < nearest) nearest = left;
+	}
+	*remain = nearest;
+	return 0;
+}
+
+/*-------------------------------------------------------------------*/
+/* arm the wheel for the nearest deadline, an entry firing earlier   */
+/* than needed is kept and pushed back when it fires                 */
+/*-------------------------------------------------------------------*/
+static void async_core_timer_update(CAsyncCore *core, CAsyncSock *sock)
+{
+	IINT32 remain = 0;
+	IUINT32 expires;
+	if (async_core_timer_check(core, sock, &remain) != 0) {
+		remain = 0;
+	}
+	if (remain < 0) {
+		itimer_node_del(&core->wheel, &sock->timer);
+		return;
+	}
+	expires = core->jiffies + 
+		((IUINT32)remain + ASYNC_CORE_TICK - 1) / ASYNC_CORE_TICK;
+	if (!ilist_is_empty(&sock->timer.head)) {
+		if (itimediff(sock->timer.expires, expires) <= 0) return;
+	}
+	itimer_node_mod(&core->wheel, &sock->timer, expires);
+}
+
+/*-------------------------------------------------------------------*/
+/* wheel callback                                                    */
+/*-------------------------------------------------------------------*/
+static void async_core_timer_fire(void *data)
+{
+	CAsyncSock *sock = (CAsyncSock*)data;
+	CAsyncCore *core = (CAsyncCore*)sock->owner;
+	IINT32 remain;
+	int code = async_core_timer_check(core, sock, &remain);
+	if (code != 0) {
+		async_core_event_close(core, sock, code);
+	}	else {
+		async_core_timer_update(core, sock);
+	}
+}
+
+
 /*-------------------------------------------------------------------*/
 /* new node                                                          */
 /*-------------------------------------------------------------------*/
@@ -1047,12 +1396,18 @@ static long async_core_node_new(CAsyncCore *core)
 		abort();
 	}
 
-	id = (index & ASYNC_CORE_HID_MASK) | 
-		(core->index << ASYNC_CORE_HID_BITS);
-
-	core->index++;
-
-	if (core->index >= ASYNC_CORE_HID_SALT) core->index = 1;
+	if (core->shard < 0) {
+		id = (index & ASYNC_CORE_HID_MASK) | 
+			(core->index << ASYNC_CORE_HID_BITS);
+		core->index++;
+		if (core->index >= ASYNC_CORE_HID_SALT) core->index = 1;
+	}	else {
+		long salt = (core->index << ASYNC_CORE_SHARD_BITS) | core->shard;
+		id = (index & ASYNC_CORE_HID_MASK) | 
+			(salt << ASYNC_CORE_HID_BITS);
+		core->index++;
+		if (core->index >= ASYNC_CORE_SHARD_SALT) core->index = 1;
+	}
 
 	sock = (CAsyncSock*)IMNODE_DATA(core->nodes, index);
 	if (sock == NULL) {
@@ -1062,6 +1417,7 @@ static long async_core_node_new(CAsyncCore *core)
 
 	async_sock_init(sock, core->cache);
 	sock->hid = id;
+	if (core->hids) core->hids[index] = (IINT32)id;
 	sock->external = core->buffer;
 	sock->buffer = core->buffer;
 	sock->bufsize = core->bufsize;
@@ -1072,9 +1428,17 @@ static long async_core_node_new(CAsyncCore *core)
 	sock->error = 0;
 	ilist_add_tail(&sock->node, &core->head);
 	ilist_init(&sock->pending);
+	ilist_init(&sock->dirty);
 	sock->closing = 0;
 	sock->filter = NULL;
 	sock->object = NULL;
+	sock->owner = core;
+	itimer_node_init(&sock->timer, async_core_timer_fire, sock);
+	async_core_timer_update(core, sock);
+
+	if (core->refmode) {
+		sock->flags |= ASYNC_SOCK_FLAG_INPLACE;
+	}
 
 	core->count++;
 
@@ -1139,7 +1503,13 @@ static long async_core_node_delete(CAsyncCore *core, long hid)
 		ilist_del(&sock->pending);
 		ilist_init(&sock->pending);
 	}
+	if (!ilist_is_empty(&sock->dirty)) {
+		ilist_del(&sock->dirty);
+		ilist_init(&sock->dirty);
+	}
+	itimer_node_destroy(&sock->timer);
 	async_sock_destroy(sock);
+	if (core->hids) core->hids[ASYNC_CORE_HID_INDEX(hid)] = -1;
 	imnode_del(core->nodes, ASYNC_CORE_HID_INDEX(hid));
 	core->count--;
 	return 0;
@@ -1153,9 +1523,9 @@ static int async_core_node_active(CAsyncCore *core, long hid)
 {
 	CAsyncSock *sock = async_core_node_get(core, hid);
 	if (sock == NULL) return -1;
+	/* the wheel entry is left alone, it is pushed back lazily when
+	 * it fires before the real deadline */
 	sock->time = core->current;
-	ilist_del(&sock->node);
-	ilist_add_tail(&sock->node, &core->head);
 	return 0;
 }
 
@@ -1242,6 +1612,56 @@ long async_core_node_prev(const CAsyncCore *core, long hid)
 	return hid;
 }
 
+/*-------------------------------------------------------------------*/
+/* new reference counted message                                     */
+/*-------------------------------------------------------------------*/
+static CAsyncMsg *async_msg_new(int event, long wparam, long lparam,
+	long size)
+{
+	CAsyncMsg *msg;
+	size = size < 0 ? 0 : size;
+	msg = (CAsyncMsg*)ikmem_malloc(sizeof(CAsyncMsg) + size + 1);
+	if (msg == NULL) return NULL;
+	msg->event = event;
+	msg->wparam = wparam;
+	msg->lparam = lparam;
+	msg->size = size;
+	msg->data = (char*)(msg + 1);
+	msg->data[size] = 0;
+	msg->refcnt = 1;
+	ilist_init(&msg->node);
+	return msg;
+}
+
+/* increase message reference count */
+void async_msg_addref(CAsyncMsg *msg)
+{
+	iatomic_add(&msg->refcnt, 1);
+}
+
+/* decrease message reference count, free it when reaches zero */
+void async_msg_release(CAsyncMsg *msg)
+{
+	if (msg == NULL) return;
+	if (iatomic_add(&msg->refcnt, -1) == 0) {
+		ikmem_free(msg);
+	}
+}
+
+
+/*-------------------------------------------------------------------*/
+/* append message reference                                          */
+/*-------------------------------------------------------------------*/
+static void async_core_msg_append(CAsyncCore *core, CAsyncMsg *msg)
+{
+	if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
+	ilist_add_tail(&msg->node, &core->refs);
+	core->msgcnt++;
+	core->posted++;
+	if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+}
+
+
 /*-------------------------------------------------------------------*/
 /* post message                                                      */
 /*-------------------------------------------------------------------*/
@@ -1250,6 +1670,13 @@ static int async_core_msg_push(CAsyncCore *core, int event, long wparam,
 {
 	char head[14];
 	size = size < 0 ? 0 : size;
+	if (core->refmode) {
+		CAsyncMsg *msg = async_msg_new(event, wparam, lparam, size);
+		if (msg == NULL) return -1;
+		if (size > 0) memcpy(msg->data, data, size);
+		async_core_msg_append(core, msg);
+		return 0;
+	}
 	iencode32u_lsb(head, (long)(size + 14));
 	iencode16u_lsb(head + 4, (unsigned short)event);
 	iencode32i_lsb(head + 6, wparam);
@@ -1258,11 +1685,44 @@ static int async_core_msg_push(CAsyncCore *core, int event, long wparam,
 	ims_write(&core->msgs, head, 14);
 	ims_write(&core->msgs, data, size);
 	core->msgcnt++;
+	core->posted++;
 	if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
 	return 0;
 }
 
 
+/*-------------------------------------------------------------------*/
+/* get message in reference mode                                     */
+/*-------------------------------------------------------------------*/
+static long async_core_msg_read_ref(CAsyncCore *core, int *event, 
+	long *wparam, long *lparam, void *data, long size)
+{
+	CAsyncMsg *msg;
+	long length;
+	if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
+	if (ilist_is_empty(&core->refs)) {
+		if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+		return -1;
+	}
+	msg = ilist_entry(core->refs.next, CAsyncMsg, node);
+	length = msg->size;
+	if (data == NULL || size < length) {
+		if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+		return (data == NULL)? length : -2;
+	}
+	ilist_del(&msg->node);
+	ilist_init(&msg->node);
+	core->msgcnt--;
+	if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+	if (length > 0) memcpy(data, msg->data, length);
+	if (event) event[0] = msg->event;
+	if (wparam) wparam[0] = msg->wparam;
+	if (lparam) lparam[0] = msg->lparam;
+	async_msg_release(msg);
+	return length;
+}
+
+
 /*-------------------------------------------------------------------*/
 /* get message                                                       */
 /*-------------------------------------------------------------------*/
@@ -1276,6 +1736,10 @@ static long async_core_msg_read(CAsyncCore *core, int *event, long *wparam,
 	int EVENT;
 	long WPARAM;
 	long LPARAM;
+	if (core->refmode) {
+		return async_core_msg_read_ref(core, event, wparam, lparam, 
+				data, size);
+	}
 	if (core->nolock == 0) {
 		IMUTEX_LOCK(&core->xmsg);
 	}
@@ -1318,6 +1782,60 @@ static long async_core_msg_read(CAsyncCore *core, int *event, long *wparam,
 }
 
 
+/*-------------------------------------------------------------------*/
+/* get messages in batch                                             */
+/*-------------------------------------------------------------------*/
+static int async_core_msg_read_batch(CAsyncCore *core, CAsyncEvent *events,
+	int count, char *payload, long capacity)
+{
+	long offset = 0;
+	int n = 0;
+	if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
+	for (n = 0; n < count; n++) {
+		CAsyncEvent *evt = &events[n];
+		long length;
+		if (core->refmode) {
+			CAsyncMsg *msg;
+			if (ilist_is_empty(&core->refs)) break;
+			msg = ilist_entry(core->refs.next, CAsyncMsg, node);
+			if (msg->size > capacity - offset) break;
+			ilist_del(&msg->node);
+			ilist_init(&msg->node);
+			evt->event = msg->event;
+			evt->wparam = msg->wparam;
+			evt->lparam = msg->lparam;
+			length = msg->size;
+			if (length > 0) memcpy(payload + offset, msg->data, length);
+			async_msg_release(msg);
+		}	else {
+			char head[14];
+			IUINT32 size;
+			IINT32 x;
+			IUINT16 y;
+			if (ims_peek(&core->msgs, head, 4) < 4) break;
+			idecode32u_lsb(head, &size);
+			length = (long)size - 14;
+			if (length > capacity - offset) break;
+			ims_read(&core->msgs, head, 14);
+			idecode16u_lsb(head + 4, &y);
+			evt->event = y;
+			idecode32i_lsb(head + 6, &x);
+			evt->wparam = x;
+			idecode32i_lsb(head + 10, &x);
+			evt->lparam = x;
+			ims_read(&core->msgs, payload + offset, length);
+		}
+		evt->offset = offset;
+		evt->size = length;
+		offset += length;
+		core->msgcnt--;
+	}
+	if (n == 0 && count > 0 && core->msgcnt > 0) n = -2;
+	if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+	return n;
+}
+
+
 /*-------------------------------------------------------------------*/
 /* resize buffer                                                     */
 /*-------------------------------------------------------------------*/
@@ -1331,6 +1849,7 @@ static int async_core_buffer_resize(CAsyncCore *core, long newsize)
 	}
 	newsize = xsize;
 	if (iv_resize(core->vector, (newsize + 64) * 2) != 0) return -1;
+	core->stats.resizes++;
 	core->data = (char*)core->vector->data;
 	core->buffer = core->data + newsize + 64;
 	core->bufsize = newsize;
@@ -1391,13 +1910,15 @@ static long async_core_accept(CAsyncCore *core, long listen_hid)
 	if (sock->mode == ASYNC_CORE_NODE_LISTEN4) {
 		addrlen = sizeof(remote4);
 		remote = (struct sockaddr*)&remote4;
-		fd = iaccept(sock->fd, remote, &addrlen);
+		fd = iaccept4(sock->fd, remote, &addrlen, 
+				IACCEPT_NOBLOCK | IACCEPT_CLOEXEC);
 	}	
 	else if (sock->mode == ASYNC_CORE_NODE_LISTEN6) {
 	#ifdef AF_INET6
 		addrlen = sizeof(remote6);
 		remote = (struct sockaddr*)&remote6;
-		fd = iaccept(sock->fd, remote, &addrlen);
+		fd = iaccept4(sock->fd, remote, &addrlen, 
+				IACCEPT_NOBLOCK | IACCEPT_CLOEXEC);
 	#endif
 	}
 	else {
@@ -1444,9 +1965,7 @@ static long async_core_accept(CAsyncCore *core, long listen_hid)
 	sock->mode = ASYNC_CORE_NODE_IN;
 	sock->ipv6 = (addrlen == sizeof(remote4))? 0 : 1;
 
-	async_sock_assign(sock, fd, head);
-
-	isocket_enable(fd, ISOCK_CLOEXEC);
+	_async_sock_assign(sock, fd, head, 0);
 
 	sock->limited = limited;
 	sock->maxsize = maxsize;
@@ -1475,25 +1994,64 @@ static long async_core_accept(CAsyncCore *core, long listen_hid)
 	return hid;
 }
 
-
-/*-------------------------------------------------------------------*/
-/* new connection to the target address, returns hid                 */
-/*-------------------------------------------------------------------*/
-static long _async_core_new_connect(CAsyncCore *core, 
-	const struct sockaddr *addr, int addrlen, int header)
+/* drain the listen backlog: up to sock->accepts connections per wakeup */
+static void async_core_accept_batch(CAsyncCore *core, CAsyncSock *sock)
 {
-	CAsyncSock *sock;
-	long hid;
-	int hr;
-
-	hid = async_core_node_new(core);
-	if (hid < 0) return -1;
+	long listen_hid = sock->hid;
+	long limit, count;
+	long accepted = 0;
+	long hr;
 
-	sock = async_core_node_get(core, hid);
+	limit = (sock->accepts > 0)? sock->accepts : ASYNC_CORE_ACCEPT_BATCH;
 
-	if (sock == NULL) {
-		assert(sock);
-		abort();
+	for (count = 0; count < limit; count++) {
+		hr = async_core_accept(core, listen_hid);
+		if (hr >= 0) {
+			accepted++;
+		}
+		else if (hr == -3 || hr == -2 || hr == -1) {
+			break;
+		}
+		else {
+			core->stats.accept_drops++;
+		}
+	}
+
+	core->stats.accepts += accepted;
+
+	if (accepted > core->stats.accept_peak) {
+		core->stats.accept_peak = accepted;
+	}
+
+	/* stopped on the limit with connections still queued */
+	if (count >= limit) {
+		CAsyncSock *listener = async_core_node_get(core, listen_hid);
+		if (listener && listener->fd >= 0 &&
+			(ipollfd(listener->fd, ISOCK_ERECV, 0) & ISOCK_ERECV)) {
+			core->stats.accept_full++;
+		}
+	}
+}
+
+
+/*-------------------------------------------------------------------*/
+/* new connection to the target address, returns hid                 */
+/*-------------------------------------------------------------------*/
+static long _async_core_new_connect(CAsyncCore *core, 
+	const struct sockaddr *addr, int addrlen, int header)
+{
+	CAsyncSock *sock;
+	long hid;
+	int hr;
+
+	hid = async_core_node_new(core);
+	if (hid < 0) return -1;
+
+	sock = async_core_node_get(core, hid);
+
+	if (sock == NULL) {
+		assert(sock);
+		abort();
 	}
 
 	if (async_sock_connect(sock, addr, addrlen, header) != 0) {
@@ -1510,7 +2068,7 @@ static long _async_core_new_connect(CAsyncCore *core,
 
 	async_core_node_mask(core, sock, IPOLL_OUT | IPOLL_IN | IPOLL_ERR, 0);
 	sock->mode = ASYNC_CORE_NODE_OUT;
-	sock->flags = 0;
+	sock->flags &= ASYNC_SOCK_FLAG_INPLACE;
 
 	async_core_msg_push(core, ASYNC_CORE_EVT_NEW, hid, 
 		0, addr, addrlen);
@@ -1656,7 +2214,7 @@ static long _async_core_new_listen(CAsyncCore *core,
 		return -2;
 	}
 
-	if (listen(fd, 20) != 0) {
+	if (listen(fd, ASYNC_CORE_BACKLOG) != 0) {
 		iclose(fd);
 		return -3;
 	}
@@ -1692,6 +2250,7 @@ static long _async_core_new_listen(CAsyncCore *core,
 		ilist_del(&sock->node);
 		ilist_init(&sock->node);
 	}
+	async_core_timer_update(core, sock);
 
 	sock->header = header & 0xff;
 
@@ -1764,6 +2323,7 @@ static long _async_core_new_dgram(CAsyncCore *core,
 		ilist_del(&sock->node);
 		ilist_init(&sock->node);
 	}
+	async_core_timer_update(core, sock);
 
 	async_core_msg_push(core, ASYNC_CORE_EVT_NEW, hid, 
 		-2, addr, addrlen);
@@ -1825,6 +2385,228 @@ long async_core_new_dgram(CAsyncCore *core,
 }
 
 
+/*-------------------------------------------------------------------*/
+/* send datagrams                                                    */
+/*-------------------------------------------------------------------*/
+static int _async_core_send_packets(CAsyncCore *core, long hid,
+	const void * const ptrs[], const long lens[],
+	const struct sockaddr * const remotes[], const int addrlens[],
+	int count)
+{
+	struct IDGRAM vec[ASYNC_CORE_MMSG_BATCH];
+	int packets[ASYNC_CORE_MMSG_BATCH];
+	CAsyncSock *sock = async_core_node_get(core, hid);
+	int sent = 0;
+
+	if (sock == NULL) return -1;
+	if (sock->mode != ASYNC_CORE_NODE_DGRAM || sock->fd < 0) return -2;
+
+	while (sent < count) {
+		int gso = (sock->flags & ASYNC_SOCK_FLAG_GSO)? 1 : 0;
+		int index = sent, n, hr, k;
+		long used = 0;
+		for (n = 0; n < ASYNC_CORE_MMSG_BATCH && index < count; n++) {
+			long segment = lens[index];
+			int next = index + 1;
+			vec[n].data = (void*)ptrs[index];
+			vec[n].size = segment;
+			vec[n].remote = (struct sockaddr*)remotes[index];
+			vec[n].addrlen = addrlens[index];
+			vec[n].segment = 0;
+			packets[n] = 1;
+			if (gso && segment > 0) {
+				long total = segment;
+				/* equal sized run to the same remote, the last one
+				 * can be shorter: merge into one gso super packet */
+				for (; next < count; next++) {
+					if (next - index >= ASYNC_CORE_GSO_SEGS) break;
+					if (lens[next] <= 0 || lens[next] > segment) break;
+					if (total + lens[next] > ASYNC_CORE_GSO_SIZE) break;
+					if (addrlens[next] != addrlens[index]) break;
+					if (memcmp(remotes[next], remotes[index], 
+						addrlens[index]) != 0) break;
+					total += lens[next];
+					if (lens[next] < segment) {
+						next++;
+						break;
+					}
+				}
+				if (next - index > 1 && used + total <= core->bufsize) {
+					char *stage = core->buffer + used;
+					for (k = index; k < next; k++) {
+						memcpy(stage, ptrs[k], lens[k]);
+						stage += lens[k];
+					}
+					vec[n].data = core->buffer + used;
+					vec[n].size = total;
+					vec[n].segment = (int)segment;
+					packets[n] = next - index;
+					used += total;
+				}	else {
+					next = index + 1;
+				}
+			}
+			index = next;
+		}
+		hr = isendmm(sock->fd, vec, n, 0);
+		core->stats.syscalls++;
+		for (k = 0; k < hr; k++) core->stats.bytes_out += vec[k].size;
+		if (hr < 0) {
+			int code = ierrno();
+			if (code == IEAGAIN) core->stats.eagains++;
+			/* kernel or device without udp gso refuses the super 
+			 * packet at the head of the batch: fall back to plain */
+			if (vec[0].segment > 0 && (code == EIO || 
+				code == EINVAL || code == EOPNOTSUPP)) {
+				sock->flags &= ~ASYNC_SOCK_FLAG_GSO;
+				continue;
+			}
+			break;
+		}
+		for (k = 0; k < hr; k++) sent += packets[k];
+		if (hr < n) break;
+	}
+
+	return sent;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* thread safe                                                       */
+/*-------------------------------------------------------------------*/
+int async_core_send_packets(CAsyncCore *core, long hid, 
+	const void * const ptrs[], const long lens[], 
+	const struct sockaddr * const remotes[], const int addrlens[], 
+	int count)
+{
+	int hr;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	hr = _async_core_send_packets(core, hid, ptrs, lens, remotes,
+		addrlens, count);
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* iterate datagrams of an ASYNC_CORE_EVT_PACKET message             */
+/*-------------------------------------------------------------------*/
+long async_core_packet_next(const void *data, long size, long *pos,
+	struct sockaddr *remote, int *addrlen, const void **payload)
+{
+	const char *ptr = (const char*)data + *pos;
+	unsigned short alen, reserved;
+	IUINT32 length;
+	if (*pos + 8 > size) return -1;
+	ptr = idecode16u_lsb(ptr, &alen);
+	ptr = idecode16u_lsb(ptr, &reserved);
+	ptr = idecode32u_lsb(ptr, &length);
+	if (*pos + 8 + (long)alen + (long)length > size) return -1;
+	if (remote && addrlen) {
+		memcpy(remote, ptr, (alen < *addrlen)? alen : *addrlen);
+	}
+	if (addrlen) *addrlen = (int)alen;
+	if (payload) *payload = ptr + alen;
+	*pos += 8 + (long)alen + (long)length;
+	return (long)length;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* managed dgram: recvmmsg into pooled slots                         */
+/*-------------------------------------------------------------------*/
+/* each datagram in EVT_PACKET: addrlen(2) + reserved(2) + size(4) +
+ * remote address + payload, gro super packets are split back here */
+static int async_core_dgram_recv(CAsyncCore *core, CAsyncSock *sock)
+{
+	struct IDGRAM vec[ASYNC_CORE_MMSG_COUNT];
+	char *slots, *addrs;
+	int round, count, i;
+
+	if (core->dgram == NULL) {
+		core->dgram = (char*)ikmem_malloc(ASYNC_CORE_MMSG_COUNT *
+			(ASYNC_CORE_MMSG_SIZE + ASYNC_CORE_MMSG_ADDR));
+		if (core->dgram == NULL) return -1;
+	}
+
+	slots = core->dgram;
+	addrs = slots + ASYNC_CORE_MMSG_COUNT * ASYNC_CORE_MMSG_SIZE;
+
+	for (round = 0; round < ASYNC_CORE_MMSG_ROUNDS; round++) {
+		CAsyncMsg *msg = NULL;
+		long total = 0;
+		char *ptr;
+
+		for (i = 0; i < ASYNC_CORE_MMSG_COUNT; i++) {
+			vec[i].data = slots + i * ASYNC_CORE_MMSG_SIZE;
+			vec[i].size = ASYNC_CORE_MMSG_SIZE;
+			vec[i].remote = (struct sockaddr*)(addrs + 
+				i * ASYNC_CORE_MMSG_ADDR);
+			vec[i].addrlen = ASYNC_CORE_MMSG_ADDR;
+			vec[i].segment = 0;
+		}
+
+		count = irecvmm(sock->fd, vec, ASYNC_CORE_MMSG_COUNT, 0);
+		core->stats.syscalls++;
+		if (count <= 0) {
+			if (count < 0 && ierrno() == IEAGAIN) core->stats.eagains++;
+			break;
+		}
+
+		for (i = 0; i < count; i++) {
+			long size = vec[i].size;
+			long segment = (vec[i].segment > 0)? vec[i].segment : size;
+			long n = (size > 0)? (size + segment - 1) / segment : 1;
+			core->stats.bytes_in += size;
+			total += n * (8 + vec[i].addrlen) + size;
+		}
+
+		if (core->refmode) {
+			msg = async_msg_new(ASYNC_CORE_EVT_PACKET, sock->hid,
+				sock->tag, total);
+			if (msg == NULL) return -2;
+			ptr = msg->data;
+		}
+		else {
+			if (total > core->bufsize) {
+				if (async_core_buffer_resize(core, total) != 0)
+					return -2;
+			}
+			ptr = core->buffer;
+		}
+
+		for (i = 0; i < count; i++) {
+			const char *lptr = (const char*)vec[i].data;
+			long remain = vec[i].size;
+			long segment = (vec[i].segment > 0)? vec[i].segment : remain;
+			do {
+				long size = (remain < segment)? remain : segment;
+				ptr = iencode16u_lsb(ptr, (unsigned short)vec[i].addrlen);
+				ptr = iencode16u_lsb(ptr, 0);
+				ptr = iencode32u_lsb(ptr, (IUINT32)size);
+				memcpy(ptr, vec[i].remote, vec[i].addrlen);
+				ptr += vec[i].addrlen;
+				memcpy(ptr, lptr, size);
+				ptr += size;
+				lptr += size;
+				remain -= size;
+			}	while (remain > 0);
+		}
+
+		if (msg) {
+			async_core_msg_append(core, msg);
+		}	else {
+			async_core_msg_push(core, ASYNC_CORE_EVT_PACKET, sock->hid,
+				sock->tag, core->buffer, total);
+		}
+
+		if (count < ASYNC_CORE_MMSG_COUNT) break;
+	}
+
+	return 0;
+}
+
+
 /*-------------------------------------------------------------------*/
 /* process close                                                     */
 /*-------------------------------------------------------------------*/
@@ -1841,7 +2623,7 @@ static void async_core_event_close(CAsyncCore *core,
 	}
 	if (sock->sendmsg.size > 0) {
 		if (sock->fd >= 0) {
-			async_sock_update(sock, 2);
+			async_core_sock_update(core, sock, 2);
 		}
 	}
 	data[0] = sock->error;
@@ -1853,6 +2635,80 @@ static void async_core_event_close(CAsyncCore *core,
 	async_core_msg_push(core, ASYNC_CORE_EVT_CLOSE, sock->hid,
 		sock->tag, data, sizeof(IUINT32) * 2);
 	async_core_node_delete(core, sock->hid);
+	if (core->blocked > 0 && core->cond) {
+		iposix_cond_wake_all(core->cond);
+	}
+}
+
+
+/*-------------------------------------------------------------------*/
+/* emit pause/resume when send queue crosses the watermarks          */
+/*-------------------------------------------------------------------*/
+static void async_core_watermark(CAsyncCore *core, CAsyncSock *sock)
+{
+	long size = (long)sock->sendmsg.size;
+	if (sock->highmark <= 0) return;
+	if (sock->paused == 0) {
+		if (size >= sock->highmark) {
+			sock->paused = 1;
+			async_core_msg_push(core, ASYNC_CORE_EVT_PAUSE,
+				sock->hid, sock->tag, core->buffer, 0);
+		}
+	}
+	else if (size <= sock->lowmark) {
+		sock->paused = 0;
+		async_core_msg_push(core, ASYNC_CORE_EVT_RESUME,
+			sock->hid, sock->tag, core->buffer, 0);
+		if (core->blocked > 0 && core->cond) {
+			iposix_cond_wake_all(core->cond);
+		}
+	}
+}
+
+
+/*-------------------------------------------------------------------*/
+/* flush sockets written since last loop, one gather write for each  */
+/*-------------------------------------------------------------------*/
+static void async_core_flush_dirty(CAsyncCore *core)
+{
+	while (!ilist_is_empty(&core->dirty)) {
+		CAsyncSock *sock;
+		int needclose = 0, code = 0;
+		sock = ilist_entry(core->dirty.next, CAsyncSock, dirty);
+		ilist_del(&sock->dirty);
+		ilist_init(&sock->dirty);
+		if (sock->fd < 0 || sock->closing) continue;
+		if (sock->state != ASYNC_SOCK_STATE_ESTAB) continue;
+		if (async_core_sock_update(core, sock, 2) != 0) {
+			needclose = 1;
+			code = 2005;
+		}
+		else {
+			if (sock->paused) {
+				async_core_watermark(core, sock);
+			}
+			if (sock->sendmsg.size > 0) {
+				if ((sock->mask & IPOLL_OUT) == 0) {
+					async_core_node_mask(core, sock, IPOLL_OUT, 0);
+				}
+			}
+			else if ((sock->mask & IPOLL_OUT) == 0) {
+				if (sock->flags & ASYNC_CORE_FLAG_PROGRESS) {
+					async_core_msg_push(core, ASYNC_CORE_EVT_PROGRESS,
+						sock->hid, sock->tag, core->buffer, 0);
+				}
+			}
+		}
+		if (sock->flags & ASYNC_CORE_FLAG_SHUTDOWN) {
+			if (sock->sendmsg.size == 0 && needclose == 0) {
+				needclose = 1;
+				code = 2006;
+			}
+		}
+		if (sock->state == ASYNC_SOCK_STATE_CLOSED || needclose) {
+			async_core_event_close(core, sock, code);
+		}
+	}
 }
 
 
@@ -1866,7 +2722,7 @@ static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
 	long pending = 0;
 	void *udata;
 	IUINT64 ts;
-	IUINT32 now;
+	IINT64 t1, t2, t3;
 
 	/* process pending close */
 	while (!ilist_is_empty(&core->pending)) {
@@ -1877,17 +2733,22 @@ static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
 		async_core_event_close(core, sock, sock->exitcode);
 	}
 
+	/* flush data queued since last loop */
+	async_core_flush_dirty(core);
+
 	/* detect msg count */
 	if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
 	pending = core->msgcnt;
 	if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
 
 	/* waiting events */
+	t1 = iclockrt();
 	count = ipoll_wait(core->pfd, (pending == 0)? millisec : 0);
+	t2 = iclockrt();
 
 	ts = iclock64();
 	core->current = (IUINT32)(ts & 0xfffffffful);
-	now = (IUINT32)((ts / 1000) & 0xfffffffful);
+	core->jiffies = (IUINT32)(ts / ASYNC_CORE_TICK);
 
 	xf = core->xfd[ASYNC_CORE_PIPE_READ];
 
@@ -1897,6 +2758,7 @@ static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
 		if (ipoll_event(core->pfd, &fd, &event, &udata) != 0) {
 			break;
 		}
+		core->stats.events++;
 		if (fd == xf && fd >= 0) {
 			if ((event & IPOLL_IN) || (event & IPOLL_ERR)) {
 				char dummy[10];
@@ -1921,6 +2783,13 @@ static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
 		if (sock->mode == ASYNC_CORE_NODE_DGRAM) {
 			char body[8];
 			int evt = event & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
+			if (sock->flags & ASYNC_SOCK_FLAG_MANAGED) {
+				if (evt & (IPOLL_IN | IPOLL_ERR)) {
+					async_core_dgram_recv(core, sock);
+				}
+				evt &= ~(IPOLL_IN | IPOLL_ERR);
+				if (evt == 0) continue;
+			}
 			iencode32u_lsb(body, (long)sock->fd);
 			iencode16u_lsb(body + 4, (short)evt);
 			iencode16u_lsb(body + 6, (short)(sock->ipv6? 1 : 0));
@@ -1931,10 +2800,10 @@ static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
 		if ((event & IPOLL_IN) || (event & IPOLL_ERR)) {
 			if (sock->mode == ASYNC_CORE_NODE_LISTEN4 ||
 				sock->mode == ASYNC_CORE_NODE_LISTEN6) {
-				async_core_accept(core, sock->hid);
+				async_core_accept_batch(core, sock);
 			}	
 			else {
-				if (async_sock_update(sock, 1) != 0) {
+				if (async_core_sock_update(core, sock, 1) != 0) {
 					needclose = 1;
 					code = 0;
 				}
@@ -1958,13 +2827,26 @@ static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
 						}
 						break;
 					}
-					else if (size > core->bufsize) {	/* buffer resize */
+					else if (size > core->bufsize && (core->refmode == 0 ||
+						sock->filter != NULL)) {	/* buffer resize */
 						if (async_core_buffer_resize(core, size) != 0) {
 							needclose = 1;
 							code = 2003;
 							break;
 						}
 					}
+					if (core->refmode && sock->filter == NULL) {
+						CAsyncMsg *msg = async_msg_new(ASYNC_CORE_EVT_DATA,
+							sock->hid, sock->tag, size);
+						if (msg == NULL) {
+							needclose = 1;
+							code = 2003;
+							break;
+						}
+						async_sock_recv(sock, msg->data, size);
+						async_core_msg_append(core, msg);
+						continue;
+					}
 					size = async_sock_recv(sock, core->buffer,
 						core->bufsize);
 					if (size >= 0) {
@@ -2008,10 +2890,13 @@ static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
 				}
 			}
 			if (sock->sendmsg.size > 0 && needclose == 0) {
-				if (async_sock_update(sock, 2) != 0) {
+				if (async_core_sock_update(core, sock, 2) != 0) {
 					needclose = 1;
 					code = 2005;
 				}
+				else if (sock->paused) {
+					async_core_watermark(core, sock);
+				}
 			}
 			if (sock->sendmsg.size == 0 && sock->fd >= 0 && !needclose) {
 				if (sock->mask & IPOLL_OUT) {
@@ -2034,16 +2919,22 @@ static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
 		}
 	}
 
-	if (now != core->lastsec && core->timeout > 0) {
-		CAsyncSock *sock;
-		core->lastsec = now;
-		while (!ilist_is_empty(&core->head)) {
-			IINT32 timeout;
-			sock = ilist_entry(core->head.next, CAsyncSock, node);
-			timeout = itimediff(core->current, sock->time + core->timeout);
-			if (timeout < 0) break;
-			async_core_event_close(core, sock, 2007);
-		}
+	/* expire deadlines */
+	itimer_core_run(&core->wheel, core->jiffies);
+
+	/* flush data written by filters during dispatch */
+	async_core_flush_dirty(core);
+
+	/* metrics, published at most once per millisecond */
+	t3 = iclockrt();
+	async_hist_add(&core->stats.wait, (IUINT32)(t2 - t1));
+	async_hist_add(&core->stats.dispatch, (IUINT32)(t3 - t2));
+	core->stats.loops++;
+	if ((IINT64)ts != core->published.clock) {
+		if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
+		memcpy(&core->published, &core->stats, sizeof(CAsyncStats));
+		core->published.clock = (IINT64)ts;
+		if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
 	}
 }
 
@@ -2058,7 +2949,7 @@ static int _async_core_close(CAsyncCore *core, long hid, int code)
 	if (sock == NULL) return -1;
 	if (sock->sendmsg.size > 0) {
 		if (sock->fd >= 0) {
-			async_sock_update(sock, 2);
+			async_core_sock_update(core, sock, 2);
 		}
 	}
 	if (sock->closing) return -2;
@@ -2086,6 +2977,43 @@ int async_core_close(CAsyncCore *core, long hid, int code)
 }
 
 
+/*-------------------------------------------------------------------*/
+/* identify calling thread                                           */
+/*-------------------------------------------------------------------*/
+static size_t async_core_thread_id(void)
+{
+#ifdef _WIN32
+	return (size_t)GetCurrentThreadId();
+#else
+	return (size_t)pthread_self();
+#endif
+}
+
+
+/*-------------------------------------------------------------------*/
+/* block producer until hid resumes, closes or the limit expires,    */
+/* only for threads other than the one running async_core_wait:     */
+/* nobody else drains the queue, so that one degrades to DROP       */
+/*-------------------------------------------------------------------*/
+static CAsyncSock *async_core_send_block(CAsyncCore *core, long hid)
+{
+	CAsyncSock *sock = async_core_node_get(core, hid);
+	IUINT32 start = iclock();
+	if (core->nolock || core->dispatch || core->cond == NULL) return sock;
+	if (core->waited && core->waiter == async_core_thread_id()) return sock;
+	core->blocked++;
+	while (sock != NULL && sock->paused && sock->closing == 0) {
+		IINT32 elapse = itimediff(iclock(), start);
+		if (elapse >= ASYNC_CORE_BLOCK_LIMIT) break;
+		iposix_cond_sleep_cs_time(core->cond, &core->lock,
+			ASYNC_CORE_BLOCK_LIMIT - elapse);
+		sock = async_core_node_get(core, hid);
+	}
+	core->blocked--;
+	return sock;
+}
+
+
 /*-------------------------------------------------------------------*/
 /* send vector                                                       */
 /*-------------------------------------------------------------------*/
@@ -2100,7 +3028,7 @@ static long _async_core_send_vector(CAsyncCore *core, long hid,
 	if (sock->limited > 0 && sock->sendmsg.size > (iulong)sock->limited) {
 		if ((sock->flags & ASYNC_CORE_FLAG_SENSITIVE) == 0) {
 			if (sock->fd >= 0) {
-				async_sock_update(sock, 2);
+				async_core_sock_update(core, sock, 2);
 			}
 		}
 		if (sock->sendmsg.size > (iulong)sock->limited) {
@@ -2108,9 +3036,28 @@ static long _async_core_send_vector(CAsyncCore *core, long hid,
 			return -200;
 		}
 	}
+	if (sock->paused && sock->policy != ASYNC_CORE_POLICY_NONE) {
+		if (sock->policy == ASYNC_CORE_POLICY_CLOSE) {
+			_async_core_close(core, hid, 2009);
+			return -200;
+		}
+		if (sock->policy == ASYNC_CORE_POLICY_BLOCK) {
+			sock = async_core_send_block(core, hid);
+			if (sock == NULL) return -100;
+			if (sock->closing) return -110;
+		}
+		if (sock->paused) return -300;
+	}
 	hr = async_sock_send_vector(sock, vecptr, veclen, count, mask);
+	async_core_watermark(core, sock);
 	if (sock->sendmsg.size > 0 && sock->fd >= 0) {
-		if ((sock->mask & IPOLL_OUT) == 0) {
+		if (sock->state == ASYNC_SOCK_STATE_ESTAB) {
+			/* coalesce: flushed by one gather write per loop */
+			if (ilist_is_empty(&sock->dirty)) {
+				ilist_add_tail(&sock->dirty, &core->dirty);
+			}
+		}
+		else if ((sock->mask & IPOLL_OUT) == 0) {
 			async_core_node_mask(core, sock, 
 				IPOLL_OUT, 0);
 		}
@@ -2165,20 +3112,19 @@ long async_core_send_vector(CAsyncCore *core, long hid,
 }
 
 /*-------------------------------------------------------------------*/
-/* send data to given hid                                            */
+/* send data to given hid (lock held)                                */
 /*-------------------------------------------------------------------*/
-long async_core_send(CAsyncCore *core, long hid, const void *ptr, long len)
+static long _async_core_send(CAsyncCore *core, long hid, 
+	const void *ptr, long len)
 {
-	CAsyncSock *sock = NULL;
-	const void *vecptr[1];
-	long veclen[1];
+	CAsyncSock *sock = async_core_node_get(core, hid);
 	long hr = -1;
-	vecptr[0] = ptr;
-	veclen[0] = len;
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	sock = async_core_node_get(core, hid);
 	if (sock) {
 		if (sock->filter == NULL) {
+			const void *vecptr[1];
+			long veclen[1];
+			vecptr[0] = ptr;
+			veclen[0] = len;
 			hr = _async_core_send_vector(core, hid, vecptr, veclen, 1, 0);
 		}
 		else {
@@ -2189,10 +3135,38 @@ long async_core_send(CAsyncCore *core, long hid, const void *ptr, long len)
 			core->dispatch = 0;
 		}
 	}
+	return hr;
+}
+
+/*-------------------------------------------------------------------*/
+/* send data to given hid                                            */
+/*-------------------------------------------------------------------*/
+long async_core_send(CAsyncCore *core, long hid, const void *ptr, long len)
+{
+	long hr = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	hr = _async_core_send(core, hid, ptr, len);
 	ASYNC_CORE_CRITICAL_END(core);
 	return hr;
 }
 
+/*-------------------------------------------------------------------*/
+/* send packets in batch                                             */
+/*-------------------------------------------------------------------*/
+int async_core_send_many(CAsyncCore *core, const long hids[], 
+	const void * const ptrs[], const long lens[], int count, 
+	long results[])
+{
+	int accepted = 0, i;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	for (i = 0; i < count; i++) {
+		long hr = _async_core_send(core, hids[i], ptrs[i], lens[i]);
+		if (results) results[i] = hr;
+		if (hr >= 0) accepted++;
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+	return accepted;
+}
 
 /*-------------------------------------------------------------------*/
 /* wait for events for millisec ms. and process events,              */
@@ -2201,6 +3175,8 @@ long async_core_send(CAsyncCore *core, long hid, const void *ptr, long len)
 void async_core_wait(CAsyncCore *core, IUINT32 millisec)
 {
 	ASYNC_CORE_CRITICAL_BEGIN(core);
+	core->waiter = async_core_thread_id();
+	core->waited = 1;
 	if (core->count > 0 || core->xfd[0] >= 0) {
 		async_core_process_events(core, millisec);
 	}	else {
@@ -2265,6 +3241,56 @@ long async_core_read(CAsyncCore *core, int *event, long *wparam,
 }
 
 
+/*-------------------------------------------------------------------*/
+/* get messages in batch                                             */
+/*-------------------------------------------------------------------*/
+int async_core_read_batch(CAsyncCore *core, CAsyncEvent *events, 
+	int count, void *payload, long capacity)
+{
+	return async_core_msg_read_batch(core, events, count, 
+			(char*)payload, capacity);
+}
+
+
+/*-------------------------------------------------------------------*/
+/* get message reference                                             */
+/*-------------------------------------------------------------------*/
+CAsyncMsg* async_core_read_msg(CAsyncCore *core)
+{
+	CAsyncMsg *msg = NULL;
+	if (core->refmode) {
+		if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
+		if (!ilist_is_empty(&core->refs)) {
+			msg = ilist_entry(core->refs.next, CAsyncMsg, node);
+			ilist_del(&msg->node);
+			ilist_init(&msg->node);
+			core->msgcnt--;
+		}
+		if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+		return msg;
+	}
+	while (1) {
+		long size = async_core_msg_read(core, NULL, NULL, NULL, NULL, 0);
+		long hr;
+		if (size < 0) return NULL;
+		msg = async_msg_new(0, 0, 0, size);
+		if (msg == NULL) return NULL;
+		hr = async_core_msg_read(core, &msg->event, &msg->wparam, 
+				&msg->lparam, msg->data, size);
+		if (hr >= 0) {
+			msg->size = hr;
+			msg->data[hr] = 0;
+			break;
+		}
+		/* raced with another reader */
+		async_msg_release(msg);
+		msg = NULL;
+		if (hr == -1) break;
+	}
+	return msg;
+}
+
+
 /*-------------------------------------------------------------------*/
 /* push message to msg queue                                         */
 /*-------------------------------------------------------------------*/
@@ -2567,13 +3593,98 @@ static int _async_core_option(CAsyncCore *core, long hid,
 			hr = -30;
 		}
 		break;
+	case ASYNC_CORE_OPTION_DGRAM:
+		if (sock->mode == ASYNC_CORE_NODE_DGRAM && sock->fd >= 0) {
+			hr = 0;
+			if (sock->flags & ASYNC_SOCK_FLAG_GRO) {
+				isocket_option(sock->fd, ISOCK_UDPGRO, 0);
+			}
+			sock->flags &= ~(ASYNC_SOCK_FLAG_MANAGED | 
+				ASYNC_SOCK_FLAG_GRO | ASYNC_SOCK_FLAG_GSO);
+			if (value & ASYNC_CORE_DGRAM_MANAGED) {
+				sock->flags |= ASYNC_SOCK_FLAG_MANAGED;
+				if ((sock->mask & IPOLL_IN) == 0) {
+					sock->mask |= IPOLL_IN;
+					hr = ipoll_set(core->pfd, sock->fd, sock->mask);
+				}
+				if (value & ASYNC_CORE_DGRAM_GRO) {
+					if (isocket_option(sock->fd, ISOCK_UDPGRO, 1) == 0) {
+						sock->flags |= ASYNC_SOCK_FLAG_GRO;
+					}	else {
+						hr = -31;
+					}
+				}
+			}
+			if (value & ASYNC_CORE_DGRAM_GSO) {
+				sock->flags |= ASYNC_SOCK_FLAG_GSO;
+			}
+		}	else {
+			hr = -30;
+		}
+		break;
+	case ASYNC_CORE_OPTION_HIGHMARK:
+		sock->highmark = value;
+		if (sock->lowmark > value) sock->lowmark = value;
+		if (value <= 0 && sock->paused) {
+			sock->paused = 0;
+			if (core->blocked > 0 && core->cond) {
+				iposix_cond_wake_all(core->cond);
+			}
+		}
+		break;
+	case ASYNC_CORE_OPTION_LOWMARK:
+		sock->lowmark = (value < sock->highmark)? value : sock->highmark;
+		break;
+	case ASYNC_CORE_OPTION_POLICY:
+		sock->policy = (int)value;
+		break;
+	case ASYNC_CORE_OPTION_IDLE:
+		sock->idle = (value < 0)? -1 : value;
+		async_core_timer_update(core, sock);
+		break;
+	case ASYNC_CORE_OPTION_CONNECT:
+		sock->deadline &= ~ASYNC_CORE_DEADLINE_CONNECT;
+		if (value > 0 && sock->state == ASYNC_SOCK_STATE_CONNECTING) {
+			sock->expire_connect = core->current + (IUINT32)value;
+			sock->deadline |= ASYNC_CORE_DEADLINE_CONNECT;
+		}
+		async_core_timer_update(core, sock);
+		break;
+	case ASYNC_CORE_OPTION_ACCEPTS:
+		sock->accepts = (value > 0)? value : 0;
+		hr = 0;
+		break;
+	case ASYNC_CORE_OPTION_DEFERACCEPT:
+		if (sock->mode == ASYNC_CORE_NODE_LISTEN4 ||
+			sock->mode == ASYNC_CORE_NODE_LISTEN6) {
+			hr = ideferaccept(sock->fd, (int)value);
+		}	else {
+			hr = -30;
+		}
+		break;
+	case ASYNC_CORE_OPTION_FASTOPEN:
+		if (sock->mode == ASYNC_CORE_NODE_LISTEN4 ||
+			sock->mode == ASYNC_CORE_NODE_LISTEN6) {
+			hr = ifastopen(sock->fd, (int)value);
+		}	else {
+			hr = -30;
+		}
+		break;
+	case ASYNC_CORE_OPTION_HANDSHAKE:
+		sock->deadline &= ~ASYNC_CORE_DEADLINE_HANDSHAKE;
+		if (value > 0) {
+			sock->expire_handshake = core->current + (IUINT32)value;
+			sock->deadline |= ASYNC_CORE_DEADLINE_HANDSHAKE;
+		}
+		async_core_timer_update(core, sock);
+		break;
 	case ASYNC_CORE_OPTION_SHUTDOWN:
 		if (sock->mode != ASYNC_CORE_NODE_LISTEN4 && 
 			sock->mode != ASYNC_CORE_NODE_LISTEN6 && 
 			sock->mode != ASYNC_CORE_NODE_DGRAM) {
 			if (sock->sendmsg.size > 0) {
 				if (sock->fd >= 0) {
-					async_sock_update(sock, 2);
+					async_core_sock_update(core, sock, 2);
 				}
 			}
 			if (sock->sendmsg.size == 0) {
@@ -2613,6 +3724,12 @@ static long _async_core_status(CAsyncCore *core, long hid, int opt)
 	case ASYNC_CORE_STATUS_ESTAB:
 		hr = isocket_tcp_estab(sock->fd);
 		break;
+	case ASYNC_CORE_STATUS_IBYTES:
+		hr = (long)sock->ibytes;
+		break;
+	case ASYNC_CORE_STATUS_OBYTES:
+		hr = (long)sock->obytes;
+		break;
 	}
 
 	return hr;
@@ -2713,8 +3830,16 @@ void async_core_firewall(CAsyncCore *core, CAsyncValidator v, void *user)
 /* set timeout */
 void async_core_timeout(CAsyncCore *core, long seconds)
 {
+	long hid;
 	ASYNC_CORE_CRITICAL_BEGIN(core);
 	core->timeout = seconds * 1000;
+	for (hid = _async_core_node_head(core); hid >= 0; ) {
+		CAsyncSock *sock = async_core_node_get(core, hid);
+		if (sock->idle < 0) {
+			async_core_timer_update(core, sock);
+		}
+		hid = _async_core_node_next(core, hid);
+	}
 	ASYNC_CORE_CRITICAL_END(core);
 }
 
@@ -2755,6 +3880,431 @@ long async_core_nfds(const CAsyncCore *core)
 }
 
 
+/*===================================================================*/
+/* CAsyncGroup: sharded multi-reactor                                */
+/*===================================================================*/
+#define ASYNC_GROUP_CMD_SEND       0
+#define ASYNC_GROUP_CMD_CLOSE      1
+
+/* send or close queued for a reactor by other threads */
+struct CAsyncCommand
+{
+	struct CAsyncCommand *next;
+	int cmd;
+	int code;
+	long hid;
+	long size;
+	char data[1];
+};
+
+struct CAsyncShard
+{
+	struct CAsyncGroup *group;
+	CAsyncCore *core;
+	iPosixThread *thread;
+	iEventPosix *idle;
+	void * volatile head;               /* lock free stack of commands */
+	volatile long waiters;
+	int index;
+};
+
+struct CAsyncGroup
+{
+	int nshards;
+	int started;
+	volatile int running;
+	volatile long next;
+	int cursor;
+	IUINT32 interval;
+	CAsyncGroupHandler handler;
+	void *user;
+	struct CAsyncShard *shards;
+};
+
+
+/* multi-producer push: a treiber stack taken whole by the reactor, 
+   so there is no ABA. only the push onto an empty stack notifies */
+static void async_group_push(struct CAsyncShard *shard, 
+	struct CAsyncCommand *cmd)
+{
+	void *head;
+	do {
+		head = shard->head;
+		cmd->next = (struct CAsyncCommand*)head;
+	}	while (iatomic_cas_ptr(&shard->head, head, cmd) == 0);
+	if (head == NULL) {
+		async_core_notify(shard->core);
+	}
+}
+
+/* run queued commands in push order */
+static void async_group_execute(struct CAsyncShard *shard)
+{
+	struct CAsyncCommand *cmd, *list = NULL;
+	void *head;
+	do {
+		head = shard->head;
+		if (head == NULL) return;
+	}	while (iatomic_cas_ptr(&shard->head, head, NULL) == 0);
+	for (cmd = (struct CAsyncCommand*)head; cmd; ) {
+		struct CAsyncCommand *next = cmd->next;
+		cmd->next = list;
+		list = cmd;
+		cmd = next;
+	}
+	for (cmd = list; cmd; ) {
+		struct CAsyncCommand *next = cmd->next;
+		if (cmd->cmd == ASYNC_GROUP_CMD_SEND) {
+			const void *ptr = cmd->data;
+			async_core_send_vector(shard->core, cmd->hid, &ptr, 
+				&cmd->size, 1, cmd->code);
+		}	else {
+			async_core_close(shard->core, cmd->hid, cmd->code);
+		}
+		ikmem_free(cmd);
+		cmd = next;
+	}
+}
+
+/* reactor thread: returns zero to stop */
+static int async_group_reactor(void *obj)
+{
+	struct CAsyncShard *shard = (struct CAsyncShard*)obj;
+	CAsyncGroup *group = shard->group;
+	if (group->running == 0) return 0;
+	/* stay off the core lock while other threads are entering */
+	while (shard->waiters > 0) {
+		iposix_event_wait(shard->idle, IEVENT_INFINITE);
+	}
+	async_group_execute(shard);
+	async_core_wait(shard->core, group->interval);
+	async_group_execute(shard);
+	if (group->handler) {
+		group->handler(group, shard->index, shard->core, group->user);
+	}
+	return 1;
+}
+
+/* locate shard of hid, returns NULL for invalid or closed hid. the
+   live hid table is written by the owner under the core lock, a hid 
+   closed right after this check is still caught by the reactor */
+static struct CAsyncShard *async_group_shard(CAsyncGroup *group, long hid)
+{
+	struct CAsyncShard *shard;
+	int index;
+	if (hid < 0) return NULL;
+	index = (int)ASYNC_CORE_HID_SHARD(hid);
+	if (index >= group->nshards) return NULL;
+	shard = &group->shards[index];
+	if (shard->core->hids[ASYNC_CORE_HID_INDEX(hid)] != (IINT32)hid)
+		return NULL;
+	return shard;
+}
+
+/* before calling into a shard core: the reactor holds the core lock 
+   while waiting, so wake it up and keep it off the lock until leave */
+static CAsyncCore *async_group_enter(struct CAsyncShard *shard)
+{
+	iatomic_add(&shard->waiters, 1);
+	if (iposix_thread_current() != shard->thread) {
+		async_core_notify(shard->core);
+	}
+	return shard->core;
+}
+
+/* after calling into a shard core, the last one lets the reactor go */
+static void async_group_leave(struct CAsyncShard *shard)
+{
+	if (iatomic_add(&shard->waiters, -1) == 0) {
+		iposix_event_set(shard->idle);
+	}
+}
+
+/* commands are only queued to a running reactor from other threads */
+static int async_group_direct(CAsyncGroup *group, 
+	struct CAsyncShard *shard)
+{
+	return (group->running == 0 || 
+		iposix_thread_current() == shard->thread);
+}
+
+/* live hid of each node index, -1 for free */
+static volatile IINT32 *async_group_hids(void)
+{
+	IINT32 *hids;
+	long i;
+	hids = (IINT32*)ikmem_malloc(sizeof(IINT32) * ASYNC_CORE_HID_SIZE);
+	if (hids == NULL) return NULL;
+	for (i = 0; i < ASYNC_CORE_HID_SIZE; i++) hids[i] = -1;
+	return hids;
+}
+
+/* create a group of nshards cores */
+CAsyncGroup* async_group_new(int nshards, int flags)
+{
+	CAsyncGroup *group;
+	int i;
+
+	if (nshards <= 0 || nshards > ASYNC_CORE_SHARD_MAX) return NULL;
+
+	group = (CAsyncGroup*)ikmem_malloc(sizeof(CAsyncGroup));
+	if (group == NULL) return NULL;
+
+	group->shards = (struct CAsyncShard*)
+		ikmem_malloc(sizeof(struct CAsyncShard) * nshards);
+
+	if (group->shards == NULL) {
+		ikmem_free(group);
+		return NULL;
+	}
+
+	group->nshards = nshards;
+	group->started = 0;
+	group->running = 0;
+	group->next = 0;
+	group->cursor = 0;
+	group->interval = 10;
+	group->handler = NULL;
+	group->user = NULL;
+
+	for (i = 0; i < nshards; i++) {
+		struct CAsyncShard *shard = &group->shards[i];
+		shard->group = group;
+		shard->index = i;
+		shard->core = async_core_new(flags & (~3));
+		shard->thread = NULL;
+		shard->idle = iposix_event_new();
+		shard->head = NULL;
+		shard->waiters = 0;
+		if (shard->core != NULL) {
+			shard->core->shard = i;
+			shard->core->hids = async_group_hids();
+			shard->thread = iposix_thread_new(async_group_reactor, 
+					shard, "AsyncReactor");
+		}
+		if (shard->core == NULL || shard->thread == NULL ||
+			shard->idle == NULL || shard->core->hids == NULL) {
+			group->nshards = i + 1;
+			async_group_delete(group);
+			return NULL;
+		}
+	}
+
+	return group;
+}
+
+/* delete group */
+void async_group_delete(CAsyncGroup *group)
+{
+	int i;
+	if (group == NULL) return;
+	async_group_stop(group);
+	for (i = 0; i < group->nshards; i++) {
+		struct CAsyncShard *shard = &group->shards[i];
+		if (shard->thread) iposix_thread_delete(shard->thread);
+		if (shard->core) async_group_execute(shard);
+		if (shard->core) async_core_delete(shard->core);
+		if (shard->idle) iposix_event_delete(shard->idle);
+		shard->thread = NULL;
+		shard->core = NULL;
+		shard->idle = NULL;
+	}
+	ikmem_free(group->shards);
+	group->shards = NULL;
+	ikmem_free(group);
+}
+
+/* start reactor threads */
+int async_group_start(CAsyncGroup *group, CAsyncGroupHandler handler,
+	void *user, IUINT32 interval)
+{
+	int i;
+	if (group->started) return -1;
+	group->handler = handler;
+	group->user = user;
+	group->interval = interval;
+	group->running = 1;
+	group->started = 1;
+	for (i = 0; i < group->nshards; i++) {
+		if (iposix_thread_start(group->shards[i].thread) != 0) {
+			async_group_stop(group);
+			return -2;
+		}
+	}
+	return 0;
+}
+
+/* stop reactor threads */
+void async_group_stop(CAsyncGroup *group)
+{
+	int i;
+	if (group->started == 0) return;
+	group->running = 0;
+	for (i = 0; i < group->nshards; i++) {
+		async_core_notify(group->shards[i].core);
+	}
+	for (i = 0; i < group->nshards; i++) {
+		iposix_thread_join(group->shards[i].thread, IEVENT_INFINITE);
+	}
+	/* commands queued while stopping */
+	for (i = 0; i < group->nshards; i++) {
+		async_group_execute(&group->shards[i]);
+	}
+	group->started = 0;
+}
+
+/* get shard count */
+int async_group_count(const CAsyncGroup *group)
+{
+	return group->nshards;
+}
+
+/* get the core of the given shard */
+CAsyncCore* async_group_core(CAsyncGroup *group, int shard)
+{
+	if (shard < 0 || shard >= group->nshards) return NULL;
+	return group->shards[shard].core;
+}
+
+/* get the core which owns the hid: no lock, shard is in the hid */
+CAsyncCore* async_group_owner(CAsyncGroup *group, long hid)
+{
+	struct CAsyncShard *shard = async_group_shard(group, hid);
+	return (shard == NULL)? NULL : shard->core;
+}
+
+/* open a SO_REUSEPORT listener on every shard */
+int async_group_new_listen(CAsyncGroup *group, const struct sockaddr *addr,
+	int addrlen, int header, long *hids)
+{
+	char name[128];
+	const struct sockaddr *target = addr;
+	int flag = 0x80 | ISOCK_REUSEPORT | ISOCK_UNIXREUSE;
+	int count = 0, i;
+	for (i = 0; i < group->nshards; i++) {
+		struct CAsyncShard *shard = &group->shards[i];
+		CAsyncCore *core = async_group_enter(shard);
+		long hid = async_core_new_listen(core, target, addrlen,
+				(header & 0xff) | (flag << 8));
+		async_group_leave(shard);
+		if (hids) hids[i] = hid;
+		if (hid < 0) {
+			if (i == 0) return (int)hid;
+			continue;
+		}
+		if (i == 0) {
+			/* port 0: the other shards must bind the chosen port */
+			int size = (addrlen > (int)sizeof(name))? 
+				(int)sizeof(name) : addrlen;
+			if (async_core_sockname(core, hid, (struct sockaddr*)name, 
+				&size) == 0) {
+				target = (const struct sockaddr*)name;
+			}
+		}
+		count++;
+	}
+	return count;
+}
+
+/* new connection on the next shard (round robin) */
+long async_group_new_connect(CAsyncGroup *group, 
+	const struct sockaddr *addr, int addrlen, int header)
+{
+	long next = iatomic_add(&group->next, 1);
+	struct CAsyncShard *shard = &group->shards[(iulong)next % group->nshards];
+	long hid = async_core_new_connect(async_group_enter(shard), 
+			addr, addrlen, header);
+	async_group_leave(shard);
+	return hid;
+}
+
+/* assign an existing socket to the next shard */
+long async_group_new_assign(CAsyncGroup *group, int fd, int header, 
+	int estab)
+{
+	long next = iatomic_add(&group->next, 1);
+	struct CAsyncShard *shard = &group->shards[(iulong)next % group->nshards];
+	long hid = async_core_new_assign(async_group_enter(shard), 
+			fd, header, estab);
+	async_group_leave(shard);
+	return hid;
+}
+
+/* send data to the owner shard of hid */
+long async_group_send(CAsyncGroup *group, long hid, const void *ptr, 
+	long len)
+{
+	return async_group_send_vector(group, hid, &ptr, &len, 1, 0);
+}
+
+/* send vector to the owner shard of hid */
+long async_group_send_vector(CAsyncGroup *group, long hid,
+	const void * const vecptr[],
+	const long veclen[], int count, int mask)
+{
+	struct CAsyncShard *shard = async_group_shard(group, hid);
+	struct CAsyncCommand *cmd;
+	long size = 0, pos = 0;
+	int i;
+	if (shard == NULL) return -100;
+	if (async_group_direct(group, shard)) {
+		return async_core_send_vector(shard->core, hid, vecptr, 
+				veclen, count, mask);
+	}
+	for (i = 0; i < count; i++) size += veclen[i];
+	cmd = (struct CAsyncCommand*)
+		ikmem_malloc(sizeof(struct CAsyncCommand) + size);
+	if (cmd == NULL) return -1000;
+	for (i = 0; i < count; i++) {
+		if (veclen[i] > 0) memcpy(cmd->data + pos, vecptr[i], veclen[i]);
+		pos += veclen[i];
+	}
+	cmd->cmd = ASYNC_GROUP_CMD_SEND;
+	cmd->code = mask;
+	cmd->hid = hid;
+	cmd->size = size;
+	async_group_push(shard, cmd);
+	return size;
+}
+
+/* close hid on its owner shard */
+int async_group_close(CAsyncGroup *group, long hid, int code)
+{
+	struct CAsyncShard *shard = async_group_shard(group, hid);
+	struct CAsyncCommand *cmd;
+	if (shard == NULL) return -1;
+	if (async_group_direct(group, shard)) {
+		return async_core_close(shard->core, hid, code);
+	}
+	cmd = (struct CAsyncCommand*)ikmem_malloc(sizeof(struct CAsyncCommand));
+	if (cmd == NULL) return -1000;
+	cmd->cmd = ASYNC_GROUP_CMD_CLOSE;
+	cmd->code = code;
+	cmd->hid = hid;
+	cmd->size = 0;
+	async_group_push(shard, cmd);
+	return 0;
+}
+
+/* read one event from any shard (round robin) */
+long async_group_read(CAsyncGroup *group, int *event, long *wparam,
+	long *lparam, void *data, long size)
+{
+	int i;
+	for (i = 0; i < group->nshards; i++) {
+		int index = (group->cursor + i) % group->nshards;
+		long hr = async_core_read(group->shards[index].core, 
+				event, wparam, lparam, data, size);
+		if (hr != -1) {
+			group->cursor = index;
+			return hr;
+		}
+	}
+	return -1;
+}
+
+
+
 /*===================================================================*/
 /* Thread Safe Queue                                                 */
 /*===================================================================*/
@@ -2918,6 +4468,183 @@ iulong queue_safe_size(iQueueSafe *q)
 
 
 
+
+/*===================================================================*/
+/* Work Stealing Deque                                               */
+/*===================================================================*/
+struct iWorkDequeArray
+{
+	ilong size;
+	struct iWorkDequeArray *prev;	/* retired array, freed in delete */
+	void * volatile data[1];
+};
+
+struct iWorkDeque
+{
+	volatile long top;				/* thieves side */
+	char padding[64 - sizeof(long)];
+	volatile long bottom;			/* owner side */
+	struct iWorkDequeArray * volatile array;
+};
+
+/* indices are long for iatomic_cas and may wrap around (long is 32
+   bits on win64), so they are only compared by distance */
+static inline long work_deque_span(long from, long to)
+{
+	return (long)((unsigned long)to - (unsigned long)from);
+}
+
+static inline long work_deque_step(long index, long delta)
+{
+	return (long)((unsigned long)index + (unsigned long)delta);
+}
+
+static inline void *volatile *work_deque_slot(
+	struct iWorkDequeArray *array, long index)
+{
+	return &array->data[(ilong)index & (array->size - 1)];
+}
+
+
+static struct iWorkDequeArray *work_deque_array_new(ilong size)
+{
+	struct iWorkDequeArray *array;
+	ilong need = sizeof(struct iWorkDequeArray) + sizeof(void*) * size;
+	array = (struct iWorkDequeArray*)ikmem_malloc(need);
+	if (array == NULL) return NULL;
+	array->size = size;
+	array->prev = NULL;
+	return array;
+}
+
+/* new deque, capacity grows automatically */
+iWorkDeque *work_deque_new(void)
+{
+	iWorkDeque *dq = (iWorkDeque*)ikmem_malloc(sizeof(iWorkDeque));
+	if (dq == NULL) return NULL;
+	dq->array = work_deque_array_new(256);
+	if (dq->array == NULL) {
+		ikmem_free(dq);
+		return NULL;
+	}
+	dq->top = 0;
+	dq->bottom = 0;
+	return dq;
+}
+
+/* delete deque */
+void work_deque_delete(iWorkDeque *dq)
+{
+	if (dq) {
+		struct iWorkDequeArray *array = dq->array;
+		while (array) {
+			struct iWorkDequeArray *prev = array->prev;
+			ikmem_free(array);
+			array = prev;
+		}
+		dq->array = NULL;
+		ikmem_free(dq);
+	}
+}
+
+/* grow array, old one is kept alive until delete for running thieves */
+static int work_deque_grow(iWorkDeque *dq, long top, long bottom)
+{
+	struct iWorkDequeArray *old = dq->array;
+	struct iWorkDequeArray *array;
+	long count = work_deque_span(top, bottom), i;
+	array = work_deque_array_new(old->size * 2);
+	if (array == NULL) return -1;
+	for (i = 0; i < count; i++) {
+		long k = work_deque_step(top, i);
+		*work_deque_slot(array, k) = *work_deque_slot(old, k);
+	}
+	array->prev = old;
+	iatomic_fence();
+	dq->array = array;
+	return 0;
+}
+
+/* owner only: push to bottom, returns 0 for success. a full barrier
+   is issued after push, so the owner can check idle thieves safely */
+int work_deque_push(iWorkDeque *dq, void *ptr)
+{
+	struct iWorkDequeArray *array;
+	long b, t;
+	b = dq->bottom;
+	t = dq->top;
+	array = dq->array;
+	if (work_deque_span(t, b) >= (long)array->size) {
+		if (work_deque_grow(dq, t, b) != 0) {
+			return -1;
+		}
+		array = dq->array;
+	}
+	*work_deque_slot(array, b) = ptr;
+	iatomic_fence();
+	dq->bottom = work_deque_step(b, 1);
+	iatomic_fence();
+	return 0;
+}
+
+/* owner only: pop from bottom (lifo), returns 1 for success, 0 for empty */
+int work_deque_pop(iWorkDeque *dq, void **ptr)
+{
+	struct iWorkDequeArray *array;
+	long b, t, n;
+	int hr = 1;
+	b = work_deque_step(dq->bottom, -1);
+	array = dq->array;
+	dq->bottom = b;
+	iatomic_fence();
+	t = dq->top;
+	n = work_deque_span(t, b);
+	if (n >= 0) {
+		ptr[0] = *work_deque_slot(array, b);
+		if (n == 0) {
+			/* last item: race against thieves */
+			if (!iatomic_cas(&dq->top, t, work_deque_step(t, 1))) hr = 0;
+			dq->bottom = work_deque_step(b, 1);
+		}
+	}	else {
+		hr = 0;
+		dq->bottom = work_deque_step(b, 1);
+	}
+	return hr;
+}
+
+/* any thread: steal from top (fifo), returns 1 for success, 0 for empty,
+   -1 for losing a race to another thief or the owner (can retry) */
+int work_deque_steal(iWorkDeque *dq, void **ptr)
+{
+	struct iWorkDequeArray *array;
+	long b, t;
+	int hr = 0;
+	t = dq->top;
+	iatomic_fence();
+	b = dq->bottom;
+	if (work_deque_span(t, b) > 0) {
+		void *x;
+		array = dq->array;
+		x = *work_deque_slot(array, t);
+		if (!iatomic_cas(&dq->top, t, work_deque_step(t, 1))) return -1;
+		ptr[0] = x;
+		hr = 1;
+	}
+	return hr;
+}
+
+/* approximate size, issues a full barrier before reading */
+ilong work_deque_size(iWorkDeque *dq)
+{
+	long b, t, n;
+	iatomic_fence();
+	b = dq->bottom;
+	t = dq->top;
+	n = work_deque_span(t, b);
+	return (n > 0)? (ilong)n : 0;
+}
+
 /*-------------------------------------------------------------------*/
 /* PROXY                                                             */
 /*-------------------------------------------------------------------*/
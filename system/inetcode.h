@@ -13,6 +13,7 @@
 
 #include "inetbase.h"
 #include "imemdata.h"
+#include "itimer.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -69,6 +70,21 @@ struct CAsyncSock
 	long bufsize;                /* working buffer size */
 	long maxsize;                /* max packet size */
 	long limited;                /* buffer limited */
+	long highmark;               /* send queue high watermark */
+	long lowmark;                /* send queue low watermark */
+	int policy;                  /* action when sending over highmark */
+	int paused;                  /* above highmark, not yet resumed */
+	long idle;                   /* idle timeout (ms), <0: core default */
+	int deadline;                /* armed deadlines: 1 connect 2 handshake */
+	IUINT32 expire_connect;      /* connect deadline */
+	IUINT32 expire_handshake;    /* handshake deadline */
+	void *owner;                 /* core owning the timer */
+	itimer_node timer;           /* nearest deadline on core wheel */
+	IINT64 ibytes;               /* bytes received */
+	IINT64 obytes;               /* bytes sent */
+	IUINT32 syscalls;            /* send/recv calls */
+	IUINT32 eagains;             /* calls that would block */
+	long accepts;                /* listener: max accepts per wakeup */
 	int rc4_send_x;              /* rc4 encryption variable */
 	int rc4_send_y;              /* rc4 encryption variable */
 	int rc4_recv_x;              /* rc4 encryption variable */
@@ -80,6 +96,7 @@ struct CAsyncSock
 	int protocol;                /* protocol */
 	struct ILISTHEAD node;       /* list node */
 	struct ILISTHEAD pending;    /* waiting close */
+	struct ILISTHEAD dirty;      /* waiting flush */
 	struct IMSTREAM linemsg;     /* line buffer */
 	struct IMSTREAM sendmsg;     /* send buffer */
 	struct IMSTREAM recvmsg;     /* recv buffer */
@@ -208,6 +225,9 @@ typedef struct CAsyncCore CAsyncCore;
 #define ASYNC_CORE_EVT_DGRAM     5   /* raw fd event: (hid, tag) */
 #define ASYNC_CORE_EVT_POST      6   /* msg from async_core_post */
 #define ASYNC_CORE_EVT_EXTEND    7   /* user defined event */
+#define ASYNC_CORE_EVT_PACKET    8   /* managed dgram batch: (hid, tag) */
+#define ASYNC_CORE_EVT_PAUSE     9   /* send queue above highmark */
+#define ASYNC_CORE_EVT_RESUME    10  /* send queue drained to lowmark */
 
 #define ASYNC_CORE_NODE_IN          1       /* accepted node */
 #define ASYNC_CORE_NODE_OUT         2       /* connected out node */
@@ -224,6 +244,19 @@ typedef struct CAsyncCore CAsyncCore;
 #define ASYNC_CORE_HID_MASK        ((ASYNC_CORE_HID_SIZE) - 1)
 #define ASYNC_CORE_HID_INDEX(hid)  ((hid) & ASYNC_CORE_HID_MASK) 
 
+/* group hids keep the shard in the low bits of the salt, so every
+ * shard has the full ASYNC_CORE_HID_SIZE index range, and the salt
+ * of a shard cycles through (1 << (15 - ASYNC_CORE_SHARD_BITS)) - 1
+ * values before a hid repeats */
+#ifndef ASYNC_CORE_SHARD_BITS
+#define ASYNC_CORE_SHARD_BITS      4        /* shard bits in group hid */
+#endif
+
+#define ASYNC_CORE_SHARD_MAX       (1 << (ASYNC_CORE_SHARD_BITS))
+#define ASYNC_CORE_SHARD_MASK      ((ASYNC_CORE_SHARD_MAX) - 1)
+#define ASYNC_CORE_HID_SHARD(hid)  \
+	(((hid) >> ASYNC_CORE_HID_BITS) & ASYNC_CORE_SHARD_MASK)
+
 
 
 /* Remote IP Validator: returns 1 to accept it, 0 to reject */
@@ -234,9 +267,75 @@ typedef int (*CAsyncValidator)(const struct sockaddr *remote, int len,
 typedef int (*CAsyncFilter)(CAsyncCore *core, void *object, long hid,
 	int cmd, const void *data, long size);
 
+/* reference counted message, returned by async_core_read_msg */
+struct CAsyncMsg
+{
+	int event;                   /* ASYNC_CORE_EVT_* */
+	long wparam;                 /* wparam */
+	long lparam;                 /* lparam */
+	long size;                   /* data size */
+	char *data;                  /* payload, valid until released */
+	volatile long refcnt;        /* private: reference count */
+	struct ILISTHEAD node;       /* private: queue node */
+};
+
+typedef struct CAsyncMsg CAsyncMsg;
+
+/* event descriptor filled by async_core_read_batch */
+struct CAsyncEvent
+{
+	int event;                   /* ASYNC_CORE_EVT_* */
+	long wparam;                 /* wparam */
+	long lparam;                 /* lparam */
+	long offset;                 /* data offset in the payload buffer */
+	long size;                   /* data size */
+};
+
+typedef struct CAsyncEvent CAsyncEvent;
+
+#define ASYNC_HIST_BUCKETS      124
+
+/* log-linear latency histogram in microseconds: four buckets for each
+ * power of two, a sample is within 25% of its bucket lower bound */
+struct CAsyncHist
+{
+	IUINT64 count;               /* samples */
+	IUINT64 total;               /* sum of samples (us) */
+	IUINT32 maximum;             /* largest sample (us) */
+	IUINT32 buckets[ASYNC_HIST_BUCKETS];
+};
+
+typedef struct CAsyncHist CAsyncHist;
+
+/* counters snapshot filled by async_core_stats */
+struct CAsyncStats
+{
+	IINT64 clock;                /* iclock64() when published */
+	IINT64 loops;                /* event loop iterations */
+	IINT64 events;               /* poll events dispatched */
+	IINT64 messages;             /* messages posted to the queue */
+	IINT64 bytes_in;             /* bytes received */
+	IINT64 bytes_out;            /* bytes sent */
+	IINT64 syscalls;             /* send/recv family calls */
+	IINT64 eagains;              /* calls that would block */
+	IINT64 resizes;              /* core buffer resizes */
+	IINT64 accepts;              /* connections accepted */
+	IINT64 accept_drops;         /* accepted then closed (limit, validator) */
+	IINT64 accept_full;          /* wakeups that left backlog behind */
+	long accept_peak;            /* most accepts in one wakeup */
+	long queue;                  /* messages waiting in the queue */
+	CAsyncHist wait;             /* ipoll_wait duration */
+	CAsyncHist dispatch;         /* handling of one batch of poll events */
+};
+
+typedef struct CAsyncStats CAsyncStats;
+
 /**
  * create CAsyncCore object:
- * if (flags & 1) disable lock, if (flags & 2) disable notify
+ * if (flags & 1) disable lock, if (flags & 2) disable notify,
+ * if (flags & 4) message reference mode: events are queued as CAsyncMsg
+ * and tcp data is received and framed in place over the stream pages,
+ * async_core_read_msg hands them out without further copies.
  */
 CAsyncCore* async_core_new(int flags);
 
@@ -261,6 +360,28 @@ int async_core_notify(CAsyncCore *core);
 long async_core_read(CAsyncCore *core, int *event, long *wparam,
 	long *lparam, void *data, long size);
 
+/**
+ * read one event as a message reference, returns NULL for no event,
+ * call async_msg_release when it is no longer needed. works in both
+ * modes, but only the reference mode (flags & 4) avoids the copy.
+ */
+CAsyncMsg* async_core_read_msg(CAsyncCore *core);
+
+/**
+ * read up to count events under a single lock acquisition: descriptors
+ * go to events[], data is packed into payload one after another.
+ * returns number of events read, 0 for no event, -2 for the first
+ * event larger than capacity.
+ */
+int async_core_read_batch(CAsyncCore *core, CAsyncEvent *events, 
+	int count, void *payload, long capacity);
+
+/* increase message reference count */
+void async_msg_addref(CAsyncMsg *msg);
+
+/* decrease message reference count, free it when reaches zero */
+void async_msg_release(CAsyncMsg *msg);
+
 
 /* send data to given hid */
 long async_core_send(CAsyncCore *core, long hid, const void *ptr, long len);
@@ -268,6 +389,15 @@ long async_core_send(CAsyncCore *core, long hid, const void *ptr, long len);
 /* close given hid */
 int async_core_close(CAsyncCore *core, long hid, int code);
 
+/**
+ * send count packets (hids[i], ptrs[i], lens[i]) under a single lock
+ * acquisition, results (can be NULL) receives the return value of each
+ * send, returns how many packets have been accepted.
+ */
+int async_core_send_many(CAsyncCore *core, const long hids[], 
+	const void * const ptrs[], const long lens[], int count, 
+	long results[]);
+
 /* send vector */
 long async_core_send_vector(CAsyncCore *core, long hid, 
 	const void * const vecptr[],
@@ -289,6 +419,26 @@ long async_core_new_assign(CAsyncCore *core, int fd, int header, int estab);
 long async_core_new_dgram(CAsyncCore *core, const struct sockaddr *addr,
 	int addrlen, int mode);
 
+/**
+ * send count datagrams (ptrs[i], lens[i]) to (remotes[i], addrlens[i])
+ * through a dgram hid with sendmmsg. with ASYNC_CORE_DGRAM_GSO, runs of
+ * equal sized packets to the same remote leave as one gso super packet.
+ * returns how many datagrams have been sent (less than count when the
+ * socket buffer is full), -1 for invalid hid, -2 for non-dgram hid.
+ */
+int async_core_send_packets(CAsyncCore *core, long hid, 
+	const void * const ptrs[], const long lens[], 
+	const struct sockaddr * const remotes[], const int addrlens[], 
+	int count);
+
+/**
+ * iterate datagrams of an ASYNC_CORE_EVT_PACKET message: *pos starts at
+ * zero, remote/addrlen (can be NULL) receive the peer address. returns
+ * payload size and advances *pos, or -1 when the batch is exhausted.
+ */
+long async_core_packet_next(const void *data, long size, long *pos,
+	struct sockaddr *remote, int *addrlen, const void **payload);
+
 
 /* queue an ASYNC_CORE_EVT_POST event and wake async_core_wait up */
 int async_core_post(CAsyncCore *core, long wparam, long lparam, 
@@ -346,6 +496,32 @@ long async_core_node_prev(const CAsyncCore *core, long hid);
 #define ASYNC_CORE_OPTION_SHUTDOWN      17
 #define ASYNC_CORE_OPTION_GET_HEADER    18
 #define ASYNC_CORE_OPTION_GET_PROTOCOL  19
+#define ASYNC_CORE_OPTION_DGRAM         20
+
+#define ASYNC_CORE_DGRAM_MANAGED    1   /* core reads with recvmmsg */
+#define ASYNC_CORE_DGRAM_GRO        2   /* udp gro (linux 5.0+) */
+#define ASYNC_CORE_DGRAM_GSO        4   /* udp gso (linux 4.18+) */
+
+#define ASYNC_CORE_OPTION_HIGHMARK      21
+#define ASYNC_CORE_OPTION_LOWMARK       22
+#define ASYNC_CORE_OPTION_POLICY        23
+
+#define ASYNC_CORE_POLICY_NONE      0   /* only report pause/resume */
+#define ASYNC_CORE_POLICY_DROP      1   /* reject sends while paused */
+#define ASYNC_CORE_POLICY_CLOSE     2   /* close hid with code 2009 */
+#define ASYNC_CORE_POLICY_BLOCK     3   /* block producer thread, DROP
+                                           for the async_core_wait one */
+
+/* per-hid deadlines, expiring ones close with code 2007 (idle), 2011
+ * (connect) or 2012 (handshake, cleared by setting it to zero) */
+#define ASYNC_CORE_OPTION_IDLE          24  /* idle ms, 0 off, <0 default */
+#define ASYNC_CORE_OPTION_CONNECT       25  /* connect timeout ms, 0 off */
+#define ASYNC_CORE_OPTION_HANDSHAKE     26  /* handshake ms from now, 0 off */
+
+/* listener options */
+#define ASYNC_CORE_OPTION_ACCEPTS       27  /* max accepts per wakeup */
+#define ASYNC_CORE_OPTION_DEFERACCEPT   28  /* TCP_DEFER_ACCEPT seconds */
+#define ASYNC_CORE_OPTION_FASTOPEN      29  /* TCP_FASTOPEN queue length */
 
 /* set connection socket option */
 int async_core_option(CAsyncCore *core, long hid, int opt, long value);
@@ -353,10 +529,25 @@ int async_core_option(CAsyncCore *core, long hid, int opt, long value);
 #define ASYNC_CORE_STATUS_STATE     0
 #define ASYNC_CORE_STATUS_IPV6      1
 #define ASYNC_CORE_STATUS_ESTAB     2
+#define ASYNC_CORE_STATUS_IBYTES    3   /* bytes received */
+#define ASYNC_CORE_STATUS_OBYTES    4   /* bytes sent */
 
 /* get connection socket status */
 long async_core_status(CAsyncCore *core, long hid, int opt);
 
+/**
+ * copy the counters published by the event loop (at most once per
+ * millisecond), never waits for async_core_wait to return. rates come
+ * from the difference of two snapshots over stats->clock.
+ */
+void async_core_stats(CAsyncCore *core, CAsyncStats *stats);
+
+/* add a sample (us) to histogram */
+void async_hist_add(CAsyncHist *hist, IUINT32 usec);
+
+/* lower bound (us) of the bucket holding given percentile (0-100) */
+IUINT32 async_hist_percentile(const CAsyncHist *hist, double percent);
+
 /* set connection rc4 send key */
 int async_core_rc4_set_skey(CAsyncCore *core, long hid, 
 	const unsigned char *key, int keylen);
@@ -402,7 +593,7 @@ void* async_core_registry(CAsyncCore *core, int op, int value, void *ptr);
 /* set protocol: use factory to create a CAsyncFilter and install it */
 int async_core_protocol(CAsyncCore *core, long hid, int protocol);
 
-/* set timeout */
+/* set default idle timeout of all hids following the core default */
 void async_core_timeout(CAsyncCore *core, long seconds);
 
 /* getsockname */
@@ -418,6 +609,88 @@ long async_core_nfds(const CAsyncCore *core);
 
 
 
+/*===================================================================*/
+/* CAsyncGroup: sharded multi-reactor                                */
+/*===================================================================*/
+struct CAsyncGroup;
+typedef struct CAsyncGroup CAsyncGroup;
+
+/* called in the reactor thread after each wait, drain the shard here */
+typedef void (*CAsyncGroupHandler)(CAsyncGroup *group, int shard,
+	CAsyncCore *core, void *user);
+
+/**
+ * create a group of nshards cores, each one will be driven by its own
+ * reactor thread. hids from the group encode the owner shard (see
+ * ASYNC_CORE_HID_SHARD), flags are the same as async_core_new, except
+ * that lock and notify can not be disabled.
+ */
+CAsyncGroup* async_group_new(int nshards, int flags);
+
+/* delete group, stop the reactors first */
+void async_group_delete(CAsyncGroup *group);
+
+/* start reactor threads, handler can be NULL if events are consumed 
+   by async_group_read, interval is the wait time of each loop */
+int async_group_start(CAsyncGroup *group, CAsyncGroupHandler handler,
+	void *user, IUINT32 interval);
+
+/* stop reactor threads */
+void async_group_stop(CAsyncGroup *group);
+
+/* get shard count */
+int async_group_count(const CAsyncGroup *group);
+
+/* get the core of the given shard, outside the reactor thread prefer
+   async_group_* calls: the reactor holds the core lock while waiting */
+CAsyncCore* async_group_core(CAsyncGroup *group, int shard);
+
+/* get the core which owns the hid, returns NULL for invalid or 
+   closed hid */
+CAsyncCore* async_group_owner(CAsyncGroup *group, long hid);
+
+/**
+ * open a SO_REUSEPORT listener on every shard, so the kernel spreads
+ * incoming connections across reactors. hids (can be NULL) receives
+ * the listener hid of each shard, returns how many shards are
+ * listening, or below zero for error.
+ */
+int async_group_new_listen(CAsyncGroup *group, const struct sockaddr *addr,
+	int addrlen, int header, long *hids);
+
+/* new connection on the next shard (round robin), returns hid */
+long async_group_new_connect(CAsyncGroup *group, 
+	const struct sockaddr *addr, int addrlen, int header);
+
+/* assign an existing socket to the next shard, returns hid */
+long async_group_new_assign(CAsyncGroup *group, int fd, int header, 
+	int estab);
+
+/**
+ * send data to the owner shard of hid. outside the reactor thread of
+ * a running group it is queued lock free to that reactor and returns
+ * len (or -100 for invalid or closed hid, -1000 for no memory): later
+ * failures of the queued send show up as events, and BLOCK policy
+ * acts as DROP there.
+ */
+long async_group_send(CAsyncGroup *group, long hid, const void *ptr, 
+	long len);
+
+/* send vector to the owner shard of hid, queued like async_group_send */
+long async_group_send_vector(CAsyncGroup *group, long hid,
+	const void * const vecptr[],
+	const long veclen[], int count, int mask);
+
+/* close hid on its owner shard, queued like async_group_send, 
+   returns -1 for invalid or closed hid */
+int async_group_close(CAsyncGroup *group, long hid, int code);
+
+/* read one event from any shard (round robin), same as async_core_read */
+long async_group_read(CAsyncGroup *group, int *event, long *wparam,
+	long *lparam, void *data, long size);
+
+
+
 /*===================================================================*/
 /* Thread Safe Queue                                                 */
 /*===================================================================*/
@@ -457,6 +730,33 @@ iulong queue_safe_size(iQueueSafe *q);
 
 
 
+/*===================================================================*/
+/* Work Stealing Deque (Chase-Lev)                                   */
+/*===================================================================*/
+struct iWorkDeque;
+typedef struct iWorkDeque iWorkDeque;
+
+/* new deque */
+iWorkDeque *work_deque_new(void);
+
+/* delete deque */
+void work_deque_delete(iWorkDeque *dq);
+
+/* owner only: push to bottom, returns 0 for success */
+int work_deque_push(iWorkDeque *dq, void *ptr);
+
+/* owner only: pop from bottom, returns 1 for success, 0 for empty */
+int work_deque_pop(iWorkDeque *dq, void **ptr);
+
+/* any thread: steal from top, returns 1 for success, 0 for empty, 
+   -1 for contention (try again later) */
+int work_deque_steal(iWorkDeque *dq, void **ptr);
+
+/* approximate size */
+ilong work_deque_size(iWorkDeque *dq);
+
+
+
 /*-------------------------------------------------------------------*/
 /* PROXY                                                             */
 /*-------------------------------------------------------------------*/
@@ -26,6 +26,8 @@ const IUINT32 IKCP_CMD_PUSH = 81;		// cmd: push data
 const IUINT32 IKCP_CMD_ACK  = 82;		// cmd: ack
 const IUINT32 IKCP_CMD_WASK = 83;		// cmd: window probe (ask)
 const IUINT32 IKCP_CMD_WINS = 84;		// cmd: window size (tell)
+const IUINT32 IKCP_CMD_SACK = 85;		// cmd: selective ack ranges
+const IUINT32 IKCP_SACK_FLAG = 0x80;	// frg of ack/wask/wins: sack able
 const IUINT32 IKCP_ASK_SEND = 1;		// need to send IKCP_CMD_WASK
 const IUINT32 IKCP_ASK_TELL = 2;		// need to send IKCP_CMD_WINS
 const IUINT32 IKCP_WND_SND = 32;
@@ -47,16 +49,46 @@ const IUINT32 IKCP_FASTACK_LIMIT = 5;		// max times to trigger fastack
 //---------------------------------------------------------------------
 typedef struct IKCPSEG IKCPSEG;
 
+// segments up to pool_cap (mss) bytes are recycled through seg_pool,
+// bigger ones (peer with larger mtu) go back to the allocator
 static IKCPSEG* ikcp_segment_new(ikcpcb *kcp, int size)
 {
-	return (IKCPSEG*)ikmem_malloc(sizeof(IKCPSEG) + size);
+	IKCPSEG *seg;
+	if (size <= (int)kcp->pool_cap) {
+		if (!ilist_is_empty(&kcp->seg_pool)) {
+			seg = ilist_entry(kcp->seg_pool.next, IKCPSEG, node);
+			ilist_del(&seg->node);
+			kcp->npool--;
+			return seg;
+		}
+		size = (int)kcp->pool_cap;
+	}
+	seg = (IKCPSEG*)ikmem_malloc(sizeof(IKCPSEG) + size);
+	if (seg) seg->cap = (IUINT32)size;
+	return seg;
 }
 
 static void ikcp_segment_delete(ikcpcb *kcp, IKCPSEG *seg)
 {
+	if (seg->cap == kcp->pool_cap && 
+		kcp->npool < kcp->snd_wnd + kcp->rcv_wnd) {
+		ilist_add(&seg->node, &kcp->seg_pool);
+		kcp->npool++;
+		return;
+	}
 	ikmem_free(seg);
 }
 
+static void ikcp_pool_clear(ikcpcb *kcp)
+{
+	while (!ilist_is_empty(&kcp->seg_pool)) {
+		IKCPSEG *seg = ilist_entry(kcp->seg_pool.next, IKCPSEG, node);
+		ilist_del(&seg->node);
+		ikmem_free(seg);
+	}
+	kcp->npool = 0;
+}
+
 void ikcp_log(ikcpcb *kcp, int mask, const char *fmt, ...)
 {
 	char buffer[1024];
@@ -74,14 +106,35 @@ static int ikcp_canlog(const ikcpcb *kcp, int mask)
 	return 1;
 }
 
+static int ikcp_output_batch(ikcpcb *kcp)
+{
+	int count = kcp->nbatch;
+	kcp->nbatch = 0;
+	if (count == 0) return 0;
+	assert(kcp->output_batch);
+	return kcp->output_batch(kcp->bvec, count, kcp, kcp->user);
+}
+
 static int ikcp_output(ikcpcb *kcp, const void *data, int size)
 {
 	assert(kcp);
-	assert(kcp->output);
+	assert(kcp->output || kcp->batch_max > 0);
 	if (ikcp_canlog(kcp, IKCP_LOG_OUTPUT)) {
 		ikcp_log(kcp, IKCP_LOG_OUTPUT, "[RO] %ld bytes", (long)size);
 	}
 	if (size == 0) return 0;
+	if (kcp->batch_max > 0) {
+		char *ptr;
+		if (kcp->nbatch >= kcp->batch_max) {
+			ikcp_output_batch(kcp);
+		}
+		ptr = kcp->batch + kcp->nbatch * kcp->mtu;
+		memcpy(ptr, data, size);
+		kcp->bvec[kcp->nbatch].data = ptr;
+		kcp->bvec[kcp->nbatch].size = size;
+		kcp->nbatch++;
+		return 0;
+	}
 	return kcp->output((const char*)data, size, kcp, kcp->user);
 }
 
@@ -143,8 +196,16 @@ ikcpcb* ikcp_create(IUINT32 conv, void *user)
 	ilist_init(&kcp->rcv_queue);
 	ilist_init(&kcp->snd_buf);
 	ilist_init(&kcp->rcv_buf);
+	kcp->snd_ring = NULL;
+	kcp->rcv_ring = NULL;
+	kcp->snd_mask = 0;
+	kcp->rcv_mask = 0;
+	ilist_init(&kcp->seg_pool);
+	kcp->npool = 0;
+	kcp->pool_cap = kcp->mss;
 	kcp->nrcv_buf = 0;
 	kcp->nsnd_buf = 0;
+	kcp->nsnd_bytes = 0;
 	kcp->nrcv_que = 0;
 	kcp->nsnd_que = 0;
 	kcp->state = 0;
@@ -164,9 +225,21 @@ ikcpcb* ikcp_create(IUINT32 conv, void *user)
 	kcp->fastresend = 0;
 	kcp->fastlimit = IKCP_FASTACK_LIMIT;
 	kcp->nocwnd = 0;
+	kcp->sack = 0;
+	kcp->sack_peer = 0;
+	kcp->sack_tell = 0;
+	kcp->sack_sn = 0;
+	kcp->cc = &ikcp_cc_reno;
+	kcp->ccdata = NULL;
+	kcp->batch = NULL;
+	kcp->bvec = NULL;
+	kcp->nbatch = 0;
+	kcp->batch_max = 0;
+	memset(&kcp->stats, 0, sizeof(kcp->stats));
 	kcp->xmit = 0;
     kcp->dead_link = IKCP_DEADLINK;
 	kcp->output = NULL;
+	kcp->output_batch = NULL;
 	kcp->writelog = NULL;
 
 	return kcp;
@@ -181,6 +254,9 @@ void ikcp_release(ikcpcb *kcp)
 	assert(kcp);
 	if (kcp) {
 		IKCPSEG *seg;
+		if (kcp->cc && kcp->cc->release) {
+			kcp->cc->release(kcp);
+		}
 		while (!ilist_is_empty(&kcp->snd_buf)) {
 			seg = ilist_entry(kcp->snd_buf.next, IKCPSEG, node);
 			ilist_del(&seg->node);
@@ -201,20 +277,35 @@ void ikcp_release(ikcpcb *kcp)
 			ilist_del(&seg->node);
 			ikcp_segment_delete(kcp, seg);
 		}
+		ikcp_pool_clear(kcp);
 		if (kcp->buffer) {
 			ikmem_free(kcp->buffer);
 		}
 		if (kcp->acklist) {
 			iv_delete(kcp->acklist);
 		}
+		if (kcp->snd_ring) {
+			ikmem_free(kcp->snd_ring);
+		}
+		if (kcp->rcv_ring) {
+			ikmem_free(kcp->rcv_ring);
+		}
+		if (kcp->bvec) {
+			ikmem_free(kcp->bvec);
+		}
 
 		kcp->nrcv_buf = 0;
 		kcp->nsnd_buf = 0;
+		kcp->nsnd_bytes = 0;
 		kcp->nrcv_que = 0;
 		kcp->nsnd_que = 0;
 		kcp->ackcount = 0;
 		kcp->buffer = NULL;
 		kcp->acklist = NULL;
+		kcp->snd_ring = NULL;
+		kcp->rcv_ring = NULL;
+		kcp->batch = NULL;
+		kcp->bvec = NULL;
 		ikmem_free(kcp);
 	}
 }
@@ -222,10 +313,135 @@ void ikcp_release(ikcpcb *kcp)
 
 
 //---------------------------------------------------------------------
-// user/upper level recv: returns size, returns below zero for EAGAIN
+// sequence number indexed rings
 //---------------------------------------------------------------------
-int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
+static int ikcp_ring_build(IKCPSEG ***ring, IUINT32 *mask, IUINT32 wnd,
+	const struct ILISTHEAD *head)
+{
+	const struct ILISTHEAD *p;
+	IKCPSEG **data;
+	IUINT32 size = 1;
+	while (size < wnd) size <<= 1;
+	data = (IKCPSEG**)ikmem_malloc(sizeof(IKCPSEG*) * size);
+	if (data == NULL) return -1;
+	memset(data, 0, sizeof(IKCPSEG*) * size);
+	for (p = head->next; p != head; p = p->next) {
+		IKCPSEG *seg = ilist_entry(p, IKCPSEG, node);
+		data[seg->sn & (size - 1)] = seg;
+	}
+	if (*ring) ikmem_free(*ring);
+	*ring = data;
+	*mask = size - 1;
+	return 0;
+}
+
+static int ikcp_ring_resize(ikcpcb *kcp)
+{
+	IUINT32 inflight = kcp->snd_nxt - kcp->snd_una;
+	IUINT32 snd = _imax(kcp->snd_wnd, inflight);
+	if (kcp->snd_ring == NULL) return 0;
+	if (snd > kcp->snd_mask + 1 || kcp->rcv_wnd > kcp->rcv_mask + 1) {
+		if (ikcp_ring_build(&kcp->snd_ring, &kcp->snd_mask, snd,
+				&kcp->snd_buf) != 0)
+			return -1;
+		if (ikcp_ring_build(&kcp->rcv_ring, &kcp->rcv_mask, kcp->rcv_wnd,
+				&kcp->rcv_buf) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+// move available data from rcv_buf -> rcv_queue
+static void ikcp_move_rcv(ikcpcb *kcp)
+{
+	if (kcp->rcv_ring) {
+		while (kcp->nrcv_buf > 0 && kcp->nrcv_que < kcp->rcv_wnd) {
+			IKCPSEG **slot = &kcp->rcv_ring[kcp->rcv_nxt & kcp->rcv_mask];
+			IKCPSEG *seg = *slot;
+			if (seg == NULL) break;
+			*slot = NULL;
+			ilist_del(&seg->node);
+			kcp->nrcv_buf--;
+			ilist_add_tail(&seg->node, &kcp->rcv_queue);
+			kcp->nrcv_que++;
+			kcp->rcv_nxt++;
+		}
+		return;
+	}
+	while (! ilist_is_empty(&kcp->rcv_buf)) {
+		IKCPSEG *seg = ilist_entry(kcp->rcv_buf.next, IKCPSEG, node);
+		if (seg->sn == kcp->rcv_nxt && kcp->nrcv_que < kcp->rcv_wnd) {
+			ilist_del(&seg->node);
+			kcp->nrcv_buf--;
+			ilist_add_tail(&seg->node, &kcp->rcv_queue);
+			kcp->nrcv_que++;
+			kcp->rcv_nxt++;
+		}	else {
+			break;
+		}
+	}
+}
+
+
+//---------------------------------------------------------------------
+// copy between vectors and a flat cursor
+//---------------------------------------------------------------------
+struct IKCPCURSOR
+{
+	const ikcpvec *vecs;
+	int count;
+	int index;
+	int offset;
+};
+
+static void ikcp_cursor_init(struct IKCPCURSOR *cur, const ikcpvec *vecs,
+	int count)
+{
+	cur->vecs = vecs;
+	cur->count = count;
+	cur->index = 0;
+	cur->offset = 0;
+}
+
+// read (dir == 0) from or write (dir == 1) to the vectors
+static void ikcp_cursor_copy(struct IKCPCURSOR *cur, char *data, int size,
+	int dir)
 {
+	while (size > 0 && cur->index < cur->count) {
+		const ikcpvec *vec = &cur->vecs[cur->index];
+		int canuse = vec->size - cur->offset;
+		if (canuse > size) canuse = size;
+		if (canuse > 0 && vec->data) {
+			if (dir == 0) memcpy(data, vec->data + cur->offset, canuse);
+			else memcpy(vec->data + cur->offset, data, canuse);
+		}
+		if (canuse > 0) {
+			data += canuse;
+			size -= canuse;
+			cur->offset += canuse;
+		}
+		if (cur->offset >= vec->size) {
+			cur->index++;
+			cur->offset = 0;
+		}
+	}
+}
+
+static int ikcp_vec_size(const ikcpvec *vecs, int count)
+{
+	int size = 0, i;
+	for (i = 0; i < count; i++) size += vecs[i].size;
+	return size;
+}
+
+
+//---------------------------------------------------------------------
+// recv next message into vectors (NULL data drops), len < 0 to peek
+//---------------------------------------------------------------------
+static int ikcp_recv_vec(ikcpcb *kcp, const ikcpvec *vecs, int count,
+	int len)
+{
+	struct IKCPCURSOR cursor;
 	struct ILISTHEAD *p;
 	int ispeek = (len < 0)? 1 : 0;
 	int peeksize;
@@ -249,16 +465,15 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 	if (kcp->nrcv_que >= kcp->rcv_wnd)
 		recover = 1;
 
+	ikcp_cursor_init(&cursor, vecs, count);
+
 	// merge fragment
 	for (len = 0, p = kcp->rcv_queue.next; p != &kcp->rcv_queue; ) {
 		int fragment;
 		seg = ilist_entry(p, IKCPSEG, node);
 		p = p->next;
 
-		if (buffer) {
-			memcpy(buffer, seg->data, seg->len);
-			buffer += seg->len;
-		}
+		ikcp_cursor_copy(&cursor, seg->data, seg->len, 1);
 
 		len += seg->len;
 		fragment = seg->frg;
@@ -280,18 +495,7 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 	assert(len == peeksize);
 
 	// move available data from rcv_buf -> rcv_queue
-	while (! ilist_is_empty(&kcp->rcv_buf)) {
-		IKCPSEG *seg = ilist_entry(kcp->rcv_buf.next, IKCPSEG, node);
-		if (seg->sn == kcp->rcv_nxt && kcp->nrcv_que < kcp->rcv_wnd) {
-			ilist_del(&seg->node);
-			kcp->nrcv_buf--;
-			ilist_add_tail(&seg->node, &kcp->rcv_queue);
-			kcp->nrcv_que++;
-			kcp->rcv_nxt++;
-		}	else {
-			break;
-		}
-	}
+	ikcp_move_rcv(kcp);
 
 	// fast recover
 	if (kcp->nrcv_que < kcp->rcv_wnd && recover) {
@@ -304,6 +508,56 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
 }
 
 
+//---------------------------------------------------------------------
+// user/upper level recv: returns size, returns below zero for EAGAIN
+//---------------------------------------------------------------------
+int ikcp_recv(ikcpcb *kcp, char *buffer, int len)
+{
+	ikcpvec vec;
+	vec.data = buffer;
+	vec.size = (len < 0)? -len : len;
+	return ikcp_recv_vec(kcp, &vec, 1, len);
+}
+
+
+//---------------------------------------------------------------------
+// scatter recv
+//---------------------------------------------------------------------
+int ikcp_recvv(ikcpcb *kcp, const ikcpvec *vecs, int count)
+{
+	return ikcp_recv_vec(kcp, vecs, count, ikcp_vec_size(vecs, count));
+}
+
+
+//---------------------------------------------------------------------
+// peek next message as fragment pointers
+//---------------------------------------------------------------------
+int ikcp_peekv(const ikcpcb *kcp, ikcpvec *vecs, int count)
+{
+	const struct ILISTHEAD *p;
+	const IKCPSEG *seg;
+	int need;
+
+	if (ikcp_peeksize(kcp) < 0) return -1;
+
+	seg = ilist_entry(kcp->rcv_queue.next, const IKCPSEG, node);
+	need = (int)seg->frg + 1;
+
+	if (need > count) return -need;
+
+	for (count = 0, p = kcp->rcv_queue.next; p != &kcp->rcv_queue; ) {
+		seg = ilist_entry(p, const IKCPSEG, node);
+		p = p->next;
+		vecs[count].data = (char*)seg->data;
+		vecs[count].size = (int)seg->len;
+		count++;
+		if (seg->frg == 0) break;
+	}
+
+	return count;
+}
+
+
 //---------------------------------------------------------------------
 // peek data size
 //---------------------------------------------------------------------
@@ -333,15 +587,19 @@ int ikcp_peeksize(const ikcpcb *kcp)
 
 
 //---------------------------------------------------------------------
-// user/upper level send, returns below zero for error
+// send from vectors (NULL data reserves without copy)
 //---------------------------------------------------------------------
-int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
+static int ikcp_send_vec(ikcpcb *kcp, const ikcpvec *vecs, int count,
+	int len)
 {
+	struct IKCPCURSOR cursor;
 	IKCPSEG *seg;
-	int count, i;
+	int i;
 
 	assert(kcp->mss > 0);
 	if (len < 0) return -1;
+
+	ikcp_cursor_init(&cursor, vecs, count);
 	
 	// append to previous segment in stream mode (when possible)
 	if (kcp->stream != 0) {
@@ -350,22 +608,27 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 			if (old->len < kcp->mss) {
 				int capacity = kcp->mss - old->len;
 				int extend = (len < capacity)? len : capacity;
-				seg = ikcp_segment_new(kcp, old->len + extend);
-				assert(seg);
-				if (seg == NULL) {
-					return -2;
-				}
-				ilist_add_tail(&seg->node, &kcp->snd_queue);
-				memcpy(seg->data, old->data, old->len);
-				if (buffer) {
-					memcpy(seg->data + old->len, buffer, extend);
-					buffer += extend;
+				if (old->len + extend <= old->cap) {
+					// pooled segments have room for a whole mss
+					ikcp_cursor_copy(&cursor, old->data + old->len, 
+						extend, 0);
+					old->len += extend;
+				}	else {
+					seg = ikcp_segment_new(kcp, old->len + extend);
+					assert(seg);
+					if (seg == NULL) {
+						return -2;
+					}
+					ilist_add_tail(&seg->node, &kcp->snd_queue);
+					memcpy(seg->data, old->data, old->len);
+					ikcp_cursor_copy(&cursor, seg->data + old->len, 
+						extend, 0);
+					seg->len = old->len + extend;
+					seg->frg = 0;
+					ilist_del_init(&old->node);
+					ikcp_segment_delete(kcp, old);
 				}
-				seg->len = old->len + extend;
-				seg->frg = 0;
 				len -= extend;
-				ilist_del_init(&old->node);
-				ikcp_segment_delete(kcp, old);
 			}
 		}
 		if (len <= 0) {
@@ -388,17 +651,14 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 		if (seg == NULL) {
 			return -2;
 		}
-		if (buffer && len > 0) {
-			memcpy(seg->data, buffer, size);
+		if (len > 0) {
+			ikcp_cursor_copy(&cursor, seg->data, size, 0);
 		}
 		seg->len = size;
 		seg->frg = (kcp->stream == 0)? (count - i - 1) : 0;
 		ilist_init(&seg->node);
 		ilist_add_tail(&seg->node, &kcp->snd_queue);
 		kcp->nsnd_que++;
-		if (buffer) {
-			buffer += size;
-		}
 		len -= size;
 	}
 
@@ -406,11 +666,33 @@ int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
 }
 
 
+//---------------------------------------------------------------------
+// user/upper level send, returns below zero for error
+//---------------------------------------------------------------------
+int ikcp_send(ikcpcb *kcp, const char *buffer, int len)
+{
+	ikcpvec vec;
+	vec.data = (char*)buffer;
+	vec.size = len;
+	return ikcp_send_vec(kcp, &vec, 1, len);
+}
+
+
+//---------------------------------------------------------------------
+// gather send
+//---------------------------------------------------------------------
+int ikcp_sendv(ikcpcb *kcp, const ikcpvec *vecs, int count)
+{
+	return ikcp_send_vec(kcp, vecs, count, ikcp_vec_size(vecs, count));
+}
+
+
 //---------------------------------------------------------------------
 // parse ack
 //---------------------------------------------------------------------
 static void ikcp_update_ack(ikcpcb *kcp, IINT32 rtt)
 {
+	struct IKCPSTATS *st = &kcp->stats;
 	IINT32 rto = 0;
 	if (kcp->rx_srtt == 0) {
 		kcp->rx_srtt = rtt;
@@ -425,6 +707,15 @@ static void ikcp_update_ack(ikcpcb *kcp, IINT32 rtt)
 	rto = kcp->rx_srtt + _imax(1, 4 * kcp->rx_rttval);
 	kcp->rx_rto = _ibound(kcp->rx_minrto, rto, IKCP_RTO_MAX);
 	kcp->rx_rtt = (IUINT32)rtt;
+	if (st->rtts++ == 0 || rtt < st->rtt_min) st->rtt_min = rtt;
+	if (rtt > st->rtt_max) st->rtt_max = rtt;
+	if (st->samples == 0 || 
+		itimediff(kcp->current, st->ts_sample) >= (IINT32)kcp->interval) {
+		int i = (int)(st->samples++ % IKCP_STATS_HISTORY);
+		st->srtt[i] = kcp->rx_srtt;
+		st->rttvar[i] = kcp->rx_rttval;
+		st->ts_sample = kcp->current;
+	}
 }
 
 static void ikcp_shrink_buf(ikcpcb *kcp)
@@ -438,18 +729,39 @@ static void ikcp_shrink_buf(ikcpcb *kcp)
 	}
 }
 
-static void ikcp_parse_ack(ikcpcb *kcp, IUINT32 sn)
+// ts: send time echoed by the ack, NULL if unknown
+static void ikcp_parse_ack(ikcpcb *kcp, IUINT32 sn, const IUINT32 *ts)
 {
 	struct ILISTHEAD *p, *next;
 
 	if (itimediff(sn, kcp->snd_una) < 0 || itimediff(sn, kcp->snd_nxt) >= 0)
 		return;
 
+	if (kcp->snd_ring) {
+		IKCPSEG **slot = &kcp->snd_ring[sn & kcp->snd_mask];
+		IKCPSEG *seg = *slot;
+		if (seg != NULL && seg->sn == sn) {
+			if (ts && seg->xmit > 1 && seg->ts != *ts) {
+				kcp->stats.rexmit_early++;
+			}
+			*slot = NULL;
+			ilist_del(&seg->node);
+			kcp->nsnd_bytes -= seg->len;
+			ikcp_segment_delete(kcp, seg);
+			kcp->nsnd_buf--;
+		}
+		return;
+	}
+
 	for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = next) {
 		IKCPSEG *seg = ilist_entry(p, IKCPSEG, node);
 		next = p->next;
 		if (sn == seg->sn) {
+			if (ts && seg->xmit > 1 && seg->ts != *ts) {
+				kcp->stats.rexmit_early++;
+			}
 			ilist_del(p);
+			kcp->nsnd_bytes -= seg->len;
 			ikcp_segment_delete(kcp, seg);
 			kcp->nsnd_buf--;
 			break;
@@ -467,7 +779,11 @@ static void ikcp_parse_una(ikcpcb *kcp, IUINT32 una)
 		IKCPSEG *seg = ilist_entry(p, IKCPSEG, node);
 		next = p->next;
 		if (itimediff(una, seg->sn) > 0) {
+			if (kcp->snd_ring) {
+				kcp->snd_ring[seg->sn & kcp->snd_mask] = NULL;
+			}
 			ilist_del(p);
+			kcp->nsnd_bytes -= seg->len;
 			ikcp_segment_delete(kcp, seg);
 			kcp->nsnd_buf--;
 		}	else {
@@ -477,6 +793,71 @@ static void ikcp_parse_una(ikcpcb *kcp, IUINT32 una)
 }
 
 
+// ring mode: segments before the highest acked sn of a datagram count
+// one fastack, instead of one per ack while searching the list
+static void ikcp_parse_fastack(ikcpcb *kcp, IUINT32 sn)
+{
+	struct ILISTHEAD *p;
+
+	if (itimediff(sn, kcp->snd_una) < 0 || itimediff(sn, kcp->snd_nxt) >= 0)
+		return;
+
+	for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
+		IKCPSEG *seg = ilist_entry(p, IKCPSEG, node);
+		if (itimediff(sn, seg->sn) <= 0) break;
+		seg->fastack++;
+	}
+}
+
+
+// remove segments covered by sack ranges [start, end), sorted by start
+static void ikcp_parse_sack(ikcpcb *kcp, const char *data, IUINT32 count,
+	IUINT32 *maxack)
+{
+	struct ILISTHEAD *p, *next;
+	IUINT32 start, end, i;
+
+	if (kcp->snd_ring) {
+		for (i = 0; i < count; i++) {
+			data = idecode32u_lsb(data, &start);
+			data = idecode32u_lsb(data, &end);
+			if (itimediff(start, kcp->snd_una) < 0) start = kcp->snd_una;
+			if (itimediff(end, kcp->snd_nxt) > 0) end = kcp->snd_nxt;
+			for (; itimediff(start, end) < 0; start++) {
+				ikcp_parse_ack(kcp, start, NULL);
+			}
+			if (itimediff(end - 1, *maxack) > 0) *maxack = end - 1;
+		}
+		return;
+	}
+
+	if (count == 0) return;
+
+	data = idecode32u_lsb(data, &start);
+	data = idecode32u_lsb(data, &end);
+
+	for (i = 1, p = kcp->snd_buf.next; p != &kcp->snd_buf; p = next) {
+		IKCPSEG *seg = ilist_entry(p, IKCPSEG, node);
+		next = p->next;
+		while (itimediff(seg->sn, end) >= 0) {
+			if (itimediff(end - 1, *maxack) > 0) *maxack = end - 1;
+			if (i >= count) return;
+			data = idecode32u_lsb(data, &start);
+			data = idecode32u_lsb(data, &end);
+			i++;
+		}
+		if (itimediff(seg->sn, start) >= 0) {
+			ilist_del(p);
+			kcp->nsnd_bytes -= seg->len;
+			ikcp_segment_delete(kcp, seg);
+			kcp->nsnd_buf--;
+		}
+	}
+
+	if (itimediff(end - 1, *maxack) > 0) *maxack = end - 1;
+}
+
+
 //---------------------------------------------------------------------
 // ack append
 //---------------------------------------------------------------------
@@ -518,6 +899,20 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 		return;
 	}
 
+	// ring mode: rcv_buf is unordered, the ring keeps sn order
+	if (kcp->rcv_ring) {
+		IKCPSEG **slot = &kcp->rcv_ring[sn & kcp->rcv_mask];
+		if (*slot == NULL) {
+			*slot = newseg;
+			ilist_add_tail(&newseg->node, &kcp->rcv_buf);
+			kcp->nrcv_buf++;
+		}	else {
+			ikcp_segment_delete(kcp, newseg);
+		}
+		ikcp_move_rcv(kcp);
+		return;
+	}
+
 	for (p = kcp->rcv_buf.prev; p != &kcp->rcv_buf; p = prev) {
 		IKCPSEG *seg = ilist_entry(p, IKCPSEG, node);
 		prev = p->prev;
@@ -544,18 +939,7 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 #endif
 
 	// move available data from rcv_buf -> rcv_queue
-	while (! ilist_is_empty(&kcp->rcv_buf)) {
-		IKCPSEG *seg = ilist_entry(kcp->rcv_buf.next, IKCPSEG, node);
-		if (seg->sn == kcp->rcv_nxt && kcp->nrcv_que < kcp->rcv_wnd) {
-			ilist_del(&seg->node);
-			kcp->nrcv_buf--;
-			ilist_add_tail(&seg->node, &kcp->rcv_queue);
-			kcp->nrcv_que++;
-			kcp->rcv_nxt++;
-		}	else {
-			break;
-		}
-	}
+	ikcp_move_rcv(kcp);
 
 #if 0
 	ikcp_qprint("queue", &kcp->rcv_queue);
@@ -575,6 +959,10 @@ void ikcp_parse_data(ikcpcb *kcp, IKCPSEG *newseg)
 int ikcp_input(ikcpcb *kcp, const char *data, long size)
 {
 	IUINT32 prev_una = kcp->snd_una;
+	IUINT32 prev_buf = kcp->nsnd_buf;
+	IUINT32 maxack = 0;
+	int acked = 0;
+	int sacked = 0;
 
 	if (ikcp_canlog(kcp, IKCP_LOG_INPUT)) {
 		ikcp_log(kcp, IKCP_LOG_INPUT, "[RI] %d bytes", size);
@@ -606,9 +994,14 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 		if ((long)size < (long)len) return -2;
 
 		if (cmd != IKCP_CMD_PUSH && cmd != IKCP_CMD_ACK &&
-			cmd != IKCP_CMD_WASK && cmd != IKCP_CMD_WINS) 
+			cmd != IKCP_CMD_WASK && cmd != IKCP_CMD_WINS &&
+			cmd != IKCP_CMD_SACK) 
 			return -3;
 
+		if (cmd != IKCP_CMD_PUSH && (frg & IKCP_SACK_FLAG) && kcp->sack) {
+			kcp->sack_peer = 1;
+		}
+
 		kcp->rmt_wnd = wnd;
 		ikcp_parse_una(kcp, una);
 		ikcp_shrink_buf(kcp);
@@ -617,8 +1010,12 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 			if (itimediff(kcp->current, ts) >= 0) {
 				ikcp_update_ack(kcp, itimediff(kcp->current, ts));
 			}
-			ikcp_parse_ack(kcp, sn);
+			ikcp_parse_ack(kcp, sn, &ts);
 			ikcp_shrink_buf(kcp);
+			if (acked == 0 || itimediff(sn, maxack) > 0) {
+				maxack = sn;
+				acked = 1;
+			}
 			if (ikcp_canlog(kcp, IKCP_LOG_IN_ACK)) {
 				ikcp_log(kcp, IKCP_LOG_IN_ACK, 
 					"input ack: sn=%lu rtt=%ld rto=%ld", sn, 
@@ -631,6 +1028,7 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 				ikcp_log(kcp, IKCP_LOG_IN_DATA, 
 					"input psh: sn=%lu ts=%lu", sn, ts);
 			}
+			kcp->stats.in_data++;
 			if (itimediff(sn, kcp->rcv_nxt + kcp->rcv_wnd) < 0) {
 				ikcp_ack_push(kcp, sn, ts);
 				if (itimediff(sn, kcp->rcv_nxt) >= 0) {
@@ -656,17 +1054,39 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 			// ready to send back IKCP_CMD_WINS in ikcp_flush
 			// tell remote my window size
 			kcp->probe |= IKCP_ASK_TELL;
+			kcp->stats.wask_in++;
 			if (ikcp_canlog(kcp, IKCP_LOG_IN_PROBE)) {
 				ikcp_log(kcp, IKCP_LOG_IN_PROBE, "input probe");
 			}
 		}
 		else if (cmd == IKCP_CMD_WINS) {
-			// do nothing
+			kcp->stats.wins_in++;
 			if (ikcp_canlog(kcp, IKCP_LOG_IN_WINS)) {
 				ikcp_log(kcp, IKCP_LOG_IN_WINS,
 					"input wins: %lu", (IUINT32)(wnd));
 			}
 		}
+		else if (cmd == IKCP_CMD_SACK) {
+			// sn carries the range count, ts the newest acked segment
+			if (kcp->sack == 0) return -3;
+			if (sn > len / 8) return -2;
+			if (itimediff(kcp->current, ts) >= 0) {
+				ikcp_update_ack(kcp, itimediff(kcp->current, ts));
+			}
+			if (acked == 0) {
+				maxack = kcp->snd_una - 1;
+				acked = 1;
+			}
+			ikcp_parse_sack(kcp, data, sn, &maxack);
+			ikcp_shrink_buf(kcp);
+			sacked = 1;
+			if (ikcp_canlog(kcp, IKCP_LOG_IN_ACK)) {
+				ikcp_log(kcp, IKCP_LOG_IN_ACK, 
+					"input sack: ranges=%lu rtt=%ld rto=%ld", sn, 
+					(long)itimediff(kcp->current, ts),
+					(long)kcp->rx_rto);
+			}
+		}
 		else {
 			return -3;
 		}
@@ -675,28 +1095,21 @@ int ikcp_input(ikcpcb *kcp, const char *data, long size)
 		size -= len;
 	}
 
-	if (itimediff(kcp->snd_una, prev_una) > 0) {
-		if (kcp->cwnd < kcp->rmt_wnd) {
-			IUINT32 mss = kcp->mss;
-			if (kcp->cwnd < kcp->ssthresh) {
-				kcp->cwnd++;
-				kcp->incr += mss;
-			}	else {
-				if (kcp->incr < mss) kcp->incr = mss;
-				kcp->incr += (mss * mss) / kcp->incr + (mss / 16);
-				if ((kcp->cwnd + 1) * mss <= kcp->incr) {
-				#if 1
-					kcp->cwnd = (kcp->incr + mss - 1) / ((mss > 0)? mss : 1);
-				#else
-					kcp->cwnd++;
-				#endif
-				}
-			}
-			if (kcp->cwnd > kcp->rmt_wnd) {
-				kcp->cwnd = kcp->rmt_wnd;
-				kcp->incr = kcp->rmt_wnd * mss;
-			}
-		}
+	if (acked && (kcp->snd_ring || sacked)) {
+		ikcp_parse_fastack(kcp, maxack);
+	}
+
+	// the peer got data sent after our sack announcement, or it has
+	// shown sack support itself
+	if (kcp->sack_tell && (kcp->sack_peer || sacked ||
+		itimediff(kcp->snd_una, kcp->sack_sn) > 0)) {
+		kcp->sack_tell = 0;
+	}
+
+	if (kcp->nsnd_buf < prev_buf || itimediff(kcp->snd_una, prev_una) > 0) {
+		IINT32 una = itimediff(kcp->snd_una, prev_una);
+		kcp->cc->on_ack(kcp, (una > 0)? (IUINT32)una : 0, 
+			prev_buf - kcp->nsnd_buf);
 	}
 
 	return 0;
@@ -719,6 +1132,82 @@ static char *ikcp_encode_seg(char *ptr, const IKCPSEG *seg)
 	return ptr;
 }
 
+//---------------------------------------------------------------------
+// ikcp_flush_sack: report rcv_buf as sn ranges above una, so a lost
+// sack is repaired by the next one instead of leaving holes
+//---------------------------------------------------------------------
+static char *ikcp_flush_sack(ikcpcb *kcp, char *ptr, IKCPSEG *seg)
+{
+	IUINT32 *acks = (IUINT32*)kcp->acklist->data;
+	IUINT32 count = kcp->ackcount;
+	IUINT32 maxrange = (kcp->mtu - IKCP_OVERHEAD) / 8;
+	IUINT32 i, j, n, nranges;
+	IUINT32 *sns;
+	char *buffer = kcp->buffer;
+
+	if (count == 0) return ptr;
+
+	// newest arrival gives the rtt sample
+	seg->ts = acks[(count - 1) * 2 + 1];
+
+	if (kcp->nrcv_buf * 2 * sizeof(IUINT32) > kcp->acklist->size) {
+		if (iv_resize(kcp->acklist, kcp->nrcv_buf * 2 * sizeof(IUINT32)))
+			return ptr;
+		acks = (IUINT32*)kcp->acklist->data;
+	}
+
+	// collect rcv_buf sn in order into the upper half, so merging
+	// downward never overwrites a sn before it is read
+	sns = acks + kcp->nrcv_buf;
+	n = 0;
+	if (kcp->rcv_ring) {
+		IUINT32 sn = kcp->rcv_nxt;
+		for (i = 0; n < kcp->nrcv_buf && i < kcp->rcv_wnd; i++, sn++) {
+			if (kcp->rcv_ring[sn & kcp->rcv_mask]) sns[n++] = sn;
+		}
+	}	else {
+		struct ILISTHEAD *p;
+		for (p = kcp->rcv_buf.next; p != &kcp->rcv_buf; p = p->next) {
+			sns[n++] = ilist_entry(p, IKCPSEG, node)->sn;
+		}
+	}
+
+	// merge into [start, end) pairs: range r lands in acks[2r, 2r+1],
+	// below every sn not yet read
+	for (i = 0, nranges = 0; i < n; ) {
+		IUINT32 start = sns[i], end = sns[i] + 1;
+		for (i++; i < n && sns[i] == end; i++) end++;
+		acks[nranges * 2] = start;
+		acks[nranges * 2 + 1] = end;
+		nranges++;
+	}
+
+	seg->cmd = IKCP_CMD_SACK;
+
+	// an empty sack still carries una and the rtt sample
+	for (i = 0; i < nranges || i == 0; ) {
+		IUINT32 k = _imin(nranges - i, maxrange);
+		int size = (int)(ptr - buffer);
+		if (size + (int)(IKCP_OVERHEAD + k * 8) > (int)kcp->mtu) {
+			ikcp_output(kcp, buffer, size);
+			ptr = buffer;
+		}
+		seg->sn = k;
+		seg->len = k * 8;
+		ptr = ikcp_encode_seg(ptr, seg);
+		for (j = 0; j < k; j++, i++) {
+			ptr = iencode32u_lsb(ptr, acks[i * 2]);
+			ptr = iencode32u_lsb(ptr, acks[i * 2 + 1]);
+		}
+		if (k == 0) break;
+	}
+
+	seg->len = 0;
+	seg->cmd = IKCP_CMD_ACK;
+
+	return ptr;
+}
+
 static int ikcp_wnd_unused(const ikcpcb *kcp)
 {
 	if (kcp->nrcv_que < kcp->rcv_wnd) {
@@ -739,9 +1228,12 @@ void ikcp_flush(ikcpcb *kcp)
 	int count, size, i;
 	IUINT32 resent, cwnd;
 	IUINT32 rtomin;
+	IUINT32 sent = 0;
+	IINT32 quota = -1;
 	struct ILISTHEAD *p;
 	int change = 0;
 	int lost = 0;
+	int paced = 0;
 	IKCPSEG seg;
 
 	// 'ikcp_update' haven't been called. 
@@ -749,7 +1241,7 @@ void ikcp_flush(ikcpcb *kcp)
 
 	seg.conv = kcp->conv;
 	seg.cmd = IKCP_CMD_ACK;
-	seg.frg = 0;
+	seg.frg = (kcp->sack)? IKCP_SACK_FLAG : 0;
 	seg.wnd = ikcp_wnd_unused(kcp);
 	seg.una = kcp->rcv_nxt;
 	seg.len = 0;
@@ -758,6 +1250,10 @@ void ikcp_flush(ikcpcb *kcp)
 
 	// flush acknowledges
 	count = kcp->ackcount;
+	if (kcp->sack && kcp->sack_peer) {
+		ptr = ikcp_flush_sack(kcp, ptr, &seg);
+		count = 0;
+	}
 	for (i = 0; i < count; i++) {
 		size = (int)(ptr - buffer);
 		if (size + (int)IKCP_OVERHEAD > (int)kcp->mtu) {
@@ -770,6 +1266,13 @@ void ikcp_flush(ikcpcb *kcp)
 
 	kcp->ackcount = 0;
 
+	// announce sack support with a harmless window tell until the
+	// peer acks data from sack_sn on (set once by ikcp_sack)
+	if (kcp->sack && kcp->sack_tell && 
+		(kcp->nsnd_que > 0 || kcp->nsnd_buf > 0)) {
+		kcp->probe |= IKCP_ASK_TELL;
+	}
+
 	// probe window size (if remote window size equals zero)
 	if (kcp->rmt_wnd == 0) {
 		if (kcp->probe_wait == 0) {
@@ -795,6 +1298,7 @@ void ikcp_flush(ikcpcb *kcp)
 	// flush window probing commands
 	if (kcp->probe & IKCP_ASK_SEND) {
 		seg.cmd = IKCP_CMD_WASK;
+		kcp->stats.wask_out++;
 		size = (int)(ptr - buffer);
 		if (size + (int)IKCP_OVERHEAD > (int)kcp->mtu) {
 			ikcp_output(kcp, buffer, size);
@@ -806,6 +1310,7 @@ void ikcp_flush(ikcpcb *kcp)
 	// flush window probing commands
 	if (kcp->probe & IKCP_ASK_TELL) {
 		seg.cmd = IKCP_CMD_WINS;
+		kcp->stats.wins_out++;
 		size = (int)(ptr - buffer);
 		if (size + (int)IKCP_OVERHEAD > (int)kcp->mtu) {
 			ikcp_output(kcp, buffer, size);
@@ -831,12 +1336,16 @@ void ikcp_flush(ikcpcb *kcp)
 		ilist_add_tail(&newseg->node, &kcp->snd_buf);
 		kcp->nsnd_que--;
 		kcp->nsnd_buf++;
+		kcp->nsnd_bytes += newseg->len;
 
 		newseg->conv = kcp->conv;
 		newseg->cmd = IKCP_CMD_PUSH;
 		newseg->wnd = seg.wnd;
 		newseg->ts = current;
 		newseg->sn = kcp->snd_nxt++;
+		if (kcp->snd_ring) {
+			kcp->snd_ring[newseg->sn & kcp->snd_mask] = newseg;
+		}
 		newseg->una = kcp->rcv_nxt;
 		newseg->resendts = current;
 		newseg->rto = kcp->rx_rto;
@@ -848,15 +1357,25 @@ void ikcp_flush(ikcpcb *kcp)
 	resent = (kcp->fastresend > 0)? (IUINT32)kcp->fastresend : 0xffffffff;
 	rtomin = (kcp->nodelay == 0)? (kcp->rx_rto >> 3) : 0;
 
+	// pacing budget, segments beyond it wait for a later flush
+	if (kcp->nocwnd == 0 && kcp->cc->quota) {
+		quota = kcp->cc->quota(kcp, current);
+	}
+
 	// flush data segments
 	for (p = kcp->snd_buf.next; p != &kcp->snd_buf; p = p->next) {
 		IKCPSEG *segment = ilist_entry(p, IKCPSEG, node);
 		int needsend = 0;
+		if (quota >= 0 && sent >= (IUINT32)quota) {
+			if (segment->xmit == 0) paced = 1;
+			break;
+		}
 		if (segment->xmit == 0) {
 			needsend = 1;
 			segment->xmit++;
 			segment->rto = kcp->rx_rto;
 			segment->resendts = current + segment->rto + rtomin;
+			kcp->stats.out_data++;
 		}
 		else if (itimediff(current, segment->resendts) >= 0) {
 			needsend = 1;
@@ -870,6 +1389,7 @@ void ikcp_flush(ikcpcb *kcp)
 				segment->rto += step / 2;
 			}
 			segment->resendts = current + segment->rto;
+			kcp->stats.rexmit_timeout++;
 			lost = 1;
 		}
 		else if (segment->fastack >= resent) {
@@ -879,6 +1399,7 @@ void ikcp_flush(ikcpcb *kcp)
 				segment->xmit++;
 				segment->fastack = 0;
 				segment->resendts = current + segment->rto;
+				kcp->stats.rexmit_fast++;
 				change++;
 			}
 		}
@@ -904,6 +1425,8 @@ void ikcp_flush(ikcpcb *kcp)
 				ptr += segment->len;
 			}
 
+			sent++;
+
 			if (segment->xmit >= kcp->dead_link) {
 				kcp->state = -1;
 			}
@@ -916,28 +1439,28 @@ void ikcp_flush(ikcpcb *kcp)
 		ikcp_output(kcp, buffer, size);
 	}
 
-	// update ssthresh
-	if (change) {
-		IUINT32 inflight = kcp->snd_nxt - kcp->snd_una;
-		kcp->ssthresh = inflight / 2;
-		if (kcp->ssthresh < IKCP_THRESH_MIN)
-			kcp->ssthresh = IKCP_THRESH_MIN;
-		kcp->cwnd = kcp->ssthresh + resent;
-		kcp->incr = kcp->cwnd * kcp->mss;
+	// data held back: pacing first, otherwise the smallest window
+	if (paced) {
+		kcp->stats.stall_pacing++;
 	}
-
-	if (lost) {
-		kcp->ssthresh = cwnd / 2;
-		if (kcp->ssthresh < IKCP_THRESH_MIN)
-			kcp->ssthresh = IKCP_THRESH_MIN;
-		kcp->cwnd = 1;
-		kcp->incr = kcp->mss;
+	else if (!ilist_is_empty(&kcp->snd_queue)) {
+		if (cwnd == kcp->rmt_wnd && cwnd < kcp->snd_wnd) 
+			kcp->stats.stall_rmt_wnd++;
+		else if (cwnd < kcp->snd_wnd) 
+			kcp->stats.stall_cwnd++;
+		else 
+			kcp->stats.stall_snd_wnd++;
 	}
 
+	// update cwnd
+	kcp->cc->on_flush(kcp, cwnd, change, lost, sent);
+
 	if (kcp->cwnd < 1) {
 		kcp->cwnd = 1;
 		kcp->incr = kcp->mss;
 	}
+
+	ikcp_output_batch(kcp);
 }
 
 
@@ -1037,6 +1560,36 @@ int ikcp_setmtu(ikcpcb *kcp, int mtu)
 	kcp->mss = kcp->mtu - IKCP_OVERHEAD;
 	ikmem_free(kcp->buffer);
 	kcp->buffer = buffer;
+	// segments of the old size are freed as they retire
+	ikcp_pool_clear(kcp);
+	kcp->pool_cap = kcp->mss;
+	if (kcp->batch_max > 0 && ikcp_batch(kcp, kcp->batch_max) != 0) {
+		return -2;
+	}
+	return 0;
+}
+
+
+//---------------------------------------------------------------------
+// batched output: one slot of mtu bytes per datagram
+//---------------------------------------------------------------------
+int ikcp_batch(ikcpcb *kcp, int count)
+{
+	char *ptr = NULL;
+	if (count < 0) return -1;
+	if (count > 0) {
+		size_t need = (size_t)count * (kcp->mtu + sizeof(ikcpvec));
+		ptr = (char*)ikmem_malloc(need);
+		if (ptr == NULL) return -2;
+	}
+	// vectors first to keep them aligned for any mtu
+	if (kcp->bvec) {
+		ikmem_free(kcp->bvec);
+	}
+	kcp->bvec = (ikcpvec*)ptr;
+	kcp->batch = (count > 0)? ptr + count * sizeof(ikcpvec) : NULL;
+	kcp->nbatch = 0;
+	kcp->batch_max = count;
 	return 0;
 }
 
@@ -1083,12 +1636,975 @@ int ikcp_wndsize(ikcpcb *kcp, int sndwnd, int rcvwnd)
 		if (rcvwnd > 0) {
 			kcp->rcv_wnd = _imax(rcvwnd, IKCP_WND_RCV);
 		}
+		if (ikcp_ring_resize(kcp) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+int ikcp_sack(ikcpcb *kcp, int enable)
+{
+	kcp->sack = enable? 1 : 0;
+	kcp->sack_tell = kcp->sack;
+	kcp->sack_sn = kcp->snd_nxt;
+	if (enable == 0) kcp->sack_peer = 0;
+	return 0;
+}
+
+int ikcp_setcc(ikcpcb *kcp, const ikcpcc *cc)
+{
+	if (cc == NULL) cc = &ikcp_cc_reno;
+	if (kcp->cc && kcp->cc->release) {
+		kcp->cc->release(kcp);
 	}
+	kcp->ccdata = NULL;
+	kcp->cc = &ikcp_cc_reno;
+	if (cc->init && cc->init(kcp) != 0) {
+		return -1;
+	}
+	kcp->cc = cc;
 	return 0;
 }
 
+void ikcp_stats(const ikcpcb *kcp, ikcpstats *stats)
+{
+	const struct IKCPSTATS *st = &kcp->stats;
+	*stats = *st;
+	if (st->samples > IKCP_STATS_HISTORY) {
+		int head = (int)(st->samples % IKCP_STATS_HISTORY);
+		int tail = IKCP_STATS_HISTORY - head;
+		memcpy(stats->srtt, st->srtt + head, tail * sizeof(IINT32));
+		memcpy(stats->srtt + tail, st->srtt, head * sizeof(IINT32));
+		memcpy(stats->rttvar, st->rttvar + head, tail * sizeof(IINT32));
+		memcpy(stats->rttvar + tail, st->rttvar, head * sizeof(IINT32));
+	}
+	stats->rto = kcp->rx_rto;
+	stats->cwnd = kcp->cwnd;
+	stats->ssthresh = kcp->ssthresh;
+	stats->rmt_wnd = kcp->rmt_wnd;
+	stats->inflight = kcp->nsnd_buf;
+	stats->inflight_bytes = kcp->nsnd_bytes;
+	stats->queued = kcp->nsnd_que;
+}
+
+void ikcp_stats_reset(ikcpcb *kcp)
+{
+	memset(&kcp->stats, 0, sizeof(kcp->stats));
+}
+
 int ikcp_waitsnd(const ikcpcb *kcp)
 {
 	return kcp->nsnd_buf + kcp->nsnd_que;
 }
 
+int ikcp_ringbuf(ikcpcb *kcp, int enable)
+{
+	if (enable) {
+		IUINT32 inflight = kcp->snd_nxt - kcp->snd_una;
+		if (kcp->snd_ring) return 0;
+		if (ikcp_ring_build(&kcp->snd_ring, &kcp->snd_mask, 
+				_imax(kcp->snd_wnd, inflight), &kcp->snd_buf) != 0)
+			return -2;
+		if (ikcp_ring_build(&kcp->rcv_ring, &kcp->rcv_mask, 
+				kcp->rcv_wnd, &kcp->rcv_buf) != 0) {
+			ikmem_free(kcp->snd_ring);
+			kcp->snd_ring = NULL;
+			return -2;
+		}
+	}
+	else if (kcp->snd_ring) {
+		// list mode expects rcv_buf sorted by sn
+		if (kcp->nrcv_buf > 0) return -1;
+		ikmem_free(kcp->snd_ring);
+		ikmem_free(kcp->rcv_ring);
+		kcp->snd_ring = NULL;
+		kcp->rcv_ring = NULL;
+		kcp->snd_mask = 0;
+		kcp->rcv_mask = 0;
+	}
+	return 0;
+}
+
+
+
+
+//=====================================================================
+// CONGESTION CONTROL
+//=====================================================================
+
+//---------------------------------------------------------------------
+// reno-like window, grows per una advance, halves on loss
+//---------------------------------------------------------------------
+static void ikcp_reno_ack(ikcpcb *kcp, IUINT32 una, IUINT32 acked)
+{
+	(void)acked;
+	if (una > 0 && kcp->cwnd < kcp->rmt_wnd) {
+		IUINT32 mss = kcp->mss;
+		if (kcp->cwnd < kcp->ssthresh) {
+			kcp->cwnd++;
+			kcp->incr += mss;
+		}	else {
+			if (kcp->incr < mss) kcp->incr = mss;
+			kcp->incr += (mss * mss) / kcp->incr + (mss / 16);
+			if ((kcp->cwnd + 1) * mss <= kcp->incr) {
+			#if 1
+				kcp->cwnd = (kcp->incr + mss - 1) / ((mss > 0)? mss : 1);
+			#else
+				kcp->cwnd++;
+			#endif
+			}
+		}
+		if (kcp->cwnd > kcp->rmt_wnd) {
+			kcp->cwnd = kcp->rmt_wnd;
+			kcp->incr = kcp->rmt_wnd * mss;
+		}
+	}
+}
+
+static void ikcp_reno_flush(ikcpcb *kcp, IUINT32 cwnd, int fast, int lost,
+	IUINT32 sent)
+{
+	(void)sent;
+	// update ssthresh
+	if (fast) {
+		IUINT32 inflight = kcp->snd_nxt - kcp->snd_una;
+		kcp->ssthresh = inflight / 2;
+		if (kcp->ssthresh < IKCP_THRESH_MIN)
+			kcp->ssthresh = IKCP_THRESH_MIN;
+		kcp->cwnd = kcp->ssthresh + (IUINT32)kcp->fastresend;
+		kcp->incr = kcp->cwnd * kcp->mss;
+	}
+
+	if (lost) {
+		kcp->ssthresh = cwnd / 2;
+		if (kcp->ssthresh < IKCP_THRESH_MIN)
+			kcp->ssthresh = IKCP_THRESH_MIN;
+		kcp->cwnd = 1;
+		kcp->incr = kcp->mss;
+	}
+}
+
+const ikcpcc ikcp_cc_reno = {
+	"reno", NULL, NULL, ikcp_reno_ack, ikcp_reno_flush, NULL,
+};
+
+
+//---------------------------------------------------------------------
+// bbr-like pacing, rates are in segments per second (acks carry no 
+// byte counts) and tokens in 1/1000 segment
+//---------------------------------------------------------------------
+#define IKCP_BBR_BWS			10		// rounds in max bandwidth filter
+#define IKCP_BBR_RTT_WIN		10000	// min rtt expires after 10s
+#define IKCP_BBR_PROBE_RTT		200		// time spent at minimal cwnd
+#define IKCP_BBR_CWND_MIN		4
+#define IKCP_BBR_STARTUP		0
+#define IKCP_BBR_DRAIN			1
+#define IKCP_BBR_PROBE_BW		2
+#define IKCP_BBR_PROBE_MIN		3
+
+// gains in 1/256 units
+#define IKCP_BBR_HIGH_GAIN		739		// 2/ln(2)
+#define IKCP_BBR_DRAIN_GAIN		88		// ln(2)/2
+#define IKCP_BBR_CWND_GAIN		512
+
+static const IUINT32 ikcp_bbr_cycle[8] = 
+	{ 320, 192, 256, 256, 256, 256, 256, 256 };
+
+struct IKCPBBR
+{
+	int mode;
+	IUINT32 bw[IKCP_BBR_BWS];		// delivery rate of recent rounds
+	IUINT32 btlbw;					// max of bw[]
+	IUINT32 min_rtt;
+	IUINT32 ts_min_rtt;
+	IUINT32 probe_rtt;				// min rtt seen in PROBE_MIN
+	IUINT32 ts_probe;				// DRAIN or PROBE_MIN entered
+	IUINT32 ts_round;				// start of current delivery round
+	IUINT32 delivered;				// segments acked this round
+	IUINT32 rounds;
+	IUINT32 full_bw;
+	int full_count;
+	int cycle;
+	IUINT32 ts_cycle;
+	IUINT32 ts_pace;
+	IINT32 tokens;
+	IUINT32 pacing_gain;
+	IUINT32 pacing_rate;
+};
+
+typedef struct IKCPBBR IKCPBBR;
+
+static int ikcp_bbr_init(ikcpcb *kcp)
+{
+	IKCPBBR *bbr = (IKCPBBR*)ikmem_malloc(sizeof(IKCPBBR));
+	if (bbr == NULL) return -1;
+	memset(bbr, 0, sizeof(IKCPBBR));
+	bbr->mode = IKCP_BBR_STARTUP;
+	bbr->pacing_gain = IKCP_BBR_HIGH_GAIN;
+	bbr->ts_round = kcp->current;
+	bbr->ts_pace = kcp->current;
+	bbr->ts_min_rtt = kcp->current;
+	kcp->ccdata = bbr;
+	if (kcp->cwnd < IKCP_BBR_CWND_MIN) {
+		kcp->cwnd = IKCP_BBR_CWND_MIN;
+		kcp->incr = kcp->cwnd * kcp->mss;
+	}
+	return 0;
+}
+
+static void ikcp_bbr_release(ikcpcb *kcp)
+{
+	if (kcp->ccdata) {
+		ikmem_free(kcp->ccdata);
+		kcp->ccdata = NULL;
+	}
+}
+
+static void ikcp_bbr_ack(ikcpcb *kcp, IUINT32 una, IUINT32 acked)
+{
+	IKCPBBR *bbr = (IKCPBBR*)kcp->ccdata;
+	IUINT32 current = kcp->current;
+	IUINT32 rtt = (kcp->rx_rtt > 0)? kcp->rx_rtt : 1;
+	IUINT32 round, bdp, cwnd, i;
+
+	if (bbr->min_rtt == 0 || rtt <= bbr->min_rtt) {
+		bbr->min_rtt = rtt;
+		bbr->ts_min_rtt = current;
+	}
+
+	// min rtt expired: drain the queue for a moment to measure again
+	if (bbr->mode != IKCP_BBR_PROBE_MIN && 
+		itimediff(current, bbr->ts_min_rtt) > IKCP_BBR_RTT_WIN) {
+		bbr->mode = IKCP_BBR_PROBE_MIN;
+		bbr->pacing_gain = 256;
+		bbr->probe_rtt = rtt;
+		bbr->ts_probe = current;
+	}
+
+	if (bbr->mode == IKCP_BBR_PROBE_MIN) {
+		if (rtt < bbr->probe_rtt) bbr->probe_rtt = rtt;
+		if (itimediff(current, bbr->ts_probe) >= 
+			(IINT32)(IKCP_BBR_PROBE_RTT + bbr->min_rtt)) {
+			bbr->min_rtt = bbr->probe_rtt;
+			bbr->ts_min_rtt = current;
+			bbr->mode = IKCP_BBR_PROBE_BW;
+			bbr->cycle = 0;
+			bbr->ts_cycle = current;
+		}
+	}
+
+	bbr->delivered += acked;
+
+	// one delivery rate sample per min_rtt round
+	round = _imax(bbr->min_rtt, kcp->interval);
+	if (itimediff(current, bbr->ts_round) >= (IINT32)round) {
+		IUINT32 elapsed = (IUINT32)itimediff(current, bbr->ts_round);
+		// rounds throttled on purpose say nothing about the path
+		if (bbr->mode != IKCP_BBR_DRAIN && bbr->mode != IKCP_BBR_PROBE_MIN) {
+			bbr->bw[bbr->rounds % IKCP_BBR_BWS] = 
+				(IUINT32)(((IINT64)bbr->delivered * 1000) / elapsed);
+			bbr->rounds++;
+		}
+		bbr->ts_round = current;
+		bbr->delivered = 0;
+		for (bbr->btlbw = 0, i = 0; i < IKCP_BBR_BWS; i++) {
+			if (bbr->bw[i] > bbr->btlbw) bbr->btlbw = bbr->bw[i];
+		}
+		// startup ends when bandwidth stops growing 25% for 3 rounds
+		if (bbr->mode == IKCP_BBR_STARTUP) {
+			if (bbr->btlbw >= bbr->full_bw + bbr->full_bw / 4) {
+				bbr->full_bw = bbr->btlbw;
+				bbr->full_count = 0;
+			}
+			else if (++bbr->full_count >= 3) {
+				bbr->mode = IKCP_BBR_DRAIN;
+				bbr->pacing_gain = IKCP_BBR_DRAIN_GAIN;
+				bbr->ts_probe = current;
+			}
+		}
+	}
+
+	bdp = (IUINT32)(((IINT64)bbr->btlbw * bbr->min_rtt) / 1000);
+
+	// lost segments stay in flight, so drain one round at most
+	if (bbr->mode == IKCP_BBR_DRAIN && (kcp->snd_nxt - kcp->snd_una <= bdp ||
+		itimediff(current, bbr->ts_probe) >= (IINT32)bbr->min_rtt)) {
+		bbr->mode = IKCP_BBR_PROBE_BW;
+		bbr->cycle = 0;
+		bbr->ts_cycle = current;
+	}
+
+	if (bbr->mode == IKCP_BBR_PROBE_BW) {
+		if (itimediff(current, bbr->ts_cycle) >= (IINT32)bbr->min_rtt) {
+			bbr->cycle = (bbr->cycle + 1) & 7;
+			bbr->ts_cycle = current;
+		}
+		bbr->pacing_gain = ikcp_bbr_cycle[bbr->cycle];
+	}
+
+	if (bbr->mode == IKCP_BBR_PROBE_MIN) {
+		cwnd = IKCP_BBR_CWND_MIN;
+	}
+	else if (bbr->btlbw > 0) {
+		IUINT32 gain = (bbr->mode == IKCP_BBR_STARTUP)? 
+			IKCP_BBR_HIGH_GAIN : IKCP_BBR_CWND_GAIN;
+		cwnd = (bdp * gain) >> 8;
+		if (cwnd < IKCP_BBR_CWND_MIN) cwnd = IKCP_BBR_CWND_MIN;
+	}	else {
+		// no sample yet: slow start
+		cwnd = kcp->cwnd + una;
+	}
+
+	bbr->pacing_rate = (IUINT32)(((IINT64)bbr->btlbw * bbr->pacing_gain) >> 8);
+	kcp->cwnd = _imin(cwnd, kcp->rmt_wnd);
+	kcp->incr = kcp->cwnd * kcp->mss;
+}
+
+static void ikcp_bbr_flush(ikcpcb *kcp, IUINT32 cwnd, int fast, int lost,
+	IUINT32 sent)
+{
+	IKCPBBR *bbr = (IKCPBBR*)kcp->ccdata;
+	(void)cwnd; (void)fast; (void)lost;
+	bbr->tokens -= (IINT32)sent * 1000;
+	if (kcp->cwnd < IKCP_BBR_CWND_MIN) {
+		kcp->cwnd = IKCP_BBR_CWND_MIN;
+		kcp->incr = kcp->cwnd * kcp->mss;
+	}
+}
+
+static IINT32 ikcp_bbr_quota(ikcpcb *kcp, IUINT32 current)
+{
+	IKCPBBR *bbr = (IKCPBBR*)kcp->ccdata;
+	IINT32 elapsed = itimediff(current, bbr->ts_pace);
+
+	if (bbr->pacing_rate == 0) return -1;
+
+	if (elapsed > 0) {
+		// credit of one flush interval at most, and two segments
+		IINT64 burst = (IINT64)bbr->pacing_rate * kcp->interval;
+		IINT64 credit = (IINT64)bbr->pacing_rate * elapsed + bbr->tokens;
+		if (burst < 2000) burst = 2000;
+		bbr->tokens = (IINT32)((credit > burst)? burst : credit);
+		bbr->ts_pace = current;
+	}
+
+	return (bbr->tokens > 0)? (bbr->tokens + 999) / 1000 : 0;
+}
+
+const ikcpcc ikcp_cc_pacing = {
+	"pacing", ikcp_bbr_init, ikcp_bbr_release, ikcp_bbr_ack, 
+	ikcp_bbr_flush, ikcp_bbr_quota,
+};
+
+
+
+//=====================================================================
+// KCP SESSION MANAGER
+//=====================================================================
+static size_t ikcp_mgr_hash(const void *key)
+{
+	const ikcpsess *s = (const ikcpsess*)key;
+	const unsigned char *p = (const unsigned char*)s->addr;
+	size_t h = 2166136261u ^ (size_t)s->conv;
+	int i;
+	for (i = 0; i < s->addrlen; i++) {
+		h = (h ^ p[i]) * 16777619u;
+	}
+	return h;
+}
+
+static int ikcp_mgr_compare(const void *key1, const void *key2)
+{
+	const ikcpsess *a = (const ikcpsess*)key1;
+	const ikcpsess *b = (const ikcpsess*)key2;
+	if (a->conv != b->conv) return (a->conv < b->conv)? -1 : 1;
+	if (a->addrlen != b->addrlen) return (a->addrlen < b->addrlen)? -1 : 1;
+	return memcmp(a->addr, b->addr, a->addrlen);
+}
+
+static void ikcp_mgr_timer(void *data);
+static int ikcp_mgr_output(const char *buf, int len, ikcpcb *kcp, void *user);
+
+
+//---------------------------------------------------------------------
+// create session manager
+//---------------------------------------------------------------------
+ikcpmgr* ikcp_mgr_create(IUINT32 current, void *user)
+{
+	ikcpmgr *mgr = (ikcpmgr*)ikmem_malloc(sizeof(ikcpmgr));
+	if (mgr == NULL) return NULL;
+	mgr->obuf = iv_create();
+	if (mgr->obuf == NULL) {
+		ikmem_free(mgr);
+		return NULL;
+	}
+	if (iv_resize(mgr->obuf, IKCP_MGR_BATCH * 
+			(IKCP_MTU_DEF + IKCP_OVERHEAD)) != 0) {
+		iv_delete(mgr->obuf);
+		ikmem_free(mgr);
+		return NULL;
+	}
+	mgr->current = current;
+	mgr->count = 0;
+	mgr->active = 0;
+	mgr->osize = 0;
+	mgr->npacket = 0;
+	mgr->coalesce = 0;
+	mgr->input = NULL;
+	mgr->user = user;
+	mgr->output = NULL;
+	itimer_core_init(&mgr->wheel, current);
+	ib_hash_init(&mgr->table, ikcp_mgr_hash, ikcp_mgr_compare);
+	ilist_init(&mgr->sessions);
+	return mgr;
+}
+
+
+//---------------------------------------------------------------------
+// release session manager
+//---------------------------------------------------------------------
+void ikcp_mgr_release(ikcpmgr *mgr)
+{
+	void *ptr;
+	assert(mgr);
+	ikcp_mgr_flush(mgr);
+	while (!ilist_is_empty(&mgr->sessions)) {
+		ikcpsess *s = ilist_entry(mgr->sessions.next, ikcpsess, node);
+		ikcp_mgr_close(mgr, s);
+	}
+	ptr = ib_hash_swap(&mgr->table, NULL, 0);
+	if (ptr) {
+		ikmem_free(ptr);
+	}
+	itimer_core_destroy(&mgr->wheel);
+	iv_delete(mgr->obuf);
+	ikmem_free(mgr);
+}
+
+
+//---------------------------------------------------------------------
+// an idle session has nothing to flush until input or send
+//---------------------------------------------------------------------
+static int ikcp_mgr_idle(const ikcpcb *kcp)
+{
+	if (kcp->updated == 0) return 0;
+	if (kcp->ackcount > 0 || kcp->probe != 0 || kcp->rmt_wnd == 0) 
+		return 0;
+	if (kcp->nsnd_buf > 0 || kcp->nsnd_que > 0) 
+		return 0;
+	return 1;
+}
+
+static void ikcp_mgr_schedule(ikcpmgr *mgr, ikcpsess *s)
+{
+	ikcpcb *kcp = s->kcp;
+	IUINT32 current = mgr->current;
+	IUINT32 next;
+
+	if (ikcp_mgr_idle(kcp)) {
+		if (!ilist_is_empty(&s->timer.head)) {
+			itimer_node_del(&mgr->wheel, &s->timer);
+			mgr->active--;
+		}
+		return;
+	}
+
+	next = ikcp_check(kcp, current);
+
+	// resend deadlines before ts_flush are served by the next flush
+	if (itimediff(next, current) <= 0 && kcp->updated) {
+		next = kcp->ts_flush;
+		if (itimediff(next, current) <= 0) next = current + 1;
+	}
+
+	if (ilist_is_empty(&s->timer.head)) {
+		mgr->active++;
+	}
+	else if (s->timer.expires == next) {
+		return;
+	}
+
+	itimer_node_mod(&mgr->wheel, &s->timer, next);
+}
+
+static void ikcp_mgr_timer(void *data)
+{
+	ikcpsess *s = (ikcpsess*)data;
+	ikcpmgr *mgr = s->mgr;
+	mgr->active--;
+	ikcp_update(s->kcp, mgr->current);
+	ikcp_mgr_schedule(mgr, s);
+}
+
+
+//---------------------------------------------------------------------
+// stage a datagram of session for batched output
+//---------------------------------------------------------------------
+static int ikcp_mgr_output(const char *buf, int len, ikcpcb *kcp, void *user)
+{
+	ikcpsess *s = (ikcpsess*)user;
+	ikcpmgr *mgr = s->mgr;
+	ikcppacket *packet;
+
+	// append to the last datagram if it goes to the same peer
+	if (mgr->coalesce && mgr->npacket > 0) {
+		packet = &mgr->packets[mgr->npacket - 1];
+		if (packet->addrlen == s->addrlen &&
+			packet->size + len <= (int)kcp->mtu &&
+			mgr->osize + len <= (long)mgr->obuf->size &&
+			memcmp(packet->addr, s->addr, s->addrlen) == 0) {
+			memcpy(mgr->obuf->data + mgr->osize, buf, len);
+			mgr->osize += len;
+			packet->size += len;
+			return 0;
+		}
+	}
+
+	if (mgr->npacket >= IKCP_MGR_BATCH || 
+		mgr->osize + len > (long)mgr->obuf->size) {
+		ikcp_mgr_flush(mgr);
+	}
+
+	// grow only when empty, so staged pointers stay valid
+	if (len > (long)mgr->obuf->size) {
+		if (iv_resize(mgr->obuf, len) != 0) return -1;
+	}
+
+	packet = &mgr->packets[mgr->npacket++];
+	packet->data = (const char*)mgr->obuf->data + mgr->osize;
+	packet->size = len;
+	packet->addr = s->addr;
+	packet->addrlen = s->addrlen;
+	packet->session = s;
+
+	memcpy(mgr->obuf->data + mgr->osize, buf, len);
+	mgr->osize += len;
+
+	return 0;
+}
+
+
+//---------------------------------------------------------------------
+// deliver staged output
+//---------------------------------------------------------------------
+void ikcp_mgr_flush(ikcpmgr *mgr)
+{
+	if (mgr->npacket > 0 && mgr->output) {
+		mgr->output(mgr->packets, mgr->npacket, mgr, mgr->user);
+	}
+	mgr->npacket = 0;
+	mgr->osize = 0;
+}
+
+
+//---------------------------------------------------------------------
+// open session
+//---------------------------------------------------------------------
+ikcpsess* ikcp_mgr_open(ikcpmgr *mgr, IUINT32 conv, const void *addr,
+	int addrlen, void *user)
+{
+	ikcpsess *s;
+
+	if (addrlen < 0 || addrlen > IKCP_ADDR_MAX) return NULL;
+	if (ikcp_mgr_find(mgr, conv, addr, addrlen) != NULL) return NULL;
+
+	s = (ikcpsess*)ikmem_malloc(sizeof(ikcpsess));
+	if (s == NULL) return NULL;
+
+	s->kcp = ikcp_create(conv, s);
+	if (s->kcp == NULL) {
+		ikmem_free(s);
+		return NULL;
+	}
+
+	s->kcp->output = ikcp_mgr_output;
+	s->kcp->current = mgr->current;
+	s->mgr = mgr;
+	s->conv = conv;
+	s->addrlen = addrlen;
+	s->user = user;
+	memset(s->addr, 0, IKCP_ADDR_MAX);
+	if (addrlen > 0) memcpy(s->addr, addr, addrlen);
+
+	itimer_node_init(&s->timer, ikcp_mgr_timer, s);
+	ilist_add_tail(&s->node, &mgr->sessions);
+	ib_hash_node_key(&mgr->table, &s->hnode, s);
+	ib_hash_add(&mgr->table, &s->hnode);
+	mgr->count++;
+
+	// same growth policy as ib_map: keep buckets above count * 1.5
+	if (mgr->table.index_size < (size_t)((mgr->count * 6) >> 2)) {
+		size_t need = mgr->table.index_size;
+		size_t size;
+		void *ptr;
+		while (need < (size_t)((mgr->count * 6) >> 2)) need <<= 1;
+		size = need * sizeof(struct ib_hash_index);
+		ptr = ikmem_malloc(size);
+		if (ptr) {
+			ptr = ib_hash_swap(&mgr->table, ptr, size);
+			if (ptr) ikmem_free(ptr);
+		}
+	}
+
+	// first update arms ts_flush
+	ikcp_mgr_schedule(mgr, s);
+
+	return s;
+}
+
+
+//---------------------------------------------------------------------
+// find session
+//---------------------------------------------------------------------
+ikcpsess* ikcp_mgr_find(ikcpmgr *mgr, IUINT32 conv, const void *addr,
+	int addrlen)
+{
+	struct ib_hash_node *hnode;
+	ikcpsess key;
+
+	if (addrlen < 0 || addrlen > IKCP_ADDR_MAX) return NULL;
+
+	key.conv = conv;
+	key.addrlen = addrlen;
+	if (addrlen > 0) memcpy(key.addr, addr, addrlen);
+
+	ib_hash_node_key(&mgr->table, &key.hnode, &key);
+	ib_hash_search(&mgr->table, &key.hnode, hnode, ikcp_mgr_compare);
+
+	if (hnode == NULL) return NULL;
+
+	return ilist_entry(hnode, ikcpsess, hnode);
+}
+
+
+//---------------------------------------------------------------------
+// close session
+//---------------------------------------------------------------------
+void ikcp_mgr_close(ikcpmgr *mgr, ikcpsess *s)
+{
+	assert(s && s->mgr == mgr);
+	ikcp_mgr_flush(mgr);
+	if (!ilist_is_empty(&s->timer.head)) {
+		itimer_node_del(&mgr->wheel, &s->timer);
+		mgr->active--;
+	}
+	itimer_node_destroy(&s->timer);
+	ib_hash_erase(&mgr->table, &s->hnode);
+	ilist_del(&s->node);
+	ikcp_release(s->kcp);
+	mgr->count--;
+	ikmem_free(s);
+}
+
+
+//---------------------------------------------------------------------
+// length of the leading same conv run
+//---------------------------------------------------------------------
+long ikcp_input_run(const char *data, long size, IUINT32 *conv)
+{
+	IUINT32 first, next, len;
+	long run = 0;
+
+	if (size < (long)IKCP_OVERHEAD) return 0;
+
+	idecode32u_lsb(data, &first);
+
+	while (run + (long)IKCP_OVERHEAD <= size) {
+		idecode32u_lsb(data + run, &next);
+		if (next != first) break;
+		idecode32u_lsb(data + run + IKCP_OVERHEAD - 4, &len);
+		if ((long)len > size - run - (long)IKCP_OVERHEAD) {
+			run = size;
+			break;
+		}
+		run += IKCP_OVERHEAD + len;
+	}
+
+	if (conv) conv[0] = first;
+	return run;
+}
+
+
+//---------------------------------------------------------------------
+// demultiplex input
+//---------------------------------------------------------------------
+int ikcp_mgr_input(ikcpmgr *mgr, const char *data, long size,
+	const void *addr, int addrlen, ikcpsess **session)
+{
+	int hr = 0, first = 1;
+
+	if (session) session[0] = NULL;
+	if (data == NULL || size < (long)IKCP_OVERHEAD) return -2;
+
+	// each run of segments with the same conv goes to one session
+	while (size >= (long)IKCP_OVERHEAD) {
+		IUINT32 conv;
+		long run = ikcp_input_run(data, size, &conv);
+		ikcpsess *s;
+
+		s = ikcp_mgr_find(mgr, conv, addr, addrlen);
+
+		if (s == NULL) {
+			if (first) return -1;
+		}
+		else {
+			if (first && session) session[0] = s;
+			// parked sessions missed ikcp_update, rtt needs current time
+			s->kcp->current = mgr->current;
+			hr = ikcp_input(s->kcp, data, run);
+			ikcp_mgr_schedule(mgr, s);
+			if (mgr->input) mgr->input(s, mgr, mgr->user);
+		}
+
+		first = 0;
+		data += run;
+		size -= run;
+	}
+
+	return hr;
+}
+
+
+//---------------------------------------------------------------------
+// send through session
+//---------------------------------------------------------------------
+int ikcp_mgr_send(ikcpmgr *mgr, ikcpsess *s, const char *buf, int len)
+{
+	int hr = ikcp_send(s->kcp, buf, len);
+	ikcp_mgr_schedule(mgr, s);
+	return hr;
+}
+
+void ikcp_mgr_touch(ikcpmgr *mgr, ikcpsess *s)
+{
+	ikcp_mgr_schedule(mgr, s);
+}
+
+
+//---------------------------------------------------------------------
+// run due sessions
+//---------------------------------------------------------------------
+void ikcp_mgr_update(ikcpmgr *mgr, IUINT32 current)
+{
+	mgr->current = current;
+	itimer_core_run(&mgr->wheel, current);
+	ikcp_mgr_flush(mgr);
+}
+
+
+//---------------------------------------------------------------------
+// nearest deadline, looks up to ITVR_SIZE millisecs ahead
+//---------------------------------------------------------------------
+IUINT32 ikcp_mgr_check(const ikcpmgr *mgr, IUINT32 current)
+{
+	IUINT32 jiffies = mgr->wheel.timer_jiffies;
+	int i;
+	if (mgr->active == 0) return current + ITVR_SIZE;
+	if (itimediff(current, jiffies) >= 0) return current;
+	for (i = 0; i < ITVR_SIZE; i++) {
+		IUINT32 slot = (jiffies + i) & ITVR_MASK;
+		if (!ilist_is_empty(&mgr->wheel.tv1.vec[slot])) {
+			return jiffies + i;
+		}
+	}
+	return jiffies + ITVR_SIZE;
+}
+
+
+
+//=====================================================================
+// FORWARD ERROR CORRECTION
+//=====================================================================
+
+//---------------------------------------------------------------------
+// create codec
+//---------------------------------------------------------------------
+ikcpfec* ikcp_fec_create(int shards, int mtu, void *user)
+{
+	ikcpfec *fec;
+	int stride = mtu + 2, i;
+	char *ptr;
+
+	if (shards < 1 || shards > IKCP_FEC_SHARDS_MAX || mtu < 50) 
+		return NULL;
+
+	fec = (ikcpfec*)ikmem_malloc(sizeof(ikcpfec));
+	if (fec == NULL) return NULL;
+
+	// parity, framing buffer and decoding window in one block
+	ptr = (char*)ikmem_malloc(stride * (IKCP_FEC_WINDOW + 1) + 
+		stride + IKCP_FEC_OVERHEAD);
+	if (ptr == NULL) {
+		ikmem_free(fec);
+		return NULL;
+	}
+
+	memset(ptr, 0, stride * (IKCP_FEC_WINDOW + 1));
+	fec->shards = shards;
+	fec->mtu = mtu;
+	fec->group = 0;
+	fec->index = 0;
+	fec->psize = 0;
+	fec->parity = ptr;
+	fec->buffer = ptr + stride * (IKCP_FEC_WINDOW + 1);
+	for (i = 0; i < IKCP_FEC_WINDOW; i++) {
+		struct IKCPFECGROUP *g = &fec->window[i];
+		g->group = (IUINT32)i - IKCP_FEC_WINDOW;
+		g->mask = 0;
+		g->count = 0;
+		g->size = 0;
+		g->sum = ptr + stride * (i + 1);
+	}
+	fec->out_data = fec->out_parity = 0;
+	fec->in_data = fec->in_parity = fec->in_recover = 0;
+	fec->user = user;
+	fec->output = NULL;
+	return fec;
+}
+
+
+//---------------------------------------------------------------------
+// release codec
+//---------------------------------------------------------------------
+void ikcp_fec_release(ikcpfec *fec)
+{
+	if (fec) {
+		ikmem_free(fec->parity);
+		ikmem_free(fec);
+	}
+}
+
+
+//---------------------------------------------------------------------
+// xor a length prefixed payload into dst
+//---------------------------------------------------------------------
+static int ikcp_fec_xor(char *dst, int dsize, const char *src, int len)
+{
+	char head[2];
+	int i;
+	iencode16u_lsb(head, (IUINT16)len);
+	dst[0] ^= head[0];
+	dst[1] ^= head[1];
+	for (dst += 2, i = 0; i < len; i++) {
+		dst[i] ^= src[i];
+	}
+	return (len + 2 > dsize)? len + 2 : dsize;
+}
+
+static int ikcp_fec_send(ikcpfec *fec, const char *buf, int len, 
+	int index, int count)
+{
+	char *ptr = fec->buffer;
+	ptr = iencode32u_lsb(ptr, fec->group);
+	ptr = iencode8u(ptr, (IUINT8)index);
+	ptr = iencode8u(ptr, (IUINT8)count);
+	if (len > 0) memcpy(ptr, buf, len);
+	assert(fec->output);
+	return fec->output(fec->buffer, len + IKCP_FEC_OVERHEAD, fec, 
+		fec->user);
+}
+
+
+//---------------------------------------------------------------------
+// encode
+//---------------------------------------------------------------------
+int ikcp_fec_output(ikcpfec *fec, const char *buf, int len)
+{
+	int hr;
+	if (len < 0 || len > fec->mtu) return -1;
+	hr = ikcp_fec_send(fec, buf, len, fec->index, 0);
+	fec->psize = ikcp_fec_xor(fec->parity, fec->psize, buf, len);
+	fec->index++;
+	fec->out_data++;
+	if (fec->index >= fec->shards) {
+		ikcp_fec_flush(fec);
+	}
+	return hr;
+}
+
+int ikcp_fec_flush(ikcpfec *fec)
+{
+	int hr;
+	if (fec->index == 0) return 0;
+	hr = ikcp_fec_send(fec, fec->parity, fec->psize, fec->index, 
+		fec->index);
+	memset(fec->parity, 0, fec->psize);
+	fec->psize = 0;
+	fec->index = 0;
+	fec->group++;
+	fec->out_parity++;
+	return hr;
+}
+
+
+//---------------------------------------------------------------------
+// decode
+//---------------------------------------------------------------------
+int ikcp_fec_input(ikcpfec *fec, const char *data, long size, 
+	ikcpcb *kcp)
+{
+	struct IKCPFECGROUP *g;
+	IUINT32 group, bit, full;
+	IUINT8 index, count;
+	int hr = 0, len = (int)size - IKCP_FEC_OVERHEAD;
+
+	if (data == NULL || len < 0 || len > fec->mtu + 2) return -11;
+
+	data = idecode32u_lsb(data, &group);
+	data = idecode8u(data, &index);
+	data = idecode8u(data, &count);
+
+	// parity carries the 2 bytes length prefix on top of the payload
+	if (count == 0 && len > fec->mtu) return -11;
+
+	if (index >= IKCP_FEC_SHARDS_MAX) return -12;
+	if (count > 0 && (count != index || len < 2)) return -13;
+
+	g = &fec->window[group % IKCP_FEC_WINDOW];
+
+	if (g->group != group) {
+		// a newer group takes the slot, late ones go straight to kcp
+		if (itimediff(group, g->group) < 0) {
+			return (count == 0)? ikcp_input(kcp, data, len) : 0;
+		}
+		memset(g->sum, 0, g->size);
+		g->group = group;
+		g->mask = 0;
+		g->count = 0;
+		g->size = 0;
+	}
+
+	if (count == 0) {
+		bit = (IUINT32)1 << index;
+		if (g->mask & bit) return 0;
+		g->mask |= bit;
+		g->size = ikcp_fec_xor(g->sum, g->size, data, len);
+		fec->in_data++;
+		hr = ikcp_input(kcp, data, len);
+	}
+	else if (g->count == 0) {
+		int i;
+		for (i = 0; i < len; i++) g->sum[i] ^= data[i];
+		if (len > g->size) g->size = len;
+		g->count = count;
+		fec->in_parity++;
+	}
+
+	// exactly one shard missing: the xor is that shard
+	if (g->count > 0) {
+		full = (g->count >= 32)? 0xffffffff : ((IUINT32)1 << g->count) - 1;
+		bit = full & ~g->mask;
+		if (bit != 0 && (bit & (bit - 1)) == 0) {
+			IUINT16 need;
+			idecode16u_lsb(g->sum, &need);
+			g->mask |= bit;
+			if ((int)need + 2 <= g->size) {
+				fec->in_recover++;
+				ikcp_input(kcp, g->sum + 2, need);
+			}
+		}
+	}
+
+	return hr;
+}
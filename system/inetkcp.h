@@ -16,6 +16,7 @@
 #include <assert.h>
 
 #include "imemdata.h"
+#include "itimer.h"
 
 
 
@@ -37,10 +38,58 @@ struct IKCPSEG
 	IUINT32 rto;
 	IUINT32 fastack;
 	IUINT32 xmit;
+	IUINT32 cap;
 	char data[1];
 };
 
 
+//---------------------------------------------------------------------
+// scatter/gather buffer
+//---------------------------------------------------------------------
+struct IKCPVEC
+{
+	char *data;
+	int size;
+};
+
+
+//---------------------------------------------------------------------
+// statistics: counters are bumped inline by ikcp_input/ikcp_flush,
+// the state fields are only filled by ikcp_stats
+//---------------------------------------------------------------------
+#define IKCP_STATS_HISTORY		16		// srtt samples kept
+
+struct IKCPSTATS
+{
+	// rtt: one srtt/rttvar sample per interval at most, oldest first
+	IUINT32 samples;					// samples taken, may exceed history
+	IUINT32 ts_sample;					// time of the newest sample
+	IINT32 srtt[IKCP_STATS_HISTORY];
+	IINT32 rttvar[IKCP_STATS_HISTORY];
+	IUINT32 rtts;						// rtt measured from acks
+	IINT32 rtt_min, rtt_max;
+	// state
+	IINT32 rto;
+	IUINT32 cwnd, ssthresh, rmt_wnd;
+	IUINT32 inflight;					// segments waiting for ack
+	IUINT32 inflight_bytes;
+	IUINT32 queued;						// segments in snd_queue
+	// data segments
+	IUINT32 out_data;					// first transmissions
+	IUINT32 in_data;
+	IUINT32 rexmit_timeout;				// rto expired
+	IUINT32 rexmit_fast;				// fastack reached 'resend'
+	IUINT32 rexmit_early;				// ack echoed an earlier copy
+	// flushes which left data queued, by the smallest window, or
+	// which held new segments back for the pacing quota
+	IUINT32 stall_cwnd, stall_rmt_wnd, stall_snd_wnd, stall_pacing;
+	// window probes
+	IUINT32 wask_out, wask_in, wins_out, wins_in;
+};
+
+typedef struct IKCPSTATS ikcpstats;
+
+
 //---------------------------------------------------------------------
 // IKCPCB
 //---------------------------------------------------------------------
@@ -52,7 +101,7 @@ struct IKCPCB
 	IINT32 rx_rttval, rx_srtt, rx_rto, rx_minrto;
 	IUINT32 snd_wnd, rcv_wnd, rmt_wnd, cwnd, probe;
 	IUINT32 current, interval, ts_flush, xmit;
-	IUINT32 nrcv_buf, nsnd_buf;
+	IUINT32 nrcv_buf, nsnd_buf, nsnd_bytes;
 	IUINT32 nrcv_que, nsnd_que;
 	IUINT32 nodelay, updated;
 	IUINT32 ts_probe, probe_wait;
@@ -61,6 +110,11 @@ struct IKCPCB
 	struct ILISTHEAD rcv_queue;
 	struct ILISTHEAD snd_buf;
 	struct ILISTHEAD rcv_buf;
+	struct IKCPSEG **snd_ring;
+	struct IKCPSEG **rcv_ring;
+	IUINT32 snd_mask, rcv_mask;
+	struct ILISTHEAD seg_pool;
+	IUINT32 npool, pool_cap;
 	ib_vector *acklist;
 	IUINT32 ackcount;
 	void *user;
@@ -68,13 +122,47 @@ struct IKCPCB
 	int fastresend;
 	int fastlimit;
 	int nocwnd, stream;
+	int sack, sack_peer, sack_tell;
+	IUINT32 sack_sn;
+	const struct IKCPCC *cc;
+	void *ccdata;
+	char *batch;
+	struct IKCPVEC *bvec;
+	int nbatch, batch_max;
+	struct IKCPSTATS stats;
 	int logmask;
 	int (*output)(const char *buf, int len, struct IKCPCB *kcp, void *user);
+	int (*output_batch)(const struct IKCPVEC *bufs, int count, 
+		struct IKCPCB *kcp, void *user);
 	void (*writelog)(const char *log, struct IKCPCB *kcp, void *user);
 };
 
 
 typedef struct IKCPCB ikcpcb;
+typedef struct IKCPVEC ikcpvec;
+
+
+//---------------------------------------------------------------------
+// congestion control: decides kcp->cwnd and optionally paces flushes
+//---------------------------------------------------------------------
+struct IKCPCC
+{
+	const char *name;
+	// setup/teardown of kcp->ccdata, both can be NULL
+	int (*init)(ikcpcb *kcp);
+	void (*release)(ikcpcb *kcp);
+	// end of ikcp_input: una advanced by 'una' segments and 'acked'
+	// segments left snd_buf (including selective acks)
+	void (*on_ack)(ikcpcb *kcp, IUINT32 una, IUINT32 acked);
+	// end of ikcp_flush: 'cwnd' was the send window, 'fast' segments
+	// were fast resent, 'lost' timed out, 'sent' data segments went out
+	void (*on_flush)(ikcpcb *kcp, IUINT32 cwnd, int fast, int lost, 
+		IUINT32 sent);
+	// data segments ikcp_flush may send now, below zero for unlimited
+	IINT32 (*quota)(ikcpcb *kcp, IUINT32 current);
+};
+
+typedef struct IKCPCC ikcpcc;
 
 #define IKCP_LOG_OUTPUT			1
 #define IKCP_LOG_INPUT			2
@@ -89,10 +177,108 @@ typedef struct IKCPCB ikcpcb;
 #define IKCP_LOG_OUT_PROBE		1024
 #define IKCP_LOG_OUT_WINS		2048
 
+
+//---------------------------------------------------------------------
+// session manager: many kcp sessions keyed by (conv, peer address)
+//---------------------------------------------------------------------
+#define IKCP_ADDR_MAX			32		// >= sizeof(sockaddr_in6)
+#define IKCP_MGR_BATCH			64		// datagrams per output batch
+
+struct IKCPMGR;
+
+struct IKCPSESSION
+{
+	struct ib_hash_node hnode;			// (conv, addr) index
+	struct ILISTHEAD node;				// all sessions
+	itimer_node timer;					// next ikcp_check deadline
+	ikcpcb *kcp;
+	struct IKCPMGR *mgr;
+	IUINT32 conv;
+	int addrlen;
+	char addr[IKCP_ADDR_MAX];
+	void *user;
+};
+
+struct IKCPPACKET
+{
+	const char *data;
+	int size;
+	const void *addr;
+	int addrlen;
+	struct IKCPSESSION *session;
+};
+
+struct IKCPMGR
+{
+	IUINT32 current;
+	long count;							// sessions
+	long active;						// sessions on the wheel
+	itimer_core wheel;					// millisecond wheel
+	struct ib_hash_table table;
+	struct ILISTHEAD sessions;
+	ib_vector *obuf;					// staged datagram bytes
+	long osize;
+	int npacket;
+	int coalesce;						// merge datagrams to same peer
+	struct IKCPPACKET packets[IKCP_MGR_BATCH];
+	void *user;
+	int (*output)(const struct IKCPPACKET *packets, int count, 
+		struct IKCPMGR *mgr, void *user);
+	void (*input)(struct IKCPSESSION *session, struct IKCPMGR *mgr,
+		void *user);
+};
+
+typedef struct IKCPSESSION ikcpsess;
+typedef struct IKCPPACKET ikcppacket;
+typedef struct IKCPMGR ikcpmgr;
+
+
+//---------------------------------------------------------------------
+// forward error correction: one xor parity datagram per group, any
+// single loss in a group is rebuilt without waiting for a resend
+//---------------------------------------------------------------------
+#define IKCP_FEC_OVERHEAD		6		// group(4) + index(1) + count(1)
+#define IKCP_FEC_SHARDS_MAX		32		// data datagrams per group
+#define IKCP_FEC_WINDOW			32		// groups tracked by decoder
+
+struct IKCPFECGROUP
+{
+	IUINT32 group;
+	IUINT32 mask;						// data shards seen
+	int count;							// data shards, set by parity
+	int size;							// bytes used in xor
+	char *sum;							// xor of shards seen
+};
+
+struct IKCPFEC
+{
+	int shards;
+	int mtu;							// max datagram without header
+	IUINT32 group;						// encoding group
+	int index;							// shards in encoding group
+	int psize;
+	char *parity;						// xor of encoding group
+	char *buffer;						// one framed datagram
+	struct IKCPFECGROUP window[IKCP_FEC_WINDOW];
+	IUINT32 out_data, out_parity;
+	IUINT32 in_data, in_parity, in_recover;
+	void *user;
+	int (*output)(const char *buf, int len, struct IKCPFEC *fec, void *user);
+};
+
+typedef struct IKCPFEC ikcpfec;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// loss based window (default), from the original ikcp_flush/ikcp_input
+extern const ikcpcc ikcp_cc_reno;
+
+// bbr-like: bottleneck bandwidth and min rtt estimation, cwnd of two
+// bdp and a pacing rate spreading each window over the rtt
+extern const ikcpcc ikcp_cc_pacing;
+
 //---------------------------------------------------------------------
 // interface
 //---------------------------------------------------------------------
@@ -111,6 +297,17 @@ int ikcp_recv(ikcpcb *kcp, char *buffer, int len);
 // user/upper level send, returns below zero for error
 int ikcp_send(ikcpcb *kcp, const char *buffer, int len);
 
+// gather send: fragments are filled straight from the vectors
+int ikcp_sendv(ikcpcb *kcp, const ikcpvec *vecs, int count);
+
+// scatter recv: next message is copied into the vectors, returns size
+int ikcp_recvv(ikcpcb *kcp, const ikcpvec *vecs, int count);
+
+// peek next message without copy: vecs point into its fragments until
+// it's consumed by ikcp_recv(kcp, NULL, size), returns fragment count,
+// -1 for EAGAIN, or -(fragments needed) when count is too small
+int ikcp_peekv(const ikcpcb *kcp, ikcpvec *vecs, int count);
+
 // update state (call it repeatedly, every 10ms-100ms), or you can ask 
 // ikcp_check when to call it again (without ikcp_input/_send calling).
 // 'current' - current timestamp in millisec. 
@@ -127,6 +324,11 @@ IUINT32 ikcp_check(const ikcpcb *kcp, IUINT32 current);
 
 // when you received a low level packet (eg. UDP packet), call it
 int ikcp_input(ikcpcb *kcp, const char *data, long size);
+
+// length of the leading run of segments sharing one conv (stored in 
+// conv), 0 if data is shorter than a segment header. a truncated 
+// segment extends the run to size, so ikcp_input will reject it
+long ikcp_input_run(const char *data, long size, IUINT32 *conv);
 void ikcp_flush(ikcpcb *kcp);
 
 int ikcp_peeksize(const ikcpcb *kcp);
@@ -140,6 +342,30 @@ int ikcp_wndsize(ikcpcb *kcp, int sndwnd, int rcvwnd);
 // get how many packet is waiting to be sent
 int ikcp_waitsnd(const ikcpcb *kcp);
 
+// index snd_buf/rcv_buf by sn in circular arrays sized to the windows:
+// O(1) ack and out-of-order insertion for large windows. best enabled
+// right after ikcp_create, can't be disabled while rcv_buf has data.
+int ikcp_ringbuf(ikcpcb *kcp, int enable);
+
+// selective ack: acks go out as ranges of sn (IKCP_CMD_SACK) once the
+// peer has shown it supports them, otherwise plain acks are kept
+int ikcp_sack(ikcpcb *kcp, int enable);
+
+// stage up to 'count' datagrams per ikcp_flush and hand them to 
+// kcp->output_batch at once (for sendmmsg/GSO), zero to disable
+int ikcp_batch(ikcpcb *kcp, int count);
+
+// install congestion control (NULL for ikcp_cc_reno), it only has 
+// effect with nocwnd == 0 (see ikcp_nodelay)
+int ikcp_setcc(ikcpcb *kcp, const ikcpcc *cc);
+
+// snapshot of counters since ikcp_create (or the last reset) together
+// with the current rto/windows/inflight, cheap enough for production
+void ikcp_stats(const ikcpcb *kcp, ikcpstats *stats);
+
+// clear counters and rtt history
+void ikcp_stats_reset(ikcpcb *kcp);
+
 // fastest: ikcp_nodelay(kcp, 1, 20, 2, 1)
 // nodelay: 0:disable(default), 1:enable
 // interval: internal update timer interval in millisec, default is 100ms 
@@ -151,6 +377,85 @@ int ikcp_nodelay(ikcpcb *kcp, int nodelay, int interval, int resend, int nc);
 void ikcp_log(ikcpcb *kcp, int mask, const char *fmt, ...);
 
 
+//---------------------------------------------------------------------
+// session manager
+//---------------------------------------------------------------------
+
+// create a session manager, 'current' is timestamp in millisec. the
+// output callback receives up to IKCP_MGR_BATCH datagrams at once and
+// can be setup like this: 'mgr->output = my_udp_output_batch'.
+// with 'mgr->coalesce = 1' output of sessions sharing a peer address 
+// is packed into datagrams of up to kcp->mtu, packet->session is then
+// the first session in the datagram. the peer must be a manager too
+ikcpmgr* ikcp_mgr_create(IUINT32 current, void *user);
+
+// release manager and all of its sessions
+void ikcp_mgr_release(ikcpmgr *mgr);
+
+// create a session, returns NULL if (conv, addr) is already in use
+ikcpsess* ikcp_mgr_open(ikcpmgr *mgr, IUINT32 conv, const void *addr,
+	int addrlen, void *user);
+
+// find session by conv and peer address
+ikcpsess* ikcp_mgr_find(ikcpmgr *mgr, IUINT32 conv, const void *addr,
+	int addrlen);
+
+// destroy session, pending output is delivered first
+void ikcp_mgr_close(ikcpmgr *mgr, ikcpsess *session);
+
+// feed a datagram from addr, returns -1 if no session matches (open 
+// one and feed again to accept it), otherwise ikcp_input's result.
+// coalesced datagrams are split by conv, later parts without session
+// are dropped (their sender will resend them). mgr->input, if set, is
+// called for every session which took input
+int ikcp_mgr_input(ikcpmgr *mgr, const char *data, long size,
+	const void *addr, int addrlen, ikcpsess **session);
+
+// send through session and schedule its flush
+int ikcp_mgr_send(ikcpmgr *mgr, ikcpsess *session, const char *buf, int len);
+
+// reschedule a session after calling ikcp_* on session->kcp directly
+void ikcp_mgr_touch(ikcpmgr *mgr, ikcpsess *session);
+
+// update due sessions only and deliver their output
+void ikcp_mgr_update(ikcpmgr *mgr, IUINT32 current);
+
+// deliver staged output
+void ikcp_mgr_flush(ikcpmgr *mgr);
+
+// returns when ikcp_mgr_update should be called next
+IUINT32 ikcp_mgr_check(const ikcpmgr *mgr, IUINT32 current);
+
+
+//---------------------------------------------------------------------
+// forward error correction
+//---------------------------------------------------------------------
+
+// create fec codec, one parity follows every 'shards' datagrams. 'mtu'
+// is the largest datagram to encode, so the kcp behind it should use 
+// ikcp_setmtu(kcp, mtu) while the wire carries mtu + IKCP_FEC_OVERHEAD
+// for data and mtu + 2 + IKCP_FEC_OVERHEAD for parity (length prefix).
+// sender: call ikcp_fec_output from kcp->output and ikcp_fec_flush
+// after ikcp_update/ikcp_flush; receiver: feed ikcp_fec_input instead
+// of ikcp_input. setup output like: 'fec->output = udp_output'
+ikcpfec* ikcp_fec_create(int shards, int mtu, void *user);
+
+// release codec
+void ikcp_fec_release(ikcpfec *fec);
+
+// frame and send a datagram, emits parity when the group is full
+int ikcp_fec_output(ikcpfec *fec, const char *buf, int len);
+
+// emit parity for a partial group so the tail of a burst is covered
+int ikcp_fec_flush(ikcpfec *fec);
+
+// decode a framed datagram and feed payload, plus any datagram the 
+// parity rebuilt, into ikcp_input. returns ikcp_input's result, or
+// below -10 for malformed input
+int ikcp_fec_input(ikcpfec *fec, const char *data, long size, 
+	ikcpcb *kcp);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,428 @@
+//=====================================================================
+//
+// inetksvr.c - multi-threaded kcp server
+//
+// NOTE:
+// for more information, please see the readme file.
+//
+//=====================================================================
+#include "inetksvr.h"
+
+#include <stddef.h>
+#include <string.h>
+
+
+//=====================================================================
+// KCP SERVER
+//=====================================================================
+#define IKCP_SVR_CMD_INPUT		0
+#define IKCP_SVR_CMD_SEND		1
+
+// queued datagram or message, pushed by any thread
+struct IKCPSVRNODE
+{
+	struct IKCPSVRNODE *next;
+	int cmd;
+	IUINT32 conv;
+	long size;
+	int addrlen;
+	char addr[IKCP_ADDR_MAX];
+	char data[1];
+};
+
+struct IKCPSHARD
+{
+	struct IKCPSERVER *svr;
+	ikcpmgr *mgr;
+	iPosixThread *thread;
+	iEventPosix *event;
+	void * volatile head;				// lock free stack of nodes
+	volatile long queued;
+	volatile long dropped;
+	int index;
+};
+
+struct IKCPSERVER
+{
+	int nshards;
+	int flags;
+	int started;
+	volatile int running;
+	IUINT32 interval;
+	ikcpsvr_handler handler;
+	ikcpsvr_output output;
+	void *user;
+	struct IKCPSHARD *shards;
+};
+
+typedef struct IKCPSVRNODE ikcpsvrnode;
+typedef struct IKCPSHARD ikcpshard;
+
+
+//---------------------------------------------------------------------
+// multi-producer push: a treiber stack, the consumer takes it whole
+// so there is no ABA. wakes the shard when the stack was empty
+//---------------------------------------------------------------------
+static int ikcp_shard_push(ikcpshard *shard, ikcpsvrnode *node)
+{
+	void *head;
+	if (iatomic_add(&shard->queued, 1) > IKCP_SVR_QUEUE_MAX) {
+		iatomic_add(&shard->queued, -1);
+		iatomic_add(&shard->dropped, 1);
+		ikmem_free(node);
+		return -1;
+	}
+	do {
+		head = shard->head;
+		node->next = (ikcpsvrnode*)head;
+	}	while (iatomic_cas_ptr(&shard->head, head, node) == 0);
+	if (head == NULL) {
+		iposix_event_set(shard->event);
+	}
+	return 0;
+}
+
+// take all queued nodes in push order
+static ikcpsvrnode *ikcp_shard_take(ikcpshard *shard)
+{
+	ikcpsvrnode *node, *list = NULL;
+	void *head;
+	do {
+		head = shard->head;
+		if (head == NULL) return NULL;
+	}	while (iatomic_cas_ptr(&shard->head, head, NULL) == 0);
+	for (node = (ikcpsvrnode*)head; node; ) {
+		ikcpsvrnode *next = node->next;
+		node->next = list;
+		list = node;
+		node = next;
+	}
+	return list;
+}
+
+static ikcpsvrnode *ikcp_node_new(int cmd, IUINT32 conv,
+	const void *addr, int addrlen, const char *data, long size)
+{
+	ikcpsvrnode *node;
+	if (addrlen < 0 || addrlen > IKCP_ADDR_MAX || size < 0) return NULL;
+	node = (ikcpsvrnode*)ikmem_malloc(sizeof(ikcpsvrnode) + size);
+	if (node == NULL) return NULL;
+	node->cmd = cmd;
+	node->conv = conv;
+	node->size = size;
+	node->addrlen = addrlen;
+	if (addrlen > 0) memcpy(node->addr, addr, addrlen);
+	if (size > 0) memcpy(node->data, data, size);
+	return node;
+}
+
+
+//---------------------------------------------------------------------
+// shard callbacks
+//---------------------------------------------------------------------
+static int ikcp_shard_output(const ikcppacket *packets, int count,
+	ikcpmgr *mgr, void *user)
+{
+	ikcpshard *shard = (ikcpshard*)user;
+	ikcpserver *svr = shard->svr;
+	(void)mgr;
+	return svr->output(packets, count, svr, shard->index, svr->user);
+}
+
+static void ikcp_shard_input(ikcpsess *session, ikcpmgr *mgr, void *user)
+{
+	ikcpshard *shard = (ikcpshard*)user;
+	ikcpserver *svr = shard->svr;
+	(void)mgr;
+	if (svr->handler) {
+		svr->handler(svr, shard->index, IKCP_SVR_EVT_DATA, session,
+			svr->user);
+	}
+}
+
+static void ikcp_shard_dispatch(ikcpshard *shard, ikcpsvrnode *node)
+{
+	ikcpserver *svr = shard->svr;
+	ikcpmgr *mgr = shard->mgr;
+	ikcpsess *s;
+
+	if (node->cmd == IKCP_SVR_CMD_SEND) {
+		s = ikcp_mgr_find(mgr, node->conv, node->addr, node->addrlen);
+		if (s) ikcp_mgr_send(mgr, s, node->data, (int)node->size);
+		return;
+	}
+
+	if (ikcp_mgr_input(mgr, node->data, node->size, node->addr,
+		node->addrlen, NULL) != -1) {
+		return;
+	}
+
+	if ((svr->flags & IKCP_SVR_ACCEPT) == 0) return;
+
+	s = ikcp_mgr_open(mgr, node->conv, node->addr, node->addrlen, NULL);
+	if (s == NULL) return;
+
+	if (svr->handler) {
+		svr->handler(svr, shard->index, IKCP_SVR_EVT_NEW, s, svr->user);
+	}
+
+	// the handler may close it to refuse the conversation
+	ikcp_mgr_input(mgr, node->data, node->size, node->addr,
+		node->addrlen, NULL);
+}
+
+
+//---------------------------------------------------------------------
+// shard thread: returns zero to stop
+//---------------------------------------------------------------------
+static int ikcp_shard_loop(void *obj)
+{
+	ikcpshard *shard = (ikcpshard*)obj;
+	ikcpserver *svr = shard->svr;
+	ikcpmgr *mgr = shard->mgr;
+	ikcpsvrnode *node;
+	IUINT32 current, next;
+	IINT32 wait;
+
+	if (svr->running == 0) return 0;
+
+	current = (IUINT32)iclock();
+	mgr->current = current;
+
+	for (node = ikcp_shard_take(shard); node; ) {
+		ikcpsvrnode *next = node->next;
+		iatomic_add(&shard->queued, -1);
+		ikcp_shard_dispatch(shard, node);
+		ikmem_free(node);
+		node = next;
+	}
+
+	ikcp_mgr_update(mgr, current);
+
+	if (svr->handler) {
+		svr->handler(svr, shard->index, IKCP_SVR_EVT_TICK, NULL,
+			svr->user);
+	}
+
+	// sleep until the wheel is due or a producer wakes us
+	current = (IUINT32)iclock();
+	next = ikcp_mgr_check(mgr, current);
+	wait = itimediff(next, current);
+	if (wait > (IINT32)svr->interval) wait = (IINT32)svr->interval;
+	if (wait > 0) {
+		iposix_event_wait(shard->event, (unsigned long)wait);
+	}
+
+	return 1;
+}
+
+
+//---------------------------------------------------------------------
+// create server
+//---------------------------------------------------------------------
+ikcpserver* ikcp_server_new(int nshards, int flags, ikcpsvr_output output,
+	void *user)
+{
+	ikcpserver *svr;
+	IUINT32 current = (IUINT32)iclock();
+	int i;
+
+	if (nshards <= 0 || nshards > IKCP_SVR_SHARD_MAX) return NULL;
+	if (output == NULL) return NULL;
+
+	svr = (ikcpserver*)ikmem_malloc(sizeof(ikcpserver));
+	if (svr == NULL) return NULL;
+
+	svr->shards = (ikcpshard*)ikmem_malloc(sizeof(ikcpshard) * nshards);
+
+	if (svr->shards == NULL) {
+		ikmem_free(svr);
+		return NULL;
+	}
+
+	svr->nshards = nshards;
+	svr->flags = flags;
+	svr->started = 0;
+	svr->running = 0;
+	svr->interval = 10;
+	svr->handler = NULL;
+	svr->output = output;
+	svr->user = user;
+
+	for (i = 0; i < nshards; i++) {
+		ikcpshard *shard = &svr->shards[i];
+		shard->svr = svr;
+		shard->index = i;
+		shard->head = NULL;
+		shard->queued = 0;
+		shard->dropped = 0;
+		shard->thread = NULL;
+		shard->event = iposix_event_new();
+		shard->mgr = ikcp_mgr_create(current, shard);
+		if (shard->mgr != NULL) {
+			shard->mgr->output = ikcp_shard_output;
+			shard->mgr->input = ikcp_shard_input;
+			shard->thread = iposix_thread_new(ikcp_shard_loop,
+					shard, "KcpShard");
+		}
+		if (shard->event == NULL || shard->mgr == NULL ||
+			shard->thread == NULL) {
+			svr->nshards = i + 1;
+			ikcp_server_delete(svr);
+			return NULL;
+		}
+	}
+
+	return svr;
+}
+
+
+//---------------------------------------------------------------------
+// delete server
+//---------------------------------------------------------------------
+void ikcp_server_delete(ikcpserver *svr)
+{
+	int i;
+	if (svr == NULL) return;
+	ikcp_server_stop(svr);
+	for (i = 0; i < svr->nshards; i++) {
+		ikcpshard *shard = &svr->shards[i];
+		ikcpsvrnode *node = ikcp_shard_take(shard);
+		while (node) {
+			ikcpsvrnode *next = node->next;
+			ikmem_free(node);
+			node = next;
+		}
+		if (shard->thread) iposix_thread_delete(shard->thread);
+		if (shard->mgr) ikcp_mgr_release(shard->mgr);
+		if (shard->event) iposix_event_delete(shard->event);
+		shard->thread = NULL;
+		shard->mgr = NULL;
+		shard->event = NULL;
+	}
+	ikmem_free(svr->shards);
+	svr->shards = NULL;
+	ikmem_free(svr);
+}
+
+
+//---------------------------------------------------------------------
+// start / stop
+//---------------------------------------------------------------------
+int ikcp_server_start(ikcpserver *svr, ikcpsvr_handler handler,
+	IUINT32 interval)
+{
+	int i;
+	if (svr->started) return -1;
+	svr->handler = handler;
+	svr->interval = (interval > 0)? interval : 1;
+	svr->running = 1;
+	svr->started = 1;
+	for (i = 0; i < svr->nshards; i++) {
+		if (iposix_thread_start(svr->shards[i].thread) != 0) {
+			ikcp_server_stop(svr);
+			return -2;
+		}
+	}
+	return 0;
+}
+
+void ikcp_server_stop(ikcpserver *svr)
+{
+	int i;
+	if (svr->started == 0) return;
+	svr->running = 0;
+	for (i = 0; i < svr->nshards; i++) {
+		iposix_event_set(svr->shards[i].event);
+	}
+	for (i = 0; i < svr->nshards; i++) {
+		iposix_thread_join(svr->shards[i].thread, IEVENT_INFINITE);
+	}
+	svr->started = 0;
+}
+
+
+//---------------------------------------------------------------------
+// shard lookup
+//---------------------------------------------------------------------
+int ikcp_server_count(const ikcpserver *svr)
+{
+	return svr->nshards;
+}
+
+int ikcp_server_shard(const ikcpserver *svr, IUINT32 conv)
+{
+	// convs are often sequential, spread them with a multiplicative hash
+	IUINT32 h = conv * 2654435761u;
+	return (int)((h >> 16) % (IUINT32)svr->nshards);
+}
+
+ikcpmgr* ikcp_server_mgr(ikcpserver *svr, int shard)
+{
+	if (shard < 0 || shard >= svr->nshards) return NULL;
+	return svr->shards[shard].mgr;
+}
+
+iPosixThread* ikcp_server_thread(ikcpserver *svr, int shard)
+{
+	if (shard < 0 || shard >= svr->nshards) return NULL;
+	return svr->shards[shard].thread;
+}
+
+
+//---------------------------------------------------------------------
+// handoff from other threads
+//---------------------------------------------------------------------
+int ikcp_server_input(ikcpserver *svr, const char *data, long size,
+	const void *addr, int addrlen)
+{
+	IUINT32 conv;
+	long run;
+	int hr = 0;
+	if (data == NULL) return -2;
+	run = ikcp_input_run(data, size, &conv);
+	if (run == 0) return -2;
+	// a coalescing peer packs several convs into one datagram: hand
+	// each run of segments with the same conv to its own shard
+	for (; run > 0; run = ikcp_input_run(data, size, &conv)) {
+		ikcpsvrnode *node;
+		node = ikcp_node_new(IKCP_SVR_CMD_INPUT, conv, addr, addrlen,
+			data, run);
+		if (node == NULL) return -2;
+		if (ikcp_shard_push(&svr->shards[ikcp_server_shard(svr, conv)],
+			node) != 0) {
+			hr = -1;
+		}
+		data += run;
+		size -= run;
+	}
+	return hr;
+}
+
+int ikcp_server_send(ikcpserver *svr, IUINT32 conv, const void *addr,
+	int addrlen, const char *data, long size)
+{
+	ikcpsvrnode *node;
+	node = ikcp_node_new(IKCP_SVR_CMD_SEND, conv, addr, addrlen,
+		data, size);
+	if (node == NULL) return -2;
+	return ikcp_shard_push(&svr->shards[ikcp_server_shard(svr, conv)],
+		node);
+}
+
+
+//---------------------------------------------------------------------
+// statistics
+//---------------------------------------------------------------------
+void ikcp_server_stats(const ikcpserver *svr, int shard, long *sessions,
+	long *queued, long *dropped)
+{
+	const ikcpshard *s;
+	if (shard < 0 || shard >= svr->nshards) return;
+	s = &svr->shards[shard];
+	if (sessions) sessions[0] = s->mgr->count;
+	if (queued) queued[0] = s->queued;
+	if (dropped) dropped[0] = s->dropped;
+}
+
+
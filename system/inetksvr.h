@@ -0,0 +1,99 @@
+//=====================================================================
+//
+// inetksvr.h - multi-threaded kcp server
+//
+// NOTE:
+// for more information, please see the readme file.
+//
+//=====================================================================
+#ifndef __INETKSVR_H__
+#define __INETKSVR_H__
+
+#include "inetbase.h"
+#include "inetkcp.h"
+
+
+//---------------------------------------------------------------------
+// server: one session manager per shard thread, conversations are
+// pinned to shards by conv hash
+//---------------------------------------------------------------------
+#define IKCP_SVR_SHARD_MAX		256
+#define IKCP_SVR_QUEUE_MAX		65536	// datagrams queued per shard
+
+#define IKCP_SVR_ACCEPT			1		// open sessions for unknown conv
+
+#define IKCP_SVR_EVT_NEW		0		// session accepted, configure it
+#define IKCP_SVR_EVT_DATA		1		// session got input
+#define IKCP_SVR_EVT_TICK		2		// end of each loop, session NULL
+
+struct IKCPSERVER;
+typedef struct IKCPSERVER ikcpserver;
+
+// called in the shard thread, the only place to touch its sessions
+typedef void (*ikcpsvr_handler)(ikcpserver *svr, int shard, int event,
+	ikcpsess *session, void *user);
+
+// called in the shard thread with the datagrams of one loop
+typedef int (*ikcpsvr_output)(const ikcppacket *packets, int count,
+	ikcpserver *svr, int shard, void *user);
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//---------------------------------------------------------------------
+// interface
+//---------------------------------------------------------------------
+
+// create a server of nshards session managers, flags can be
+// IKCP_SVR_ACCEPT, output is required
+ikcpserver* ikcp_server_new(int nshards, int flags, ikcpsvr_output output,
+	void *user);
+
+// delete server, stops it first
+void ikcp_server_delete(ikcpserver *svr);
+
+// start shard threads, interval is the longest sleep of each loop
+int ikcp_server_start(ikcpserver *svr, ikcpsvr_handler handler,
+	IUINT32 interval);
+
+// stop shard threads
+void ikcp_server_stop(ikcpserver *svr);
+
+// get shard count
+int ikcp_server_count(const ikcpserver *svr);
+
+// shard which owns the conversation
+int ikcp_server_shard(const ikcpserver *svr, IUINT32 conv);
+
+// session manager of the shard, only use it in the shard thread
+ikcpmgr* ikcp_server_mgr(ikcpserver *svr, int shard);
+
+// thread of the shard, for affinity or priority before start
+iPosixThread* ikcp_server_thread(ikcpserver *svr, int shard);
+
+// hand a datagram from a udp reader to its shard, thread safe and
+// lock free. datagrams of a coalescing peer (mgr->coalesce) are split
+// by conv first. returns -1 when a shard queue is full (that part is
+// dropped, kcp will resend it), -2 for malformed datagram
+int ikcp_server_input(ikcpserver *svr, const char *data, long size,
+	const void *addr, int addrlen);
+
+// queue a message for a session from any thread, returns -1 when the
+// queue is full. it is dropped in the shard if the session is gone
+int ikcp_server_send(ikcpserver *svr, IUINT32 conv, const void *addr,
+	int addrlen, const char *data, long size);
+
+// shard statistics, each pointer can be NULL
+void ikcp_server_stats(const ikcpserver *svr, int shard, long *sessions,
+	long *queued, long *dropped);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+
@@ -36,6 +36,8 @@ void isim_transfer_init(iSimTransfer *trans, long rtt, long lost, long amb,
 	trans->cnt_send = 0;
 	trans->cnt_drop = 0;
 	trans->mode = mode;
+	trans->bandwidth = 0;
+	trans->busy = 0;
 	ilist_init(&trans->head);
 }
 
@@ -52,6 +54,7 @@ void isim_transfer_destroy(iSimTransfer *trans)
 		free(packet);
 	}
 	trans->size = 0;
+	trans->busy = 0;
 	trans->cnt_send = 0;
 	trans->cnt_drop = 0;
 	ilist_init(&trans->head);
@@ -127,6 +130,14 @@ long isim_transfer_send(iSimTransfer *trans, const void *data, long size)
 	if (wave < 0) feature = trans->current;
 	else feature = trans->current + wave;
 
+	// 限速：等待前面的包发送完毕
+	if (trans->bandwidth > 0) {
+		double start = (double)trans->current;
+		if (trans->busy > start) start = trans->busy;
+		trans->busy = start + (size * 1000.0) / trans->bandwidth;
+		feature += (long)(trans->busy - (double)trans->current);
+	}
+
 	packet->timestamp = feature;
 
 	// 按到达时间先后插入时间链表
@@ -276,3 +287,14 @@ void isim_seed(iSimNet *simnet, unsigned long seed1, unsigned long seed2)
 	simnet->t2.seed = seed2;
 }
 
+//---------------------------------------------------------------------
+// 设置带宽
+//---------------------------------------------------------------------
+void isim_bandwidth(iSimNet *simnet, long bandwidth)
+{
+	assert(simnet);
+	simnet->t1.bandwidth = bandwidth;
+	simnet->t2.bandwidth = bandwidth;
+}
+
+
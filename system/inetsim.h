@@ -119,6 +119,8 @@ struct ISIMTRANSFER
 	long lost;						// 丢包率百分比(0-100)
 	long amb;						// 延迟振幅百分比(0-100)
 	int mode;						// 模式0(会前后到达)1(顺序到达)
+	long bandwidth;					// 带宽字节每秒(0为不限)
+	double busy;					// 链路空闲的时间
 	long cnt_send;					// 发送了多少个包
 	long cnt_drop;					// 丢失了多少个包
 };
@@ -208,6 +210,9 @@ iSimPeer *isim_peer(iSimNet *simnet, int peerno);
 // 设置随机数种子
 void isim_seed(iSimNet *simnet, unsigned long seed1, unsigned long seed2);
 
+// 设置带宽：字节每秒，0为不限，超出带宽的包在链路上排队
+void isim_bandwidth(iSimNet *simnet, long bandwidth);
+
 
 
 #ifdef __cplusplus
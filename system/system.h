@@ -411,6 +411,11 @@ public:
 		return iposix_thread_affinity(_thread, cpumask) == 0? true : false;
 	}
 
+	// 设置运行的 cpu 集合，支持 64 个以上的 cpu，开始前设置则在启动时生效
+	bool set_affinity(const iCpuSet *cpuset) {
+		return iposix_thread_set_affinity(_thread, cpuset) == 0? true : false;
+	}
+
 	// 设置信号
 	void set_signal(int sig) {
 		iposix_thread_set_signal(_thread, sig);
@@ -426,6 +431,11 @@ public:
 		return iposix_thread_get_name(_thread);
 	}
 
+	// 是否是当前线程
+	bool is_current() const {
+		return (iposix_thread_current() == _thread)? true : false;
+	}
+
 	// 以下为线程内部调用的静态成员
 
 	// 取得当前线程名称
@@ -1023,6 +1033,11 @@ public:
 		async_core_notify(_core);
 	}
 
+	// 取得底层对象，用于 TaskPool::attach 等需要直接唤醒的场合
+	CAsyncCore* get_core() {
+		return _core;
+	}
+
 	// 读取消息，返回消息长度 
 	// 如果没有消息，返回-1
 	// event的值为： ASYNC_CORE_EVT_NEW/LEAVE/ESTAB/DATA等
@@ -1036,6 +1051,12 @@ public:
 		return async_core_read(_core, event, wparam, lparam, data, maxsize);
 	}
 
+	// 批量读取：一次加锁最多取出 count 个消息，数据依次放入 payload，
+	// 每个消息的位置和长度见 events[i].offset/size，返回消息数量
+	int read_batch(CAsyncEvent *events, int count, void *payload, long capacity) {
+		return async_core_read_batch(_core, events, count, payload, capacity);
+	}
+
 	// 向某连接发送数据，hid为连接标识
 	long send(long hid, const void *data, long size) {
 		return async_core_send(_core, hid, data, size);
@@ -1046,6 +1067,11 @@ public:
 		return async_core_close(_core, hid, code);
 	}
 
+	// 批量发送：一次加锁发送 count 个数据包到各自的 hid，返回成功数量
+	int send_many(const long hids[], const void * const ptrs[], const long lens[], int count, long results[] = NULL) {
+		return async_core_send_many(_core, hids, ptrs, lens, count, results);
+	}
+
 	// 发送矢量：免得多次 memcpy
 	long send(long hid, const void *vecptr[], long veclen[], int count, int mask = 0) {
 		return async_core_send_vector(_core, hid, vecptr, veclen, count, mask);
@@ -1070,6 +1096,11 @@ public:
 	long new_dgram(const struct sockaddr *addr, int len, int mode = 0) {
 		return async_core_new_dgram(_core, addr, len, mode);
 	}
+
+	// 批量发送数据报：sendmmsg 一次提交，返回实际发出的个数
+	int send_packets(long hid, const void * const ptrs[], const long lens[], const struct sockaddr * const remotes[], const int addrlens[], int count) {
+		return async_core_send_packets(_core, hid, ptrs, lens, remotes, addrlens, count);
+	}
 	
 
 	// 取得连接类型：ASYNC_CORE_NODE_IN/OUT/LISTEN4/LISTEN6/ASSIGN
@@ -1126,6 +1157,11 @@ public:
 		async_core_timeout(_core, seconds);
 	}
 
+	// 读取事件循环发布的计数器和延迟直方图，不会等待 wait 返回
+	void stats(CAsyncStats *stats) {
+		async_core_stats(_core, stats);
+	}
+
 	// 禁止接收某连接数据（打开后连断开都无法检测到，最好设置超时）
 	int disable(long hid, bool value) {
 		return async_core_disable(_core, hid, value? 1 : 0);
@@ -1819,11 +1855,54 @@ inline std::ostream & operator << (std::ostream & os, const DateTime &m) {
 
 
 
+//---------------------------------------------------------------------
+// 任务取消令牌：多个任务可以共享同一个令牌，令牌的生命周期必须长于
+// 引用它的任务。取消以后尚未开始运行的任务将不再运行，直接调用 error
+//---------------------------------------------------------------------
+class TaskToken
+{
+public:
+	TaskToken() { _cancelled = 0; }
+	virtual ~TaskToken() {}
+
+	// 取消：正在运行的任务可以在 run() 里面轮询 cancelled() 提前退出
+	void cancel() { _cancelled = 1; iatomic_fence(); }
+
+	// 恢复
+	void reset() { _cancelled = 0; iatomic_fence(); }
+
+	// 是否已经取消
+	bool cancelled() const { return _cancelled != 0; }
+
+protected:
+	volatile int _cancelled;
+};
+
+
 //---------------------------------------------------------------------
 // 线程任务接口
 //---------------------------------------------------------------------
 struct TaskInt
 {
+	// 优先级：数值越小越优先，高优先级的任务不会排在低优先级任务后面
+	enum Priority {
+		PriorityCritical = 0,
+		PriorityHigh = 1,
+		PriorityNormal = 2,
+		PriorityBulk = 3,
+		PriorityCount = 4,
+	};
+
+	// 结束状态：由线程池设置，error() 里面可以据此判断原因
+	enum Status {
+		StatusOk = 0,			// run 正常结束
+		StatusException = 1,	// run 抛出异常
+		StatusExpired = 2,		// 超过截止时间没有开始，未运行
+		StatusCancelled = 3,	// 令牌已取消，未运行
+	};
+
+	TaskInt(): priority(PriorityNormal), deadline(0), token(NULL), status(StatusOk) {}
+
 	// 任务线程池执行完一个任务就会自动删除任务，但是如果任务还没有执
 	// 行，任务线程池就析构了的话，有可能下面的run/done/error/final都
 	// 没有调用到，任务就会提前被删除
@@ -1835,11 +1914,19 @@ struct TaskInt
 	// 主线程调用，如果 run 没有抛出异常（多线程里尽量别异常）
 	virtual void done() {}
 
-	// 主线程调用，如果 run 抛出异常，则调用这里
+	// 主线程调用，如果 run 抛出异常，过期或者被取消，则调用这里
 	virtual void error() {}
 
 	// 主线程调用，结束调用，释放资源用
 	virtual void final() {}
+
+	// 设置超时：push 以后 timeout 毫秒内没有开始运行则直接调用 error
+	void set_timeout(IUINT32 timeout) { deadline = iclock64() + timeout; }
+
+	int priority;		// 优先级，push 之前设置，默认 PriorityNormal
+	IINT64 deadline;	// 截止时间（iclock64 毫秒），0 为不限制
+	TaskToken *token;	// 取消令牌，NULL 为不可取消
+	int status;			// 结束状态
 };
 
 
@@ -1850,8 +1937,9 @@ class TaskPool
 {
 public:
 
-	// 开始：设定名称以及线程数量
-	TaskPool(const char *name, int nthreads, int slap = 50) {
+	// 开始：设定名称以及线程数量，stealing 为 true 时启用工作窃取模式：
+	// 每个工作线程拥有自己的双端队列，空闲时随机窃取其他线程的任务
+	TaskPool(const char *name, int nthreads, int slap = 50, bool stealing = false) {
 		_name = name;
 		if (nthreads < 1) {
 			SYSTEM_THROW("nthreads must great than zero", 10009);
@@ -1873,6 +1961,28 @@ public:
 		_start = false;
 		_slap = slap;
 		_nthreads = nthreads;
+		_stealing = stealing;
+		_sleepers = 0;
+		_expired = 0;
+		_cancelled = 0;
+		_pending = 0;
+		_notify = NULL;
+		_pin_mode = ICPU_PIN_NONE;
+		_pin_node = -1;
+		for (int i = 0; i < TaskInt::PriorityCount; i++) {
+			_depth[i] = 0;
+		}
+		if (stealing) {
+			_workers.resize(nthreads);
+			for (int i = 0; i < nthreads; i++) {
+				_workers[i] = new Worker;
+				_workers[i]->deque = work_deque_new();
+				_workers[i]->seed = (IUINT32)(i * 0x9e3779b9u + 1);
+				if (_workers[i]->deque == NULL) {
+					SYSTEM_THROW("can not create deque for TaskPool", 10013);
+				}
+			}
+		}
 	}
 
 	// 结束线程池并删除未完成的任务
@@ -1891,12 +2001,27 @@ public:
 			node->task = NULL;
 			delete node;
 		}
-		while (1) {
-			if (_queue_in.get(&obj, 0) == 0) break;
-			node = (TaskNode*)obj;
-			delete node->task;
-			node->task = NULL;
-			delete node;
+		for (int i = 0; i < TaskInt::PriorityCount; i++) {
+			while (1) {
+				if (_queue_in[i].get(&obj, 0) == 0) break;
+				node = (TaskNode*)obj;
+				delete node->task;
+				node->task = NULL;
+				delete node;
+			}
+		}
+		for (int i = 0; i < (int)_workers.size(); i++) {
+			Worker *w = _workers[i];
+			while (work_deque_pop(w->deque, &obj) || w->mailbox.get(&obj, 0)) {
+				node = (TaskNode*)obj;
+				delete node->task;
+				node->task = NULL;
+				delete node;
+			}
+			work_deque_delete(w->deque);
+			w->deque = NULL;
+			delete w;
+			_workers[i] = NULL;
 		}
 	}
 
@@ -1904,6 +2029,7 @@ public:
 	inline bool start() {
 		if (_start) return true;
 		_stop = false;
+		__placement();
 		for (int i = 0; i < _nthreads; i++) {
 			_threads[i]->set_signal(i);
 			_threads[i]->start();
@@ -1912,10 +2038,36 @@ public:
 		return true;
 	}
 
+	// 设置工作线程的绑定方式，start 之前调用：ICPU_PIN_CORE 每个线程
+	// 绑定一个物理核心（含超线程），ICPU_PIN_NODE 绑定一个 NUMA 节点；
+	// node >= 0 时所有线程都限制在该节点内，避免在多个 socket 间迁移，
+	// node 为系统的 NUMA 节点编号（同 numactl），ICPU_NODE_CURRENT 表示
+	// 调用 start 的线程当前所在的节点
+	inline void set_placement(int mode, int node = -1) {
+		_pin_mode = mode;
+		_pin_node = node;
+	}
+
+	// 将调用线程（比如运行 AsyncCore 的线程）绑定到工作线程所在的节点，
+	// 未指定节点时绑定到调用线程当前所在的节点
+	inline bool colocate() {
+		iCpuTopology *topo = icpu_topology_new();
+		iCpuSet cpuset;
+		if (topo == NULL) return false;
+		int node = (_pin_node >= 0)? _pin_node : ICPU_NODE_CURRENT;
+		int hr = icpu_topology_place(topo, ICPU_PIN_NODE, node, 0, &cpuset);
+		icpu_topology_delete(topo);
+		if (hr <= 0) return false;
+		return (icpu_affinity_current(&cpuset) == 0)? true : false;
+	}
+
 	// 结束线程
 	inline void stop() {
 		if (_start == false) return;
 		_stop = true;
+		_park.enter();
+		_park.wake(true);
+		_park.leave();
 		for (int i = 0; i < _nthreads; i++) {
 			_threads[i]->set_notalive();
 			_threads[i]->join();
@@ -1923,86 +2075,301 @@ public:
 		_start = false;
 	}
 
-	// 放入任务
-	inline bool push(TaskInt *task) {
+	// 放入任务，按照 task->priority 进入对应的队列，高优先级先执行；
+	// affinity >= 0 时（仅窃取模式）优先交给对应的工作线程，该线程繁忙
+	// 时仍然可能被其他空闲线程窃取
+	inline bool push(TaskInt *task, int affinity = -1) {
 		if (_stop) return false;
 		TaskNode *node = new TaskNode;
 		node->task = task;
-		if (_queue_in.put(node, 0) == 0) return false;
+		node->priority = __priority(task);
+		// 计数必须先于发布，否则任务可能被取走执行完毕后才计数
+		iatomic_add(&_depth[node->priority], 1);
+		iatomic_add(&_pending, 1);
+		if (_stealing && affinity >= 0) {
+			Worker *w = _workers[affinity % _nthreads];
+			if (w->mailbox.put(node, 0) == 0) {
+				iatomic_add(&_depth[node->priority], -1);
+				iatomic_add(&_pending, -1);
+				delete node;
+				return false;
+			}
+		}
+		else if (_queue_in[node->priority].put(node, 0) == 0) {
+			iatomic_add(&_depth[node->priority], -1);
+			iatomic_add(&_pending, -1);
+			delete node;
+			return false;
+		}
+		iatomic_fence();
+		if (_sleepers > 0) {
+			__wakeup();
+		}
+		return true;
+	}
+
+	// 在工作线程的 run() 中派生子任务：窃取模式下放入当前线程的本地
+	// 队列（空闲线程会来窃取），其他情况等同于 push
+	inline bool spawn(TaskInt *task) {
+		int index = __current_worker();
+		if (index < 0) return push(task);
+		if (_stop) return false;
+		TaskNode *node = new TaskNode;
+		node->task = task;
+		node->priority = __priority(task);
+		iatomic_add(&_depth[node->priority], 1);
+		iatomic_add(&_pending, 1);
+		if (work_deque_push(_workers[index]->deque, node) != 0) {
+			iatomic_add(&_depth[node->priority], -1);
+			iatomic_add(&_pending, -1);
+			delete node;
+			return false;
+		}
+		if (_sleepers > 0) {
+			__wakeup();
+		}
 		return true;
 	}
 
 	// 更新：在主线程处理任务的结果，调用任务的 done/error/final方法，循环调用
-	inline void update() {
+	// millisec 为没有结果时最多等待的毫秒数，默认不等待，返回处理的任务数
+	inline int update(unsigned long millisec = 0) {
+		int count = 0;
 		while (1) {
 			void *objs[64];
-			int hr = _queue_out.get_many(objs, 64, 0);
+			int hr = _queue_out.get_many(objs, 64, (count == 0)? millisec : 0);
 			if (hr == 0) break;
 			for (int i = 0; i < hr; i++) {
-				TaskNode *node = (TaskNode*)objs[i];
-				TaskInt *task = node->task;
-				if (node->ok) {
-					try { task->done(); }
-					catch (...) {}
-				}	else {
-					try { task->error(); }
-					catch (...) {}
-				}
-				try { task->final(); }
-				catch (...) { }
-				delete node->task;
-				node->task = NULL;
-				delete node;
+				__task_finish((TaskNode*)objs[i]);
 			}
+			count += hr;
 		}
+		return count;
 	}
 
-	// 取得未执行完成的任务数量
+	// 取得未执行完成的任务数量：包括排队中，正在运行以及等待 update 的
 	inline int size() {
-		int x1, x2;
-		x1 = (int)_queue_in.size();
-		x2 = (int)_queue_out.size();
-		return x1 + x2;
+		return (int)_pending;
 	}
 
-	// 等待所有任务结束
+	// 等待所有任务结束：阻塞在结果队列上，任务完成后立即处理，_slap 只是
+	// 单次等待的上限，防止线程池尚未启动时永久阻塞
 	inline void wait() {
-		while (size() > 0) {
-			update();
-			isleep(_slap);
+		while (_pending > 0) {
+			update(_slap);
 		}
 	}
 
+	// 绑定 CAsyncCore：任务完成后调用 async_core_notify 唤醒其 wait，
+	// 事件循环醒来以后调用 update 即可及时处理结果，NULL 为取消绑定
+	inline void attach(CAsyncCore *core) {
+		_notify = core;
+		iatomic_fence();
+	}
+
+	// 取得某个优先级还没有开始运行的任务数量
+	inline int depth(int priority) const {
+		if (priority < 0 || priority >= TaskInt::PriorityCount) return 0;
+		return (int)_depth[priority];
+	}
+
+	// 取得因为超时而没有运行的任务总数
+	inline long expired() const { return _expired; }
+
+	// 取得因为取消而没有运行的任务总数
+	inline long cancelled() const { return _cancelled; }
+
 protected:
-	struct TaskNode { TaskInt *task; bool ok; };
+	struct TaskNode { TaskInt *task; int priority; };
+
+	// 窃取模式下每个工作线程的数据：本地双端队列以及亲和任务信箱
+	struct Worker { iWorkDeque *deque; Queue mailbox; IUINT32 seed; };
 
-	// 处理一个任务
+	// 处理一个任务：已经取消或者过期的任务不再运行
 	inline void __task_invoke(TaskNode *node) {
-		node->ok = true;
-		try { node->task->run(); }
-		catch (...) { node->ok = false; }
+		TaskInt *task = node->task;
+		iatomic_add(&_depth[node->priority], -1);
+		task->status = TaskInt::StatusOk;
+		if (task->token && task->token->cancelled()) {
+			task->status = TaskInt::StatusCancelled;
+			iatomic_add(&_cancelled, 1);
+		}
+		else if (task->deadline != 0 && iclock64() >= task->deadline) {
+			task->status = TaskInt::StatusExpired;
+			iatomic_add(&_expired, 1);
+		}
+		else {
+			try { task->run(); }
+			catch (...) { task->status = TaskInt::StatusException; }
+		}
 		_queue_out.put(node, IEVENT_INFINITE);
+		CAsyncCore *core = _notify;
+		if (core != NULL) {
+			async_core_notify(core);
+		}
+	}
+
+	// 在主线程里结束一个任务：调用 done/error 以及 final 然后删除
+	inline void __task_finish(TaskNode *node) {
+		TaskInt *task = node->task;
+		if (task->status == TaskInt::StatusOk) {
+			try { task->done(); }
+			catch (...) {}
+		}	else {
+			try { task->error(); }
+			catch (...) {}
+		}
+		try { task->final(); }
+		catch (...) { }
+		delete node->task;
+		node->task = NULL;
+		delete node;
+		iatomic_add(&_pending, -1);
+	}
+
+	// 取得合法的优先级
+	static inline int __priority(const TaskInt *task) {
+		int priority = task->priority;
+		if (priority < 0) return 0;
+		if (priority >= TaskInt::PriorityCount) 
+			return TaskInt::PriorityCount - 1;
+		return priority;
+	}
+
+	// 按照优先级从全局队列取出一个任务，没有则返回 NULL
+	inline TaskNode *__task_fetch_global(int lowest) {
+		void *obj;
+		for (int i = 0; i <= lowest; i++) {
+			if (_depth[i] <= 0) continue;
+			if (_queue_in[i].get(&obj, 0)) 
+				return (TaskNode*)obj;
+		}
+		return NULL;
+	}
+
+	// 没有任务时休眠，直到 push 唤醒或者超时
+	inline void __task_park() {
+		_park.enter();
+		_sleepers++;
+		iatomic_fence();
+		if (_stop == false && __task_empty()) {
+			_park.sleep(_slap);
+		}
+		_sleepers--;
+		_park.leave();
 	}
 
 	// 线程单次调用入口
 	inline int __run() {
 		if (_stop) return 0;
-		if (_nthreads > 1) {
-			void *obj;
-			int hr = _queue_in.get(&obj, (IUINT32)_slap);
-			if (hr == 0) return 1;
-			__task_invoke((TaskNode*)obj);
-		}	else {
-			void *objs[16];
-			int hr = _queue_in.get_many(objs, 16, (IUINT32)_slap);
-			if (hr == 0) return 1;
-			for (int i = 0; i < hr; i++) {
-				__task_invoke((TaskNode*)objs[i]);
-			}
+		if (_stealing) {
+			return __run_stealing(Thread::CurrentSignal());
 		}
+		TaskNode *node = __task_fetch_global(TaskInt::PriorityCount - 1);
+		if (node == NULL) {
+			__task_park();
+			return 1;
+		}
+		__task_invoke(node);
 		return 1;
 	}
 
+	// 窃取模式：紧急任务 -> 本地队列 -> 信箱 -> 全局队列 -> 随机窃取 -> 休眠
+	inline int __run_stealing(int index) {
+		TaskNode *node = __task_fetch(index);
+		if (node) {
+			__task_invoke(node);
+			return 1;
+		}
+		__task_park();
+		return 1;
+	}
+
+	// 窃取模式下取得一个任务，没有则返回 NULL
+	inline TaskNode *__task_fetch(int index) {
+		Worker *w = _workers[index];
+		TaskNode *node;
+		void *objs[16];
+		int hr = 0;
+		node = __task_fetch_global(TaskInt::PriorityHigh);
+		if (node) 
+			return node;
+		if (work_deque_pop(w->deque, &objs[0])) 
+			return (TaskNode*)objs[0];
+		if (w->mailbox.get(&objs[0], 0)) 
+			return (TaskNode*)objs[0];
+		// 从全局队列批量取出，多余的放入本地队列供其他线程窃取
+		for (int i = TaskInt::PriorityNormal; i < TaskInt::PriorityCount; i++) {
+			if (_depth[i] <= 0) continue;
+			hr = _queue_in[i].get_many(objs, 16, 0);
+			if (hr > 0) break;
+		}
+		if (hr > 0) {
+			for (int i = 1; i < hr; i++) {
+				if (work_deque_push(w->deque, objs[i]) != 0) {
+					__task_invoke((TaskNode*)objs[i]);
+				}
+			}
+			if (hr > 1 && _sleepers > 0) __wakeup();
+			return (TaskNode*)objs[0];
+		}
+		for (int i = 0; i < _nthreads; i++) {
+			w->seed ^= w->seed << 13;
+			w->seed ^= w->seed >> 17;
+			w->seed ^= w->seed << 5;
+			int victim = (int)(w->seed % (IUINT32)_nthreads);
+			if (victim == index) continue;
+			Worker *v = _workers[victim];
+			if (work_deque_steal(v->deque, &objs[0]) > 0) 
+				return (TaskNode*)objs[0];
+			if (v->mailbox.get(&objs[0], 0)) 
+				return (TaskNode*)objs[0];
+		}
+		return NULL;
+	}
+
+	// 是否没有待处理的任务
+	inline bool __task_empty() {
+		for (int i = 0; i < TaskInt::PriorityCount; i++) {
+			if (_queue_in[i].size() > 0) return false;
+		}
+		for (int i = 0; i < (int)_workers.size(); i++) {
+			if (work_deque_size(_workers[i]->deque) > 0) return false;
+			if (_workers[i]->mailbox.size() > 0) return false;
+		}
+		return true;
+	}
+
+	// 唤醒一个休眠的工作线程
+	inline void __wakeup() {
+		_park.enter();
+		if (_sleepers > 0) _park.wake();
+		_park.leave();
+	}
+
+	// 当前线程是本池的工作线程则返回序号，否则返回 -1
+	inline int __current_worker() const {
+		if (_stealing == false) return -1;
+		int index = Thread::CurrentSignal();
+		if (index < 0 || index >= _nthreads) return -1;
+		if (_threads[index]->is_current() == false) return -1;
+		return index;
+	}
+
+	// 按照 set_placement 的设置为每个工作线程计算并设置 cpu 集合
+	inline void __placement() {
+		if (_pin_mode == ICPU_PIN_NONE) return;
+		iCpuTopology *topo = icpu_topology_new();
+		if (topo == NULL) return;
+		for (int i = 0; i < _nthreads; i++) {
+			iCpuSet cpuset;
+			if (icpu_topology_place(topo, _pin_mode, _pin_node, i, &cpuset) > 0) {
+				_threads[i]->set_affinity(&cpuset);
+			}
+		}
+		icpu_topology_delete(topo);
+	}
+
 	// 线程静态入口
 	static int __thread_entry(void *p) {
 		TaskPool *self = (TaskPool*)p;
@@ -2013,12 +2380,23 @@ protected:
 protected:
 	bool _stop;
 	bool _start;
+	bool _stealing;
 	int _nthreads;
 	int _slap;
-	Queue _queue_in;
+	volatile int _sleepers;
+	volatile long _depth[TaskInt::PriorityCount];
+	volatile long _expired;
+	volatile long _cancelled;
+	volatile long _pending;
+	CAsyncCore * volatile _notify;
+	int _pin_mode;
+	int _pin_node;
+	Queue _queue_in[TaskInt::PriorityCount];
 	Queue _queue_out;
+	ConditionLock _park;
 	std::string _name;
 	std::vector<Thread*> _threads;
+	std::vector<Worker*> _workers;
 };
 
 